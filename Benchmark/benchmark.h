@@ -0,0 +1,199 @@
+﻿#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+/**
+	@item benchmark
+	@brief 线程池基准测试的公共部分：计时、延迟分位数、输出格式、和基线比较，不依赖具体的线程池
+**/
+
+// 每个结果输出一行：线程池名\t用例名\t数值\t单位，两个线程池同样的测试用的是同样的用例名，输出可以直接对比
+// 用法：程序 [--quick] [--filter 子串] [--baseline 基线文件]
+//   --quick     任务数减少到十分之一，用来快速检查
+//   --filter    只运行用例名包含该子串的测试
+//   --baseline  和之前保存的输出比较，每行后面加上基线的数值和变化；基线里没有本线程池的结果时按用例名和另一个线程池比较
+// 单位以/s结尾的数值越大越好，其它（ns、us、ms）越小越好
+
+// 当前时间，单位：纳秒
+inline uint64_t benchNow()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 延迟样本的分位数，单位：纳秒
+struct LatencyStats
+{
+	uint64_t p50 = 0;
+	uint64_t p90 = 0;
+	uint64_t p99 = 0;
+	uint64_t max = 0;
+};
+
+inline LatencyStats computeLatency(std::vector<uint64_t> samples)
+{
+	LatencyStats stats;
+	if (samples.empty())
+		return stats;
+	std::sort(samples.begin(), samples.end());
+	auto at = [&](double q) { return samples[std::min(samples.size() - 1, (size_t)(q * samples.size()))]; };
+	stats.p50 = at(0.50);
+	stats.p90 = at(0.90);
+	stats.p99 = at(0.99);
+	stats.max = samples.back();
+	return stats;
+}
+
+// 测试用的一小段计算，编译器不会优化掉
+inline uint64_t benchWork(int iterations)
+{
+	volatile uint64_t sum = 0;
+	for (int i = 0; i < iterations; i++)
+		sum = sum + (uint64_t)i * i;
+	return sum;
+}
+
+class BenchRunner
+{
+public:
+	BenchRunner(const std::string& pool, int argc, char** argv)
+		: pool_(pool)
+		, quick_(false)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			if (std::strcmp(argv[i], "--quick") == 0)
+				quick_ = true;
+			else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+				filter_ = argv[++i];
+			else if (std::strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+				loadBaseline(argv[++i]);
+			else
+				std::cerr << "unknown argument: " << argv[i] << std::endl;
+		}
+		std::cout << "# pool=" << pool_
+			<< " hardware_concurrency=" << std::thread::hardware_concurrency()
+			<< " quick=" << (quick_ ? 1 : 0) << std::endl;
+	}
+
+	// 按--quick缩小任务数
+	int scale(int count) const
+	{
+		return quick_ ? std::max(count / 10, 1) : count;
+	}
+
+	// 用例名包含name的测试是否要运行，一组用例共用前缀时用前缀判断
+	bool enabled(const std::string& name) const
+	{
+		return filter_.empty() || name.find(filter_) != std::string::npos || filter_.find(name) != std::string::npos;
+	}
+
+	// 线程数的扫描范围：1, 2, 4, ...直到CPU核数，最后一个是CPU核数本身，至少测到2个线程
+	std::vector<int> threadCounts() const
+	{
+		int hardware = std::max((int)std::thread::hardware_concurrency(), 2);
+		std::vector<int> counts;
+		for (int i = 1; i < hardware; i *= 2)
+			counts.push_back(i);
+		counts.push_back(hardware);
+		return counts;
+	}
+
+	// 输出一个结果，有基线时附上基线的数值和变化
+	void report(const std::string& name, double value, const std::string& unit)
+	{
+		if (!filter_.empty() && name.find(filter_) == std::string::npos)
+			return;
+
+		char text[64];
+		std::snprintf(text, sizeof(text), "%.6g", value);
+		std::cout << pool_ << '\t' << name << '\t' << text << '\t' << unit;
+
+		double base = 0;
+		if (findBaseline(name, base) && base > 0)
+		{
+			double change = (value - base) / base * 100;
+			bool higherIsBetter = unit.size() >= 2 && unit.compare(unit.size() - 2, 2, "/s") == 0;
+			bool better = higherIsBetter ? change > 0 : change < 0;
+			std::snprintf(text, sizeof(text), "%.6g\t%+.1f%%", base, change);
+			std::cout << '\t' << text << '\t' << (change == 0 ? "same" : (better ? "better" : "worse"));
+		}
+		std::cout << std::endl;
+	}
+
+	// 输出一组延迟分位数，单位换算成微秒
+	void reportLatency(const std::string& name, const std::vector<uint64_t>& samples)
+	{
+		LatencyStats stats = computeLatency(samples);
+		report(name + "/p50", stats.p50 / 1000.0, "us");
+		report(name + "/p90", stats.p90 / 1000.0, "us");
+		report(name + "/p99", stats.p99 / 1000.0, "us");
+		report(name + "/max", stats.max / 1000.0, "us");
+	}
+
+private:
+	// 基线文件就是之前的输出，#开头的行是注释
+	void loadBaseline(const char* path)
+	{
+		std::ifstream in(path);
+		if (!in)
+		{
+			std::cerr << "can not open baseline: " << path << std::endl;
+			return;
+		}
+		std::string line;
+		while (std::getline(in, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+			std::istringstream fields(line);
+			std::string pool, name, value;
+			if (!std::getline(fields, pool, '\t') || !std::getline(fields, name, '\t') || !std::getline(fields, value, '\t'))
+				continue;
+			baseline_[pool][name] = std::atof(value.c_str());
+		}
+	}
+
+	// 先找本线程池的基线，基线里没有本线程池时，按用例名找另一个线程池的结果
+	bool findBaseline(const std::string& name, double& value) const
+	{
+		auto self = baseline_.find(pool_);
+		if (self != baseline_.end())
+		{
+			auto it = self->second.find(name);
+			if (it == self->second.end())
+				return false;
+			value = it->second;
+			return true;
+		}
+		for (auto& pool : baseline_)
+		{
+			auto it = pool.second.find(name);
+			if (it != pool.second.end())
+			{
+				value = it->second;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::string pool_;    // 输出里的线程池名
+	bool quick_;          // 减少任务数
+	std::string filter_;  // 只运行用例名包含该子串的测试
+	std::map<std::string, std::map<std::string, double>> baseline_; // 线程池名 => 用例名 => 数值
+};
+
+#endif
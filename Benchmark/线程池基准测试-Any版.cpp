@@ -0,0 +1,362 @@
+﻿// 线程池基准测试-Any版.cpp : ThreadPool（Any/Result版线程池）的基准测试，用例名和线程池基准测试-最终版.cpp相同
+// g++ -std=c++17 -O2 -pthread -I../ThreadPool 线程池基准测试-Any版.cpp ../ThreadPool/threadpool.cpp -o bench_any
+// ./bench_any > any.txt; ./bench_future --baseline any.txt   两个线程池逐项对比
+
+#include <future>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "threadpool.h"
+#include "benchmark.h"
+
+const int THROUGHPUT_TASK_SIZE = 200000;	// 吞吐量测试每轮提交的任务数
+const int LATENCY_SAMPLE_SIZE = 5000;		// 延迟测试的样本数
+const int PARKED_SAMPLE_SIZE = 500;			// 线程挂起之后再提交的延迟样本数，每个样本之间间隔1ms
+const int FANOUT_WIDTH = 64;				// 扇出测试每轮的子任务数
+const int FANOUT_ROUND_SIZE = 2000;			// 扇出测试的轮数
+const int FANOUT_WORK = 200;				// 扇出测试每个子任务的计算量
+const int CACHED_BURST_SIZE = 256;			// cached模式突发测试的任务数
+const int CACHED_TASK_TIME = 2;				// cached模式突发测试每个任务的时间，单位：毫秒
+
+struct PoolConfig
+{
+	const char* name;
+	PoolMode mode;
+};
+
+// 这个线程池没有无锁队列
+const PoolConfig POOL_CONFIGS[] = {
+	{ "fixed", PoolMode::MODE_FIXED },
+	{ "stealing", PoolMode::MODE_WORK_STEALING },
+};
+
+// 空任务，结果经过Any
+class EmptyTask : public Task
+{
+public:
+	Any run()
+	{
+		return Any();
+	}
+};
+
+// 空任务，结果不经过Any
+class EmptyTypedTask : public TypedTask<int>
+{
+public:
+	int call()
+	{
+		return 0;
+	}
+};
+
+// 记录从提交到开始执行的时间
+class LatencyTask : public Task
+{
+public:
+	LatencyTask(uint64_t& sample)
+		: sample_(sample)
+		, submitTime_(benchNow())
+	{}
+	Any run()
+	{
+		sample_ = benchNow() - submitTime_;
+		return Any();
+	}
+private:
+	uint64_t& sample_;
+	uint64_t submitTime_;
+};
+
+class WorkTask : public Task
+{
+public:
+	Any run()
+	{
+		return benchWork(FANOUT_WORK);
+	}
+};
+
+// 扇出的子任务，最后一个完成的通知外部线程
+class ChildTask : public Task
+{
+public:
+	ChildTask(std::atomic_int& remaining, std::shared_ptr<std::promise<void>> done)
+		: remaining_(remaining)
+		, done_(std::move(done))
+	{}
+	Any run()
+	{
+		benchWork(FANOUT_WORK);
+		if (--remaining_ == 0)
+			done_->set_value();
+		return Any();
+	}
+private:
+	std::atomic_int& remaining_;
+	std::shared_ptr<std::promise<void>> done_; // 最后一个子任务set_value的时候外部线程可能已经返回，promise由子任务共同持有
+};
+
+// 在线程池里面提交扇出的子任务
+class RootTask : public Task
+{
+public:
+	RootTask(ThreadPool& pool, std::atomic_int& remaining, std::shared_ptr<std::promise<void>> done)
+		: pool_(pool)
+		, remaining_(remaining)
+		, done_(std::move(done))
+	{}
+	Any run()
+	{
+		for (int i = 0; i < FANOUT_WIDTH; i++)
+		{
+			pool_.submitTask(std::make_shared<ChildTask>(remaining_, done_));
+		}
+		return Any();
+	}
+private:
+	ThreadPool& pool_;
+	std::atomic_int& remaining_;
+	std::shared_ptr<std::promise<void>> done_;
+};
+
+class SleepTask : public Task
+{
+public:
+	Any run()
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(CACHED_TASK_TIME));
+		return Any();
+	}
+};
+
+// 空任务的吞吐量随线程数的变化：提交线程一次提交完，再等所有的Result
+// -typed是同样的测试换成TypedTask/TypedResult
+void benchThroughput(BenchRunner& runner)
+{
+	int size = runner.scale(THROUGHPUT_TASK_SIZE);
+	for (const PoolConfig& config : POOL_CONFIGS)
+	{
+		for (int threads : runner.threadCounts())
+		{
+			string name = string("throughput/") + config.name + "/workers=" + to_string(threads);
+			if (runner.enabled(name))
+			{
+				ThreadPool pool;
+				pool.setMode(config.mode);
+				pool.start(threads);
+
+				vector<Result> results;
+				results.reserve(size);
+				uint64_t begin = benchNow();
+				for (int i = 0; i < size; i++)
+				{
+					results.emplace_back(pool.submitTask(std::make_shared<EmptyTask>()));
+				}
+				for (auto& result : results)
+				{
+					result.get();
+				}
+				runner.report(name, size / ((benchNow() - begin) / 1e9), "tasks/s");
+			}
+
+			name = string("throughput/") + config.name + "-typed/workers=" + to_string(threads);
+			if (runner.enabled(name))
+			{
+				ThreadPool pool;
+				pool.setMode(config.mode);
+				pool.start(threads);
+
+				vector<TypedResult<int>> results;
+				results.reserve(size);
+				uint64_t begin = benchNow();
+				for (int i = 0; i < size; i++)
+				{
+					results.emplace_back(pool.submitTask(std::make_shared<EmptyTypedTask>()));
+				}
+				for (auto& result : results)
+				{
+					result.get();
+				}
+				runner.report(name, size / ((benchNow() - begin) / 1e9), "tasks/s");
+			}
+		}
+	}
+}
+
+// 从提交到开始执行的延迟
+// idle：上一个任务刚执行完就提交；parked：等线程挂起之后再提交；burst：一次提交一批，包括排队时间
+void benchLatency(BenchRunner& runner)
+{
+	if (!runner.enabled("latency"))
+		return;
+	int threads = std::min((int)std::thread::hardware_concurrency(), 4);
+	ThreadPool pool;
+	pool.start(std::max(threads, 1));
+
+	auto sample = [&](int size, int gapMs) {
+		vector<uint64_t> samples(size);
+		for (int i = 0; i < size; i++)
+		{
+			if (gapMs > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(gapMs));
+			pool.submitTask(std::make_shared<LatencyTask>(samples[i])).get();
+		}
+		return samples;
+	};
+	runner.reportLatency("latency/idle", sample(runner.scale(LATENCY_SAMPLE_SIZE), 0));
+	runner.reportLatency("latency/parked", sample(runner.scale(PARKED_SAMPLE_SIZE), 1));
+
+	int size = runner.scale(LATENCY_SAMPLE_SIZE);
+	vector<uint64_t> samples(size);
+	vector<Result> results;
+	results.reserve(size);
+	for (int i = 0; i < size; i++)
+	{
+		results.emplace_back(pool.submitTask(std::make_shared<LatencyTask>(samples[i])));
+	}
+	for (auto& result : results)
+	{
+		result.get();
+	}
+	runner.reportLatency("latency/burst", samples);
+}
+
+// 扇出/扇入：external是外部线程提交一批子任务再等全部完成；nested是一个任务在线程池里面提交子任务，最后一个子任务完成时通知外部
+void benchFanout(BenchRunner& runner)
+{
+	int threads = std::max((int)std::thread::hardware_concurrency(), 2);
+	int rounds = runner.scale(FANOUT_ROUND_SIZE);
+	string width = to_string(FANOUT_WIDTH);
+
+	string name = "fanout/external/width=" + width;
+	if (runner.enabled(name))
+	{
+		ThreadPool pool;
+		pool.start(threads);
+		uint64_t begin = benchNow();
+		for (int r = 0; r < rounds; r++)
+		{
+			vector<Result> results;
+			results.reserve(FANOUT_WIDTH);
+			for (int i = 0; i < FANOUT_WIDTH; i++)
+			{
+				results.emplace_back(pool.submitTask(std::make_shared<WorkTask>()));
+			}
+			for (auto& result : results)
+			{
+				result.get();
+			}
+		}
+		runner.report(name, rounds / ((benchNow() - begin) / 1e9), "rounds/s");
+	}
+
+	name = "fanout/nested/width=" + width;
+	if (runner.enabled(name))
+	{
+		ThreadPool pool;
+		pool.setMode(PoolMode::MODE_WORK_STEALING);
+		pool.start(threads);
+		uint64_t begin = benchNow();
+		for (int r = 0; r < rounds; r++)
+		{
+			auto done = std::make_shared<std::promise<void>>();
+			auto finished = done->get_future();
+			std::atomic_int remaining(FANOUT_WIDTH);
+			pool.submitTask(std::make_shared<RootTask>(pool, remaining, done));
+			finished.wait();
+		}
+		runner.report(name, rounds / ((benchNow() - begin) / 1e9), "rounds/s");
+	}
+}
+
+// 多个提交线程同时提交空任务，看提交一侧的竞争
+void benchContention(BenchRunner& runner)
+{
+	int size = runner.scale(THROUGHPUT_TASK_SIZE);
+	int threads = std::max((int)std::thread::hardware_concurrency(), 1);
+	vector<int> producerCounts = runner.threadCounts();
+	producerCounts.push_back(producerCounts.back() * 2);
+	for (const PoolConfig& config : POOL_CONFIGS)
+	{
+		for (int producers : producerCounts)
+		{
+			string name = string("contention/") + config.name + "/producers=" + to_string(producers);
+			if (!runner.enabled(name))
+				continue;
+			ThreadPool pool;
+			pool.setMode(config.mode);
+			pool.start(threads);
+
+			std::atomic_bool go(false);
+			vector<std::thread> submitters;
+			vector<vector<Result>> results(producers);
+			for (int p = 0; p < producers; p++)
+			{
+				submitters.emplace_back([&, p]() {
+					int count = size / producers;
+					results[p].reserve(count);
+					while (!go)
+						std::this_thread::yield();
+					for (int i = 0; i < count; i++)
+					{
+						results[p].emplace_back(pool.submitTask(std::make_shared<EmptyTask>()));
+					}
+				});
+			}
+			uint64_t begin = benchNow();
+			go = true;
+			for (auto& t : submitters)
+			{
+				t.join();
+			}
+			for (auto& list : results)
+			{
+				for (auto& result : list)
+				{
+					result.get();
+				}
+			}
+			double seconds = (benchNow() - begin) / 1e9;
+			runner.report(name, (size / producers) * producers / seconds, "tasks/s");
+		}
+	}
+}
+
+// cached模式从1个线程开始，突然来一批阻塞任务，看线程增长得多快
+// 这个线程池不提供线程数量的查询，只测完成时间
+void benchCachedBurst(BenchRunner& runner)
+{
+	if (!runner.enabled("cached/burst"))
+		return;
+	ThreadPool pool;
+	pool.setMode(PoolMode::MODE_CACHED);
+	pool.setThreadSizeThreshHold(64);
+	pool.start(1);
+
+	int size = runner.scale(CACHED_BURST_SIZE);
+	vector<Result> results;
+	results.reserve(size);
+	uint64_t begin = benchNow();
+	for (int i = 0; i < size; i++)
+	{
+		results.emplace_back(pool.submitTask(std::make_shared<SleepTask>()));
+	}
+	for (auto& result : results)
+	{
+		result.get();
+	}
+	runner.report("cached/burst/time", (benchNow() - begin) / 1e6, "ms");
+}
+
+int main(int argc, char** argv)
+{
+	BenchRunner runner("any", argc, argv);
+	benchThroughput(runner);
+	benchLatency(runner);
+	benchFanout(runner);
+	benchContention(runner);
+	benchCachedBurst(runner);
+	return 0;
+}
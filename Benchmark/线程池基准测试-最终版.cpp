@@ -0,0 +1,307 @@
+﻿// 线程池基准测试-最终版.cpp : ThreadPool_C++11（Future版线程池）的基准测试
+// g++ -std=c++17 -O2 -pthread -I../ThreadPool_C++11 线程池基准测试-最终版.cpp -o bench_future
+// ./bench_future > future.txt          保存结果，作为之后修改调度的基线
+// ./bench_future --baseline baseline.txt  和提交的基线比较
+
+#include <future>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "threadpool.h"
+#include "benchmark.h"
+
+const int THROUGHPUT_TASK_SIZE = 200000;	// 吞吐量测试每轮提交的任务数
+const int LATENCY_SAMPLE_SIZE = 5000;		// 延迟测试的样本数
+const int PARKED_SAMPLE_SIZE = 500;			// 线程挂起之后再提交的延迟样本数，每个样本之间间隔1ms
+const int FANOUT_WIDTH = 64;				// 扇出测试每轮的子任务数
+const int FANOUT_ROUND_SIZE = 2000;			// 扇出测试的轮数
+const int FANOUT_WORK = 200;				// 扇出测试每个子任务的计算量
+const int CACHED_BURST_SIZE = 256;			// cached模式突发测试的任务数
+const int CACHED_TASK_TIME = 2;				// cached模式突发测试每个任务的时间，单位：毫秒
+const int TIMER_SAMPLE_SIZE = 2000;			// 定时器测试的定时器数
+const int TIMER_DELAY = 5;					// 定时器测试每个定时器的延迟，单位：毫秒
+const int TIMER_SUBMIT_GAP = 137;			// 定时器测试相邻两次提交的间隔，单位：微秒，不是整毫秒，提交时间落在1ms内的各个位置
+
+struct PoolConfig
+{
+	const char* name;
+	PoolMode mode;
+	TaskQueMode queMode;
+};
+
+const PoolConfig POOL_CONFIGS[] = {
+	{ "fixed", PoolMode::MODE_FIXED, TaskQueMode::MODE_LOCKED },
+	{ "lockfree", PoolMode::MODE_FIXED, TaskQueMode::MODE_LOCK_FREE },
+	{ "stealing", PoolMode::MODE_WORK_STEALING, TaskQueMode::MODE_LOCKED },
+};
+
+void configure(ThreadPool& pool, const PoolConfig& config)
+{
+	pool.setMode(config.mode);
+	pool.setTaskQueMode(config.queMode);
+}
+
+// 空任务的吞吐量随线程数的变化：提交线程一次提交完，再等所有的Future
+void benchThroughput(BenchRunner& runner)
+{
+	int size = runner.scale(THROUGHPUT_TASK_SIZE);
+	for (const PoolConfig& config : POOL_CONFIGS)
+	{
+		for (int threads : runner.threadCounts())
+		{
+			string name = string("throughput/") + config.name + "/workers=" + to_string(threads);
+			if (!runner.enabled(name))
+				continue;
+			ThreadPool pool;
+			configure(pool, config);
+			pool.start(threads);
+
+			vector<Future<void>> results;
+			results.reserve(size);
+			uint64_t begin = benchNow();
+			for (int i = 0; i < size; i++)
+			{
+				results.emplace_back(pool.submitTask([]() {}));
+			}
+			for (auto& result : results)
+			{
+				result.get();
+			}
+			double seconds = (benchNow() - begin) / 1e9;
+			runner.report(name, size / seconds, "tasks/s");
+		}
+	}
+}
+
+// 从提交到开始执行的延迟
+// idle：上一个任务刚执行完就提交，线程还在自旋；parked：等线程挂起之后再提交；burst：一次提交一批，包括排队时间
+void benchLatency(BenchRunner& runner)
+{
+	if (!runner.enabled("latency"))
+		return;
+	int threads = std::min((int)std::thread::hardware_concurrency(), 4);
+	ThreadPool pool;
+	pool.start(std::max(threads, 1));
+
+	auto sample = [&](int size, int gapMs) {
+		vector<uint64_t> samples(size);
+		for (int i = 0; i < size; i++)
+		{
+			if (gapMs > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(gapMs));
+			uint64_t submitTime = benchNow();
+			pool.submitTask([&samples, i, submitTime]() { samples[i] = benchNow() - submitTime; }).get();
+		}
+		return samples;
+	};
+	runner.reportLatency("latency/idle", sample(runner.scale(LATENCY_SAMPLE_SIZE), 0));
+	runner.reportLatency("latency/parked", sample(runner.scale(PARKED_SAMPLE_SIZE), 1));
+
+	int size = runner.scale(LATENCY_SAMPLE_SIZE);
+	vector<uint64_t> samples(size);
+	vector<Future<void>> results;
+	results.reserve(size);
+	for (int i = 0; i < size; i++)
+	{
+		uint64_t submitTime = benchNow();
+		results.emplace_back(pool.submitTask([&samples, i, submitTime]() { samples[i] = benchNow() - submitTime; }));
+	}
+	for (auto& result : results)
+	{
+		result.get();
+	}
+	runner.reportLatency("latency/burst", samples);
+}
+
+// 扇出/扇入：external是外部线程提交一批子任务再等全部完成；nested是一个任务在线程池里面提交子任务，最后一个子任务完成时通知外部
+void benchFanout(BenchRunner& runner)
+{
+	int threads = std::max((int)std::thread::hardware_concurrency(), 2);
+	int rounds = runner.scale(FANOUT_ROUND_SIZE);
+	string width = to_string(FANOUT_WIDTH);
+
+	string name = "fanout/external/width=" + width;
+	if (runner.enabled(name))
+	{
+		ThreadPool pool;
+		pool.start(threads);
+		uint64_t begin = benchNow();
+		for (int r = 0; r < rounds; r++)
+		{
+			vector<Future<uint64_t>> results;
+			results.reserve(FANOUT_WIDTH);
+			for (int i = 0; i < FANOUT_WIDTH; i++)
+			{
+				results.emplace_back(pool.submitTask(benchWork, FANOUT_WORK));
+			}
+			for (auto& result : results)
+			{
+				result.get();
+			}
+		}
+		runner.report(name, rounds / ((benchNow() - begin) / 1e9), "rounds/s");
+	}
+
+	name = "fanout/nested/width=" + width;
+	if (runner.enabled(name))
+	{
+		ThreadPool pool;
+		pool.setMode(PoolMode::MODE_WORK_STEALING);
+		pool.start(threads);
+		uint64_t begin = benchNow();
+		for (int r = 0; r < rounds; r++)
+		{
+			// 最后一个子任务set_value的时候外部线程可能已经返回，promise由子任务共同持有
+			auto done = std::make_shared<std::promise<void>>();
+			auto finished = done->get_future();
+			std::atomic_int remaining(FANOUT_WIDTH);
+			pool.submitTask([&pool, &remaining, done]() {
+				for (int i = 0; i < FANOUT_WIDTH; i++)
+				{
+					pool.submitTask([&remaining, done]() {
+						benchWork(FANOUT_WORK);
+						if (--remaining == 0)
+							done->set_value();
+					});
+				}
+			});
+			finished.wait();
+		}
+		runner.report(name, rounds / ((benchNow() - begin) / 1e9), "rounds/s");
+	}
+}
+
+// 多个提交线程同时提交空任务，看提交一侧的竞争
+void benchContention(BenchRunner& runner)
+{
+	int size = runner.scale(THROUGHPUT_TASK_SIZE);
+	int threads = std::max((int)std::thread::hardware_concurrency(), 1);
+	vector<int> producerCounts = runner.threadCounts();
+	producerCounts.push_back(producerCounts.back() * 2);
+	for (const PoolConfig& config : POOL_CONFIGS)
+	{
+		for (int producers : producerCounts)
+		{
+			string name = string("contention/") + config.name + "/producers=" + to_string(producers);
+			if (!runner.enabled(name))
+				continue;
+			ThreadPool pool;
+			configure(pool, config);
+			pool.start(threads);
+
+			std::atomic_bool go(false);
+			vector<std::thread> submitters;
+			vector<vector<Future<void>>> results(producers);
+			for (int p = 0; p < producers; p++)
+			{
+				submitters.emplace_back([&, p]() {
+					int count = size / producers;
+					results[p].reserve(count);
+					while (!go)
+						std::this_thread::yield();
+					for (int i = 0; i < count; i++)
+					{
+						results[p].emplace_back(pool.submitTask([]() {}));
+					}
+				});
+			}
+			uint64_t begin = benchNow();
+			go = true;
+			for (auto& t : submitters)
+			{
+				t.join();
+			}
+			for (auto& list : results)
+			{
+				for (auto& result : list)
+				{
+					result.get();
+				}
+			}
+			double seconds = (benchNow() - begin) / 1e9;
+			runner.report(name, (size / producers) * producers / seconds, "tasks/s");
+		}
+	}
+}
+
+// cached模式从1个线程开始，突然来一批阻塞任务，看线程增长得多快
+void benchCachedBurst(BenchRunner& runner)
+{
+	if (!runner.enabled("cached/burst"))
+		return;
+	ThreadPool pool;
+	pool.setMode(PoolMode::MODE_CACHED);
+	pool.setThreadSizeThreshHold(64);
+	pool.start(1);
+
+	int size = runner.scale(CACHED_BURST_SIZE);
+	vector<Future<void>> results;
+	results.reserve(size);
+	uint64_t begin = benchNow();
+	for (int i = 0; i < size; i++)
+	{
+		results.emplace_back(pool.submitTask([]() { std::this_thread::sleep_for(std::chrono::milliseconds(CACHED_TASK_TIME)); }));
+	}
+	int peak = 0;
+	for (auto& result : results)
+	{
+		result.get();
+		peak = std::max(peak, pool.snapshotStats().curThreadSize);
+	}
+	runner.report("cached/burst/time", (benchNow() - begin) / 1e6, "ms");
+	runner.report("cached/burst/peakThreads", peak, "threads");
+}
+
+// submitAfter从提交到开始执行比要求的延迟晚了多久；timer/early是提前执行的定时器数，不为0说明定时器提前到期了
+void benchTimer(BenchRunner& runner)
+{
+	if (!runner.enabled("timer"))
+		return;
+	ThreadPool pool;
+	pool.start(2);
+
+	int size = runner.scale(TIMER_SAMPLE_SIZE);
+	uint64_t delay = (uint64_t)TIMER_DELAY * 1000000;
+	vector<int64_t> elapsed(size);
+	vector<Future<void>> results;
+	results.reserve(size);
+	for (int i = 0; i < size; i++)
+	{
+		uint64_t submitTime = benchNow();
+		int64_t& sample = elapsed[i];
+		results.emplace_back(pool.submitAfter(std::chrono::milliseconds(TIMER_DELAY), [&sample, submitTime]() {
+			sample = (int64_t)(benchNow() - submitTime);
+		}));
+		std::this_thread::sleep_for(std::chrono::microseconds(TIMER_SUBMIT_GAP));
+	}
+	for (auto& result : results)
+	{
+		result.get();
+	}
+
+	int early = 0;
+	vector<uint64_t> samples;
+	samples.reserve(size);
+	for (int64_t value : elapsed)
+	{
+		if (value < (int64_t)delay)
+			early++;
+		else
+			samples.push_back((uint64_t)value - delay);
+	}
+	runner.report("timer/early", early, "timers");
+	runner.reportLatency("timer/lateness", samples);
+}
+
+int main(int argc, char** argv)
+{
+	BenchRunner runner("future", argc, argv);
+	benchThroughput(runner);
+	benchLatency(runner);
+	benchFanout(runner);
+	benchContention(runner);
+	benchCachedBurst(runner);
+	benchTimer(runner);
+	return 0;
+}
@@ -6,15 +6,49 @@
 const int TASK_MAX_THRESHHOLD = INT32_MAX;			// 任务上限阈值
 const int THREAD_MAX_THRESHHOLD = 1024;				// 线程的最大数量	
 const int THREAD_MAX_IDLE_TIME = 60; // 单位：秒		// 线程等待时间
+const int RESULT_STATE_BLOCK_SIZE = 64;				// Result控制块每次申请的数量
+
+// 日志级别，低于THREADPOOL_LOG_LEVEL的日志直接编译掉，默认只输出警告
+// 每个任务都会打印的调试日志会让所有线程在iostream的锁上排队，调试时用-DTHREADPOOL_LOG_LEVEL=4打开
+#define THREADPOOL_LOG_LEVEL_NONE  0
+#define THREADPOOL_LOG_LEVEL_WARN  2
+#define THREADPOOL_LOG_LEVEL_INFO  3
+#define THREADPOOL_LOG_LEVEL_DEBUG 4
+
+#ifndef THREADPOOL_LOG_LEVEL
+#define THREADPOOL_LOG_LEVEL THREADPOOL_LOG_LEVEL_WARN
+#endif
+
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_WARN
+#define THREADPOOL_LOG_WARN(message) (std::cerr << message << std::endl)
+#else
+#define THREADPOOL_LOG_WARN(message) ((void)0)
+#endif
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_INFO
+#define THREADPOOL_LOG_INFO(message) (std::cout << message << std::endl)
+#else
+#define THREADPOOL_LOG_INFO(message) ((void)0)
+#endif
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_DEBUG
+#define THREADPOOL_LOG_DEBUG(message) (std::cout << message << std::endl)
+#else
+#define THREADPOOL_LOG_DEBUG(message) ((void)0)
+#endif
+
+// 当前线程所属的线程池和自己队列的下标，用来判断任务是不是线程池内部的线程提交的
+static thread_local ThreadPool* currentPool = nullptr;
+static thread_local int currentIndex = -1;
 
 // 线程池构造
 ThreadPool::ThreadPool()
 	: initThreadSize_(0)							// 初始线程池大小
-	, taskSize_(0)									// 任务队列数量
-	, idleThreadSize_(0)							// 空闲线程数量
+	, threadSizeThreshHold_(THREAD_MAX_THRESHHOLD)  // 线程数量上限阈值
 	, curThreadSize_(0)								// 当前线程数量
+	, idleThreadSize_(0)							// 空闲线程数量
+	, taskSize_(0)									// 任务队列数量
 	, taskQueMaxThreshHold_(TASK_MAX_THRESHHOLD)	// 任务上限阈值
-	, threadSizeThreshHold_(THREAD_MAX_THRESHHOLD)  // 线程数量上限阈值
+	, submitTimeout_(1000)							// 提交任务最长等待1s
+	, resultStatePool_(new ResultStatePool())		// Result控制块分配器
 	, poolMode_(PoolMode::MODE_FIXED)				// 默认固定模式
 	, isPoolRunning_(false)							// 线程暂停标志
 {}
@@ -28,6 +62,9 @@ ThreadPool::~ThreadPool()
 	std::unique_lock<std::mutex> lock(taskQueMtx_);
 	notEmpty_.notify_all();	// 可能没有通知完全，有可能线程执行完了，又去wait了 // 如果线程任务先获取锁 wait了，这里通知
 	exitCond_.wait(lock, [&]()->bool {return threads_.size() == 0; }); // 或者是curThreadSize_为空
+
+	// 还有Result在使用控制块的话，分配器等它们归还之后再释放
+	resultStatePool_->release();
 }
 
 // 设置线程池的工作模式
@@ -60,23 +97,63 @@ void ThreadPool::setThreadSizeThreshHold(int threshhold)
 	}
 }
 
+// 设置任务队列满了时提交任务最长的等待时间
+// 线程启动之后不能设置，在启动前设置。
+void ThreadPool::setSubmitTimeout(int milliseconds)
+{
+	if (checkRunningState())
+		return;
+	submitTimeout_ = milliseconds;
+}
+
 // 给线程池提交任务    用户调用该接口，传入任务对象，生产任务
 // Result 生命周期 大于 Task
 Result ThreadPool::submitTask(std::shared_ptr<Task> sp)
 {
+	// 放入队列之前先把控制块交给任务，任务和Result各持有一个引用，谁先结束都没有关系
+	ResultState* state = resultStatePool_->acquire();
+	sp->setResultState(state);
+	if (!pushTask(sp))
+	{
+		// 任务不会执行了，收回交给任务和Result的两个引用
+		sp->setResultState(nullptr);
+		state->release();
+		state->release();
+		return Result();
+	}
+
+	// 返回任务的Result对象
+	return Result(state);
+}
+
+// 把任务放入任务队列
+bool ThreadPool::pushTask(std::shared_ptr<Task> sp)
+{
+	// 工作窃取模式下，线程池自己的线程提交的子任务直接放入该线程自己的队列，不需要获取全局锁
+	if (poolMode_ == PoolMode::MODE_WORK_STEALING && currentPool == this)
+	{
+		workQues_[currentIndex]->push(std::move(sp));
+		taskSize_++;
+		// 有空闲线程时才需要通知，线程都在忙的话，任务会被自己或者窃取的线程取走
+		if (idleThreadSize_ > 0)
+		{
+			std::unique_lock<std::mutex> notifyLock(taskQueMtx_);
+			notEmpty_.notify_one();
+		}
+		return true;
+	}
+
 	// 获取任务队列锁
 	std::unique_lock<std::mutex> lock(taskQueMtx_);
 
 	// 线程的通信  等待任务队列有空余   wait   wait_for （等待最多1s）  wait_until  （设置一个时间，等待到了直接返回）
-	// 用户提交任务，最长不能阻塞超过1s，否则判断提交任务失败，返回
-	if (!notFull_.wait_for(lock, std::chrono::seconds(1),
+	// 用户提交任务，最长不能阻塞超过submitTimeout_，否则判断提交任务失败，返回
+	if (!notFull_.wait_for(lock, std::chrono::milliseconds(submitTimeout_),
 		[&]()->bool { return taskQue_.size() < (size_t)taskQueMaxThreshHold_; }))
 	{
-		// 表示notFull_等待1s种，条件依然没有满足
-		std::cerr << "task queue is full, submit task fail." << std::endl;
-		// return task->getResult();  // Task  Result   线程执行完task，task对象就被析构掉了
-		
-		return Result(sp, false);
+		// 表示notFull_等待submitTimeout_，条件依然没有满足，调用者可以用Result::isValid()判断
+		THREADPOOL_LOG_WARN("task queue is full, submit task fail.");
+		return false;
 	}
 
 	// 如果有空余，把任务放入任务队列中
@@ -91,7 +168,7 @@ Result ThreadPool::submitTask(std::shared_ptr<Task> sp)
 		&& taskSize_ > idleThreadSize_				// 任务数量大于空闲线程
 		&& curThreadSize_ < threadSizeThreshHold_)	// 当前线程数量小于阈值
 	{
-		std::cout << ">>> create new thread..." << std::endl;
+		THREADPOOL_LOG_INFO(">>> create new thread...");
 
 		// 创建新的线程对象， 创建线程就有了自定义的线程id
 		auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
@@ -104,9 +181,7 @@ Result ThreadPool::submitTask(std::shared_ptr<Task> sp)
 		idleThreadSize_++;								// 空闲线程数量++
 	}
 
-	// 返回任务的Result对象
-	return Result(sp);
-	// return task->getResult();  // 任务可能执行完了，  用户才去调用，task声明周期结束
+	return true;
 }
 
 // 开启线程池
@@ -119,6 +194,15 @@ void ThreadPool::start(int initThreadSize)
 	initThreadSize_ = initThreadSize;	// 初始线程数量
 	curThreadSize_ = initThreadSize;	// 当前线程数量
 
+	// 工作窃取模式下，每个线程一个自己的任务队列，线程启动前全部创建好，之后只读
+	if (poolMode_ == PoolMode::MODE_WORK_STEALING)
+	{
+		for (int i = 0; i < initThreadSize_; i++)
+		{
+			workQues_.emplace_back(std::make_unique<WorkStealingQueue>());
+		}
+	}
+
 	// 创建线程对象
 	for (int i = 0; i < initThreadSize_; i++)
 	{
@@ -126,16 +210,25 @@ void ThreadPool::start(int initThreadSize)
 		// threadFunc ThreadPool 的成员方法，（无限循环，执行任务）
 		// 创建线程的时候 Thread 自动分配了ID了 
 		// 调用 ptr时需要传参数
-		auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
+		std::unique_ptr<Thread> ptr;
+		if (poolMode_ == PoolMode::MODE_WORK_STEALING)
+		{
+			// 工作窃取模式的线程需要知道自己的队列下标
+			ptr = std::make_unique<Thread>([this, i](int threadid) { stealingThreadFunc(threadid, i); });
+		}
+		else
+		{
+			ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
+		}
 		int threadId = ptr->getId();
 		// 使用move 是因为ptr 是unique 指针
 		threads_.emplace(threadId, std::move(ptr));
 	}
 
-	// 启动所有线程 
-	for (int i = 0; i < initThreadSize_; i++)
+	// 启动所有线程  线程id是全局递增的，不一定从0开始，遍历容器启动
+	for (auto& item : threads_)
 	{
-		threads_[i]->start(); // 需要去执行一个线程函数
+		item.second->start(); // 需要去执行一个线程函数
 		idleThreadSize_++;    // 记录初始空闲线程的数量
 	}
 }
@@ -155,8 +248,7 @@ void ThreadPool::threadFunc(int threadid)  // 线程函数返回，相应的线
 			// 多个线程访问共享数据，必须获取锁
 			std::unique_lock<std::mutex> lock(taskQueMtx_);
 
-			std::cout << "tid:" << std::this_thread::get_id()
-				<< "尝试获取任务..." << std::endl;
+			THREADPOOL_LOG_DEBUG("tid:" << std::this_thread::get_id() << "尝试获取任务...");
 
 			// 锁 + 双重判断
 			// 当任务队列为空时，等待。，不为空时，执行任务。
@@ -168,8 +260,7 @@ void ThreadPool::threadFunc(int threadid)  // 线程函数返回，相应的线
 				// 析构时，catch模式未超过 60s  和 fix模式 都从这里退出
 				if (!isPoolRunning_)
 				{
-					std::cout << "threadid:" << std::this_thread::get_id() << " exit!"
-						<< std::endl;
+					THREADPOOL_LOG_INFO("threadid:" << std::this_thread::get_id() << " exit!");
 					threads_.erase(threadid); // std::this_thread::getid()
 					exitCond_.notify_all();
 					return; // 线程函数结束，线程结束
@@ -195,8 +286,7 @@ void ThreadPool::threadFunc(int threadid)  // 线程函数返回，相应的线
 							// 记录线程数量的相关变量的值修改
 							// 把线程对象从线程列表容器中删除   没有办法 threadFunc《=》thread对象
 							// threadid => thread对象 => 删除
-							std::cout << "threadid:" << std::this_thread::get_id() << " exit!"
-								<< std::endl;
+							THREADPOOL_LOG_INFO("threadid:" << std::this_thread::get_id() << " exit!");
 							threads_.erase(threadid); // std::this_thread::getid()
 							curThreadSize_--;
 							idleThreadSize_--;
@@ -214,8 +304,7 @@ void ThreadPool::threadFunc(int threadid)  // 线程函数返回，相应的线
 			// 获取任务成功的条件， 任务队列不为空
 
 
-			std::cout << "tid:" << std::this_thread::get_id()
-				<< "获取任务成功..." << std::endl;
+			THREADPOOL_LOG_DEBUG("tid:" << std::this_thread::get_id() << "获取任务成功...");
 
 			idleThreadSize_--;
 			// 从任务队列种取一个任务出来
@@ -239,6 +328,72 @@ void ThreadPool::threadFunc(int threadid)  // 线程函数返回，相应的线
 	}
 }
 
+// 工作窃取模式的线程函数
+// 取任务的顺序：自己的队列 -> 注入队列taskQue_ -> 窃取其它线程的队列，都没有任务才去等待
+void ThreadPool::stealingThreadFunc(int threadid, int index)
+{
+	currentPool = this;
+	currentIndex = index;
+
+	while (true)
+	{
+		std::shared_ptr<Task> task = workQues_[index]->tryPop();
+		if (task == nullptr)
+			task = popInjectedTask();
+		if (task == nullptr)
+			task = stealTask(index);
+
+		if (task != nullptr)
+		{
+			taskSize_--;
+			idleThreadSize_--;
+			task->exec();
+			idleThreadSize_++;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(taskQueMtx_);
+		// 还有任务在别的队列中（正在放入或者正在被窃取），重新扫描
+		if (taskSize_ > 0)
+			continue;
+
+		// 线程池要结束，所有队列都空了，回收线程资源
+		if (!isPoolRunning_)
+		{
+			threads_.erase(threadid);
+			exitCond_.notify_all();
+			return;
+		}
+
+		// 提交任务的一方先增加taskSize_再获取锁通知，这里持有锁判断taskSize_后再等待，不会丢失通知
+		notEmpty_.wait(lock);
+	}
+}
+
+std::shared_ptr<Task> ThreadPool::popInjectedTask()
+{
+	std::lock_guard<std::mutex> lock(taskQueMtx_);
+	if (taskQue_.empty())
+		return nullptr;
+	std::shared_ptr<Task> task = taskQue_.front();
+	taskQue_.pop();
+	notFull_.notify_all();
+	return task;
+}
+
+// 从下一个线程开始轮询，避免所有线程都去偷同一个队列
+std::shared_ptr<Task> ThreadPool::stealTask(int index)
+{
+	int size = static_cast<int>(workQues_.size());
+	for (int i = 1; i < size; i++)
+	{
+		std::shared_ptr<Task> task = workQues_[(index + i) % size]->trySteal();
+		if (task != nullptr)
+			return task;
+	}
+	return nullptr;
+}
+
 bool ThreadPool::checkRunningState() const
 {
 	return isPoolRunning_;
@@ -272,47 +427,192 @@ int Thread::getId()const
 }
 
 
+/////////////////  WorkStealingQueue方法实现
+void WorkStealingQueue::push(std::shared_ptr<Task> task)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	que_.push_back(std::move(task));
+}
+
+std::shared_ptr<Task> WorkStealingQueue::tryPop()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (que_.empty())
+		return nullptr;
+	std::shared_ptr<Task> task = std::move(que_.back());
+	que_.pop_back();
+	return task;
+}
+
+std::shared_ptr<Task> WorkStealingQueue::trySteal()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (que_.empty())
+		return nullptr;
+	std::shared_ptr<Task> task = std::move(que_.front());
+	que_.pop_front();
+	return task;
+}
+
 /////////////////  Task方法实现
 Task::Task()
-	: result_(nullptr)
+	: resultState_(nullptr)
 {}
 
+Task::~Task()
+{
+	// 任务没有执行就被销毁，写入空结果，等待的Result不会一直阻塞
+	if (resultState_ != nullptr)
+	{
+		resultState_->setVal(Any());
+		resultState_->release();
+	}
+}
+
 void Task::exec()
 {
-	if (result_ != nullptr)
+	if (resultState_ != nullptr)
 	{
-		result_->setVal(run()); // 这里发生多态调用
+		// 先取下控制块再执行，执行完释放任务的引用
+		ResultState* state = resultState_;
+		resultState_ = nullptr;
+		state->setVal(run()); // 这里发生多态调用
+		state->release();
 	}
 }
 
-void Task::setResult(Result* res)
+void Task::setResultState(ResultState* state)
 {
-	result_ = res;
+	resultState_ = state;
 }
 
-/////////////////   Result方法的实现
-Result::Result(std::shared_ptr<Task> task, bool isValid)
-	: isValid_(isValid)
-	, task_(task)
+/////////////////   ResultState方法的实现
+ResultState::ResultState()
+	: refCount_(0)
+	, pool_(nullptr)
+	, next_(nullptr)
+{}
+
+// 消费者任务执行Reuslt的任务执行完了，  获取结果，通知 Result 结果类取消阻塞。
+void ResultState::setVal(Any any)
 {
-	task_->setResult(this);		// 延长生命周期		// task 和 result 产生关系。 一个任务带一个result   task 和 result相互依赖
-								// 这里用户也可以调用，采用成员方法，便于更好的封装
+	// 存储task的返回值
+	any_ = std::move(any);
+	done_.set(); // 已经获取的任务的返回值，设置完成标志，用户获取值就不需要等待了
 }
 
-Any Result::get() // 用户调用的
+Any ResultState::get()
+{
+	done_.wait(); // task任务如果没有执行完，这里会阻塞用户的线程
+	return std::move(any_);
+}
+
+void ResultState::release()
 {
-	if (!isValid_)
+	if (refCount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
 	{
-		return "";
+		pool_->recycle(this);
 	}
-	sem_.wait(); // task任务如果没有执行完，这里会阻塞用户的线程
-	return std::move(any_);
 }
 
-// 消费者任务执行Reuslt的任务执行完了，  获取结果，通知 Result 结果类取消阻塞。
-void Result::setVal(Any any)  // 谁调用的呢？？？
+/////////////////   ResultStatePool方法的实现
+ResultStatePool::ResultStatePool()
+	: freeList_(nullptr)
+	, users_(1)	// 线程池自己
+{}
+
+ResultState* ResultStatePool::acquire()
 {
-	// 存储task的返回值
-	this->any_ = std::move(any);
-	sem_.post(); // 已经获取的任务的返回值，增加信号量资源  ，用户获取值就不需要等待了
+	users_.fetch_add(1, std::memory_order_relaxed);
+
+	ResultState* state;
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (freeList_ == nullptr)
+		{
+			// 空闲链表用完了，一次申请一块，串进空闲链表
+			std::unique_ptr<ResultState[]> block(new ResultState[RESULT_STATE_BLOCK_SIZE]);
+			for (int i = 0; i < RESULT_STATE_BLOCK_SIZE; i++)
+			{
+				block[i].pool_ = this;
+				block[i].next_ = freeList_;
+				freeList_ = &block[i];
+			}
+			blocks_.emplace_back(std::move(block));
+		}
+		state = freeList_;
+		freeList_ = state->next_;
+	}
+
+	state->next_ = nullptr;
+	state->refCount_.store(2, std::memory_order_relaxed);
+	return state;
+}
+
+void ResultStatePool::recycle(ResultState* state)
+{
+	// 清掉上一次的返回值和完成标志，这时已经没有任务和Result在使用它了
+	state->any_ = Any();
+	state->done_.reset();
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		state->next_ = freeList_;
+		freeList_ = state;
+	}
+	// 线程池已经析构，这是最后一个控制块的话，释放分配器
+	if (users_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete this;
+	}
+}
+
+void ResultStatePool::release()
+{
+	if (users_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete this;
+	}
+}
+
+/////////////////   Result方法的实现
+Result::Result()
+	: state_(nullptr)
+{}
+
+Result::Result(ResultState* state)
+	: state_(state)
+{}
+
+Result::~Result()
+{
+	if (state_ != nullptr)
+	{
+		state_->release();
+	}
+}
+
+Result::Result(Result&& other) noexcept
+	: state_(other.state_)
+{
+	other.state_ = nullptr;
+}
+
+Result& Result::operator=(Result&& other) noexcept
+{
+	std::swap(state_, other.state_);
+	return *this;
+}
+
+bool Result::isValid() const
+{
+	return state_ != nullptr;
+}
+
+Any Result::get() // 用户调用的
+{
+	if (state_ == nullptr)
+	{
+		return "";
+	}
+	return state_->get();
 }
\ No newline at end of file
@@ -3,12 +3,18 @@
 
 #include <vector>
 #include <queue>
+#include <deque>
 #include <memory>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <unordered_map>
+#include <thread>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 // Any类型：可以接收任意数据的类型
 // 为什么不设计成员变量还有模版的参数呢？  因为模版参数， 必须加上template<typename T> ，使用时必须加<> ，
@@ -26,29 +32,32 @@ public:
 
 	// 这个构造函数可以让Any类型接收任意其它的数据
 	template<typename T>  // T:int    Derive<int>
-	// 
-	Any(T data) : base_(std::make_unique<Derive<T>>(data))
+	// 数据移动进去，不再拷贝
+	Any(T data) : base_(std::make_unique<Derive<T>>(std::move(data)))
 	{}
 
 	// 这个方法能把Any对象里面存储的data数据提取出来
 	template<typename T>
-	T cast_()
+	T cast_() &
 	{
-		// 我们怎么从base_找到它所指向的Derive对象，从它里面取出data成员变量
-		// 基类指针 =》 派生类指针   RTTI
-		Derive<T>* pd = dynamic_cast<Derive<T>*>(base_.get());
-		if (pd == nullptr)
-		{
-			throw "type is unmatch!";
-		}
-		return pd->data_;
+		return derive<T>()->data_;
+	}
+
+	// 临时的Any对象（比如res.get().cast_<T>()）直接把数据移动出来
+	template<typename T>
+	T cast_() &&
+	{
+		return std::move(derive<T>()->data_);
 	}
 private:
 	// 基类类型 虚函数
 	class Base
 	{
 	public:
+		Base(const void* type) : type_(type)
+		{}
 		virtual ~Base() = default;
+		const void* type_;  // 保存的数据类型的标识
 	};
 
 	// 派生类类型 模版
@@ -56,11 +65,31 @@ private:
 	class Derive : public Base
 	{
 	public:
-		Derive(T data) : data_(data) 
+		Derive(T data) : Base(typeKey<T>()), data_(std::move(data))
 		{}
 		T data_;  // 保存了任意的其它类型
 	};
 
+	// 每种类型一个静态变量，用它的地址作为类型标识
+	template<typename T>
+	static const void* typeKey()
+	{
+		static const char key = 0;
+		return &key;
+	}
+
+	// 我们怎么从base_找到它所指向的Derive对象，从它里面取出data成员变量
+	// 比较类型标识代替dynamic_cast，不需要RTTI
+	template<typename T>
+	Derive<T>* derive()
+	{
+		if (base_ == nullptr || base_->type_ != typeKey<T>())
+		{
+			throw "type is unmatch!";
+		}
+		return static_cast<Derive<T>*>(base_.get());
+	}
+
 private:
 	// 定义一个基类的指针
 	std::unique_ptr<Base> base_;
@@ -101,43 +130,266 @@ private:
 	std::condition_variable cond_;	// resLimit_的条件变量
 };
 
+// 任务完成标志，只设置一次，可以有多个线程等待
+// C++20下只有一个原子变量，用atomic::wait等待（Linux上是futex），之前的标准退回到互斥锁+条件变量
+class CompletionFlag
+{
+public:
+	CompletionFlag()
+		: done_(false)
+	{}
+	CompletionFlag(const CompletionFlag&) = delete;
+	CompletionFlag& operator=(const CompletionFlag&) = delete;
+
+	bool isSet() const
+	{
+		return done_.load(std::memory_order_acquire);
+	}
+
+	// 重新使用之前清除标志，调用时不能有线程在等待
+	void reset()
+	{
+		done_.store(false, std::memory_order_relaxed);
+	}
+
+#if defined(__cpp_lib_atomic_wait)
+	void set()
+	{
+		done_.store(true, std::memory_order_release);
+		done_.notify_all();
+	}
+
+	void wait() const
+	{
+		done_.wait(false, std::memory_order_acquire);
+	}
+#else
+	void set()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			done_.store(true, std::memory_order_release);
+		}
+		cond_.notify_all();
+	}
+
+	void wait() const
+	{
+		if (isSet())
+			return;
+		std::unique_lock<std::mutex> lock(mtx_);
+		cond_.wait(lock, [&]()->bool { return isSet(); });
+	}
+#endif
+
+private:
+	std::atomic_bool done_;
+#if !defined(__cpp_lib_atomic_wait)
+	mutable std::mutex mtx_;
+	mutable std::condition_variable cond_;
+#endif
+};
+
 // Task类型的前置声明
 class Task;
+class ResultStatePool;
 
-// 实现接收提交到线程池的task任务执行完成后的返回值类型Result
-class Result
+// Result的控制块：任务的返回值和完成标志，由任务和Result共同持有，引用计数为0时归还给分配器
+// 任务和Result不再互相保存指针，Result可以随意移动，任务先执行完或者Result先析构都没有关系
+class ResultState
 {
 public:
-	Result(std::shared_ptr<Task> task, bool isValid = true);
-	~Result() = default;
+	ResultState();
+	ResultState(const ResultState&) = delete;
+	ResultState& operator=(const ResultState&) = delete;
 
-	// 问题一：setVal方法，获取任务执行完的返回值的 ，消费者线程执行完了，调用
+	// 消费者线程执行完任务，保存返回值，通知等待的Result
 	void setVal(Any any);
 
-	// 问题二：get方法，用户调用这个方法获取task的返回值 ， 如果任务还没执行完，阻塞
+	// 等待任务执行完，取出返回值
 	Any get();
+
+	// 释放一个引用，最后一个引用释放时归还给分配器
+	void release();
+
 private:
+	friend class ResultStatePool;
+
 	Any any_;						// 存储任务的返回值
-	Semaphore sem_;					// 线程通信信号量
-	std::shared_ptr<Task> task_;    // 延长生命周期 //指向对应获取返回值的任务对象	// 为什么Result还需要拿到任务类？ 构造时，给每一个task类 加上result类，task就不需要设置  result了
-	std::atomic_bool isValid_;	    // 返回值是否有效
+	CompletionFlag done_;			// 任务执行完成的标志，代替信号量
+	std::atomic_int refCount_;		// 任务和Result各持有一个引用
+	ResultStatePool* pool_;			// 所属的分配器
+	ResultState* next_;				// 空闲链表的下一个
+};
+
+// Result控制块的分配器，由线程池持有
+// 按块申请控制块，用完的放回空闲链表，之后提交任务不再new
+// 线程池析构之后还没释放的Result仍然可以使用，最后一个控制块归还之后分配器才释放
+class ResultStatePool
+{
+public:
+	ResultStatePool();
+	ResultStatePool(const ResultStatePool&) = delete;
+	ResultStatePool& operator=(const ResultStatePool&) = delete;
+
+	// 取一个控制块，引用计数为2：一个给任务，一个给Result
+	ResultState* acquire();
+
+	// 控制块引用计数为0，放回空闲链表
+	void recycle(ResultState* state);
+
+	// 线程池不再使用分配器
+	void release();
+
+private:
+	~ResultStatePool() = default;
+
+	std::mutex mtx_;
+	ResultState* freeList_;							// 空闲的控制块
+	std::vector<std::unique_ptr<ResultState[]>> blocks_;	// 申请过的所有控制块
+	std::atomic_int users_;							// 线程池 + 正在使用的控制块数量，为0时释放分配器
+};
+
+// 实现接收提交到线程池的task任务执行完成后的返回值类型Result
+// 只持有控制块，可以移动，可以放进容器里做fan-out/fan-in
+class Result
+{
+public:
+	Result();
+	// 接管state的一个引用，state为nullptr表示提交失败
+	explicit Result(ResultState* state);
+	~Result();
+	Result(Result&& other) noexcept;
+	Result& operator=(Result&& other) noexcept;
+	Result(const Result&) = delete;
+	Result& operator=(const Result&) = delete;
+
+	// 问题二：get方法，用户调用这个方法获取task的返回值 ， 如果任务还没执行完，阻塞
+	Any get();
+
+	// 提交是否成功，提交失败的Result调用get()不会阻塞，返回的是空结果
+	bool isValid() const;
+private:
+	ResultState* state_;			// 控制块，nullptr表示提交失败
 };
 
 // 任务抽象基类
 // 用户继承该类，实现任务函数编写
+// 同一个任务对象执行完之前不要重复提交
 class Task
 {
 public:
 	Task();
-	~Task() = default;
-	void exec();				// 对不能定义的虚函数进行封装
-	void setResult(Result* res);
+	virtual ~Task();
+	virtual void exec();		// 对不能定义的虚函数进行封装
+	void setResultState(ResultState* state);	// 接管state的一个引用
 
 	// 用户可以自定义任意任务类型，从Task继承，重写run方法，实现自定义任务处理
 	virtual Any run() = 0;
 
 private:
-	Result* result_; // Result对象的声明周期 》
+	ResultState* resultState_; // 执行完之后把返回值写进去，没执行就被销毁时写入空结果，Result不会一直阻塞
+};
+
+// 返回值类型固定为T的任务，用户继承该类，重写call方法
+// 返回值直接保存在任务对象里面，不经过Any，不需要RTTI，也不需要单独的控制块
+// 配合TypedResult<T>使用：pool.submitTask(std::make_shared<MyTask>()) 返回 TypedResult<T>
+template<typename T>
+class TypedTask : public Task
+{
+	static_assert(!std::is_void<T>::value, "task without return value should derive from Task");
+public:
+	using ValueType = T;
+
+	TypedTask()
+		: hasValue_(false)
+	{}
+	~TypedTask()
+	{
+		if (hasValue_)
+			reinterpret_cast<T*>(&value_)->~T();
+	}
+
+	// 用户重写，返回任务的结果
+	virtual T call() = 0;
+
+	// 执行任务，结果或者异常保存在任务里，然后设置完成标志
+	void exec() override
+	{
+		try
+		{
+			new (&value_) T(call());
+			hasValue_ = true;
+		}
+		catch (...)
+		{
+			exception_ = std::current_exception();
+		}
+		done_.set();
+	}
+
+	// 等待任务执行完，取出结果，任务抛出了异常的话在这里重新抛出
+	T takeValue()
+	{
+		done_.wait();
+		if (exception_)
+			std::rethrow_exception(exception_);
+		return std::move(*reinterpret_cast<T*>(&value_));
+	}
+
+	bool isReady() const
+	{
+		return done_.isSet();
+	}
+
+private:
+	// 类型化的任务不走Any
+	Any run() final
+	{
+		return Any();
+	}
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type value_;
+	bool hasValue_;
+	std::exception_ptr exception_;
+	CompletionFlag done_;
+};
+
+// TypedTask<T>的结果，只持有任务对象，可以移动，可以放进容器
+template<typename T>
+class TypedResult
+{
+public:
+	TypedResult(std::shared_ptr<TypedTask<T>> task, bool isValid = true)
+		: task_(std::move(task))
+		, isValid_(isValid)
+	{}
+
+	// 获取task的返回值，如果任务还没执行完，阻塞；提交失败的结果不会阻塞，返回T()
+	T get()
+	{
+		if (!isValid_)
+		{
+			return T();
+		}
+		return task_->takeValue();
+	}
+
+	// 提交是否成功
+	bool isValid() const
+	{
+		return isValid_;
+	}
+
+	// 任务是否已经执行完
+	bool isReady() const
+	{
+		return isValid_ && task_->isReady();
+	}
+
+private:
+	std::shared_ptr<TypedTask<T>> task_;
+	bool isValid_;
 };
 
 // 线程池支持的模式
@@ -145,6 +397,7 @@ enum class PoolMode
 {
 	MODE_FIXED,  // 固定数量的线程
 	MODE_CACHED, // 线程数量可动态增长
+	MODE_WORK_STEALING, // 固定数量的线程，每个线程有自己的任务队列，空闲时从其它线程窃取任务
 };
 
 // 线程类型
@@ -171,6 +424,29 @@ private:
 	int threadId_;  // 保存线程id
 };
 
+// 工作窃取模式下每个线程私有的任务队列
+// 所属线程在队尾push/pop，其它空闲线程从队头窃取，每个队列单独加锁，不再所有线程抢同一把taskQueMtx_
+class WorkStealingQueue
+{
+public:
+	WorkStealingQueue() = default;
+	~WorkStealingQueue() = default;
+	WorkStealingQueue(const WorkStealingQueue&) = delete;
+	WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+	// 所属线程放入任务
+	void push(std::shared_ptr<Task> task);
+
+	// 所属线程取出最新放入的任务
+	std::shared_ptr<Task> tryPop();
+
+	// 其它线程窃取最早放入的任务
+	std::shared_ptr<Task> trySteal();
+private:
+	std::deque<std::shared_ptr<Task>> que_;
+	std::mutex mtx_;
+};
+
 /*
 example:
 ThreadPool pool;
@@ -183,6 +459,15 @@ class MyTask : public Task
 };
 
 pool.submitTask(std::make_shared<MyTask>());
+
+class SumTask : public TypedTask<int>
+{
+	public:
+		int call() { return 1 + 2; }
+};
+
+TypedResult<int> res = pool.submitTask(std::make_shared<SumTask>());
+int sum = res.get();
 */
 
 
@@ -205,9 +490,24 @@ public:
 	// 设置线程池cached模式下线程阈值
 	void setThreadSizeThreshHold(int threshhold);
 
+	// 设置任务队列满了时提交任务最长的等待时间，单位：毫秒，默认1000，0表示不等待立即失败
+	void setSubmitTimeout(int milliseconds);
+
 	// 给线程池提交任务
 	Result submitTask(std::shared_ptr<Task> sp);
 
+	// 提交返回值类型固定的任务，结果直接从任务对象里取，不经过Any
+	template<typename TaskType, typename T = typename TaskType::ValueType>
+	TypedResult<T> submitTask(std::shared_ptr<TaskType> sp)
+	{
+		std::shared_ptr<TypedTask<T>> task(std::move(sp));
+		if (!pushTask(task))
+		{
+			return TypedResult<T>(std::move(task), false);
+		}
+		return TypedResult<T>(std::move(task));
+	}
+
 	// 开启线程池
 	void start(int initThreadSize = std::thread::hardware_concurrency());  //CPU当前的核心数量
 
@@ -215,9 +515,21 @@ public:
 	ThreadPool& operator=(const ThreadPool&) = delete;	// 线程池赋值删除
 
 private:
+	// 把任务放入队列，队列满了等待submitTimeout_后仍然放不进去返回false
+	bool pushTask(std::shared_ptr<Task> sp);
+
 	// 定义线程函数
 	void threadFunc(int threadid);
 
+	// 工作窃取模式的线程函数，index是该线程自己队列的下标
+	void stealingThreadFunc(int threadid, int index);
+
+	// 从注入队列taskQue_取一个外部提交的任务
+	std::shared_ptr<Task> popInjectedTask();
+
+	// 从其它线程的队列窃取一个任务
+	std::shared_ptr<Task> stealTask(int index);
+
 	// 检查pool的运行状态
 	bool checkRunningState() const;
 
@@ -232,6 +544,9 @@ private:
 	std::queue<std::shared_ptr<Task>> taskQue_;						// 任务队列  存储所有待处理的任务
 	std::atomic_int taskSize_;										// 任务的数量	taskQue_.size()
 	int taskQueMaxThreshHold_;									    // 任务队列数量上限阈值
+	int submitTimeout_;												// 任务队列满了时提交任务最长的等待时间，单位：毫秒
+	std::vector<std::unique_ptr<WorkStealingQueue>> workQues_;		// 工作窃取模式下每个线程自己的任务队列，taskQue_作为外部提交任务的注入队列
+	ResultStatePool* resultStatePool_;								// Result控制块的分配器，线程池析构后由最后一个控制块释放
 
 	std::mutex taskQueMtx_;											// 保证任务队列的线程安全
 	std::condition_variable notFull_;								// 表示任务队列不满		用于任务队列加任务	任务队列等待，  消费线程通知   这个控制添加任务的数量，一般的线程池不设置该值。
@@ -4,18 +4,87 @@
 #include <iostream>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <memory>
 #include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <unordered_map>
 #include <thread>
 #include <future>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <exception>
+#include <stdexcept>
+#include <new>
+#include <cstddef>
+#include <string>
+#include <fstream>
+#include <cstdio>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// std::pmr::memory_resource：C++17标准库支持时才提供按memory_resource分配的submitTask
+#if defined(__has_include)
+#if __has_include(<memory_resource>) && (__cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L))
+#include <memory_resource>
+#define THREADPOOL_HAS_PMR 1
+#endif
+#endif
+
+// C++20协程：co_await pool.schedule()、CoroTask<T>、co_await Future，编译器支持时才提供
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <optional>
+#define THREADPOOL_HAS_COROUTINE 1
+#endif
+#endif
 
 const int TASK_MAX_THRESHHOLD = INT32_MAX;  // INT32_MAX;
 const int THREAD_MAX_THRESHHOLD = 1024;
-const int THREAD_MAX_IDLE_TIME = 60;		// 单位：秒
+const int THREAD_MAX_IDLE_TIME = 60;		// 单位：秒，cached模式默认的空闲线程回收时间，可以用setThreadIdleTimeout修改
+const int THREAD_GROW_LATENCY = 1000;		// 单位：微秒，cached模式任务排队超过这个时间才增加线程
+const int CONTROLLER_INTERVAL = 10;			// 单位：毫秒，cached模式控制线程检查线程数量的间隔
+const int THREAD_SPIN_TIME = 50;			// 空闲线程挂起之前自旋的时间，单位：微秒
+const int BLOCKING_THREAD_IDLE_TIME = 100;	// 单位：毫秒，阻塞补偿线程空闲时每隔这么久检查一次阻塞的线程是不是都回来了，回来了就退出
+const int LOCK_FREE_QUE_MAX_SIZE = 16384;	// 无锁任务队列的最大容量，任务队列阈值超过该值时使用该值（每个优先级一个队列）
+const int PRIORITY_STARVATION_INTERVAL = 8;	// 每取这么多个任务，有一次先从低优先级的队列开始取，防止饿死
+const int HELP_WAIT_INTERVAL = 100;			// helpWhileWaiting没有别的任务可做时，每次等待结果的最长时间，单位：微秒
+const int CONTINUATION_MAX_DEPTH = 16;		// 后续任务直接在完成任务的线程上执行的最大嵌套层数，超过了放进任务队列
+const int CACHE_LINE_SIZE = 64;				// 缓存行大小，避免伪共享
+const int SLAB_CLASS_SIZE = 5;				// 小对象分配器的档数，从SLAB_MIN_BLOCK_SIZE开始每档翻倍，超过最大一档直接用operator new
+const int SLAB_MIN_BLOCK_SIZE = 64;			// 小对象分配器最小一档的大小，单位：字节
+const int SLAB_CHUNK_SIZE = 64 * 1024;		// 小对象分配器每次向系统申请的内存大小，单位：字节
+const int HISTOGRAM_BUCKET_SIZE = 40;		// 延迟直方图的桶数，按2的幂分桶，最后一个桶包含所有超过2^38纳秒（约275秒）的值
+const int TIMER_WHEEL_SLOT_BITS = 6;		// 时间轮每层的槽数是2的这么多次方
+const int TIMER_WHEEL_SLOT_SIZE = 1 << TIMER_WHEEL_SLOT_BITS;
+const int TIMER_WHEEL_LEVEL_SIZE = 5;		// 时间轮的层数，第0层每槽1ms，五层一共约12.4天，更远的定时器到时再往下放
+const int TIMER_NODE_BLOCK_SIZE = 256;		// 定时器节点每次申请的个数
+const int STRAND_BATCH_SIZE = 64;			// strand每次被调度最多连续执行的任务数，还有剩余就重新排队，不会一直占着线程
+const int REACTOR_MAX_EVENTS = 256;			// Reactor每次epoll_wait最多取的事件数，取到的事件整批放进线程池
+const int REACTOR_BUFFER_SIZE = 4096;		// Reactor每个连接读缓冲区的初始大小，也是每次读至少留出的空间，单位：字节
+const size_t REACTOR_BUFFER_MAX_SIZE = 1024 * 1024;	// 连接关闭放回空闲列表时，超过这个大小的缓冲区释放掉，单位：字节
+const size_t BULK_CHUNK_BYTES = 64 * 1024;	// parallel_transform/parallel_scan/parallel_sort每块输出的字节数，一块的输入输出放得进L2缓存
+const int GROUP_STRIDE = 1 << 20;			// 执行器组加权公平调度的步长，组每开始执行一个任务虚拟时间增加GROUP_STRIDE / weight
 
 /**
 	@item threadpool
@@ -27,317 +96,7405 @@ enum class PoolMode
 {
 	MODE_FIXED,  // 固定数量的线程
 	MODE_CACHED, // 线程数量可动态增长
+	MODE_WORK_STEALING, // 固定数量的线程，parallel_for在线程内部递归二分，分出去的块放进线程自己的队列由其它线程窃取
 };
+// 所有模式下，初始的每个线程都有自己的任务队列：线程内部提交的普通任务放进自己的队列，空闲时从其它线程的队列窃取任务
 
-// 线程类型
-class Thread
+// 任务的优先级，数值越小优先级越高
+enum class TaskPriority
+{
+	PRIORITY_HIGH,   // 延迟敏感的任务，比如请求处理
+	PRIORITY_NORMAL, // 默认优先级，不指定优先级时使用
+	PRIORITY_LOW,    // 批处理任务
+};
+const int TASK_PRIORITY_SIZE = 3;
+
+// 任务队列的实现方式
+enum class TaskQueMode
+{
+	MODE_LOCKED,    // std::queue + 互斥锁 + 条件变量
+	MODE_LOCK_FREE, // 无锁的多生产者多消费者环形队列，容量由任务队列阈值决定
+};
+
+// 任务队列满了时提交任务的处理方式
+enum class BackpressurePolicy
+{
+	POLICY_BLOCK,       // 等待队列空出位置，最长等待setSubmitTimeout设置的时间（默认1s），超时提交失败
+	POLICY_FAIL_FAST,   // 不等待，立即提交失败
+	POLICY_CALLER_RUNS, // 由提交任务的线程直接执行，提交的速度自然就降下来了
+	POLICY_DROP_OLDEST, // 丢弃队列中最早的任务给新任务腾出位置，被丢弃任务的Future抛出std::future_error(broken_promise)
+};
+
+// 工作线程绑定CPU的方式
+enum class AffinityMode
+{
+	AFFINITY_NONE,     // 不绑定，由操作系统调度
+	AFFINITY_COMPACT,  // 按节点顺序依次绑定CPU，先占满一个NUMA节点再用下一个
+	AFFINITY_SCATTER,  // 轮流绑定到各个NUMA节点，线程均匀分布在所有节点上
+	AFFINITY_EXPLICIT, // 按用户给定的CPU列表依次绑定
+};
+
+// 关闭线程池的方式，三种方式都不再接受外部线程提交的任务，正在执行的任务都会执行完
+enum class ShutdownMode
+{
+	SHUTDOWN_DRAIN,          // 执行完队列中所有的任务再结束线程，析构时使用
+	SHUTDOWN_CANCEL_PENDING, // 队列中还没开始的任务不再执行，Future抛出std::future_error(broken_promise)，等线程结束再返回
+	SHUTDOWN_IMMEDIATE,      // 和SHUTDOWN_CANCEL_PENDING一样丢弃排队的任务，但是不等线程结束，立即返回
+};
+
+// 把线程绑定到一个CPU上，目前只支持Linux，其它平台不绑定返回false
+inline bool bindThreadToCpu(std::thread& t, int cpu)
+{
+#ifdef __linux__
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	return pthread_setaffinity_np(t.native_handle(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+	(void)t;
+	(void)cpu;
+	return false;
+#endif
+}
+
+// CPU拓扑：每个NUMA节点有哪些CPU，节点按系统编号顺序从0开始重新编号，没有CPU的节点不算
+// Linux下读取/sys/devices/system/node，只保留当前进程允许使用的CPU；其它平台或读取失败时当作只有一个节点
+class CpuTopology
 {
 public:
-	// 线程函数对象类型，线程执行的任务函数（包含该线程id）
-	using ThreadFunc = std::function<void(int)>;
+	CpuTopology()
+	{
+#ifdef __linux__
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		bool hasMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+		// 节点编号可能不连续，连续8个编号都不存在时认为已经读完
+		for (int node = 0, missing = 0; missing < 8; node++)
+		{
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			if (!file)
+			{
+				missing++;
+				continue;
+			}
+			missing = 0;
+			std::string list;
+			std::getline(file, list);
+			std::vector<int> cpus;
+			for (int cpu : parseCpuList(list))
+			{
+				if (cpu < CPU_SETSIZE && (!hasMask || CPU_ISSET(cpu, &allowed)))
+					cpus.push_back(cpu);
+			}
+			if (!cpus.empty())
+				nodes_.emplace_back(std::move(cpus));
+		}
+#endif
+		if (nodes_.empty())
+		{
+			int size = std::max(1, (int)std::thread::hardware_concurrency());
+			std::vector<int> cpus(size);
+			for (int i = 0; i < size; i++)
+				cpus[i] = i;
+			nodes_.emplace_back(std::move(cpus));
+		}
+	}
 
-	// 线程构造
-	Thread(ThreadFunc func)
-		: func_(func)
-		, threadId_(generateId_++)
-	{}
-	// 线程析构
-	~Thread() = default;
+	int nodeSize() const
+	{
+		return (int)nodes_.size();
+	}
 
-	// 启动线程
-	void start()
+	const std::vector<int>& nodeCpus(int node) const
 	{
-		// 创建一个线程来执行一个线程函数 pthread_create
-		std::thread t(func_, threadId_);  // C++11来说 线程对象t  和线程函数func_
-		t.detach(); // 设置分离线程   pthread_detach  pthread_t设置成分离线程
+		return nodes_[node];
 	}
 
-	// 获取线程id
-	int getId()const
+	// cpu所在的节点，找不到返回-1
+	int nodeOfCpu(int cpu) const
 	{
-		return threadId_;
+		for (int node = 0; node < nodeSize(); node++)
+		{
+			if (std::find(nodes_[node].begin(), nodes_[node].end(), cpu) != nodes_[node].end())
+				return node;
+		}
+		return -1;
 	}
+
 private:
-	ThreadFunc func_;
-	static int generateId_;
-	int threadId_;  // 保存线程id
+	// 解析"0-3,8-11"格式的CPU列表
+	static std::vector<int> parseCpuList(const std::string& list)
+	{
+		std::vector<int> cpus;
+		size_t pos = 0;
+		while (pos < list.size())
+		{
+			size_t end = list.find(',', pos);
+			if (end == std::string::npos)
+				end = list.size();
+			std::string range = list.substr(pos, end - pos);
+			size_t dash = range.find('-');
+			try
+			{
+				int first = std::stoi(range.substr(0, dash));
+				int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+				for (int cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+			}
+			catch (const std::exception&)
+			{
+				// 空串或者格式不对，跳过这一段
+			}
+			pos = end + 1;
+		}
+		return cpus;
+	}
+
+	std::vector<std::vector<int>> nodes_;
 };
 
-int Thread::generateId_ = 0;	// 静态成员变量，全类共享，不占用对象内存，且只在程序的全局数据区分配一次内存空间
+// 日志级别，低于编译时THREADPOOL_LOG_LEVEL的日志直接编译掉，不产生任何代码
+#define THREADPOOL_LOG_LEVEL_NONE  0
+#define THREADPOOL_LOG_LEVEL_ERROR 1
+#define THREADPOOL_LOG_LEVEL_WARN  2
+#define THREADPOOL_LOG_LEVEL_INFO  3
+#define THREADPOOL_LOG_LEVEL_DEBUG 4
+#define THREADPOOL_LOG_LEVEL_TRACE 5
+
+#ifndef THREADPOOL_LOG_LEVEL
+#define THREADPOOL_LOG_LEVEL THREADPOOL_LOG_LEVEL_WARN
+#endif
 
-// 线程池类型
-class ThreadPool
+enum class LogLevel
+{
+	LOG_ERROR = THREADPOOL_LOG_LEVEL_ERROR,
+	LOG_WARN = THREADPOOL_LOG_LEVEL_WARN,
+	LOG_INFO = THREADPOOL_LOG_LEVEL_INFO,
+	LOG_DEBUG = THREADPOOL_LOG_LEVEL_DEBUG,
+	LOG_TRACE = THREADPOOL_LOG_LEVEL_TRACE,
+};
+
+const int LOG_BUFFER_SIZE = 1024;		// 每个线程的日志环形缓冲区能存放的记录数，满了丢弃新记录
+const int LOG_DRAIN_INTERVAL = 10;		// 后台线程取日志的间隔，单位：毫秒
+const int TRACE_BUFFER_SIZE = 8192;		// 每个线程的跟踪环形缓冲区能存放的事件数，满了覆盖最早的事件
+const int TRACE_RETIRED_BUFFER_SIZE = 64;	// 已经退出的线程最多保留这么多个跟踪缓冲区，更早的释放掉
+
+// 一条日志记录：格式串必须是字符串常量，最多两个整数参数，由后台线程格式化，记录时不申请内存
+struct LogRecord
+{
+	LogLevel level;
+	std::chrono::steady_clock::time_point time;
+	std::thread::id threadId;
+	const char* format;
+	long long args[2];
+};
+
+// 一个线程的日志缓冲区：单生产者（所属线程）单消费者（后台线程）的无锁环形队列
+class alignas(CACHE_LINE_SIZE) LogBuffer
 {
 public:
-	// 线程池构造
-	ThreadPool()
-		: initThreadSize_(0)
-		, taskSize_(0)
-		, idleThreadSize_(0)
-		, curThreadSize_(0)
-		, taskQueMaxThreshHold_(TASK_MAX_THRESHHOLD)
-		, threadSizeThreshHold_(THREAD_MAX_THRESHHOLD)
-		, poolMode_(PoolMode::MODE_FIXED)
-		, isPoolRunning_(false)
+	LogBuffer()
+		: head_(0)
+		, tail_(0)
+		, closed_(false)
 	{}
+	LogBuffer(const LogBuffer&) = delete;
+	LogBuffer& operator=(const LogBuffer&) = delete;
 
-	// 线程池析构
-	~ThreadPool()
+	// 所属线程放入一条记录，满了返回false
+	bool tryPush(const LogRecord& record)
 	{
-		isPoolRunning_ = false;
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) >= (size_t)LOG_BUFFER_SIZE)
+			return false;
+		records_[tail % LOG_BUFFER_SIZE] = record;
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
 
-		// 等待线程池里面所有的线程返回  有两种状态：阻塞 & 正在执行任务中
-		std::unique_lock<std::mutex> lock(taskQueMtx_);
-		notEmpty_.notify_all();
-		exitCond_.wait(lock, [&]()->bool {return threads_.size() == 0; });
+	// 后台线程取出一条记录
+	bool tryPop(LogRecord& record)
+	{
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire))
+			return false;
+		record = records_[head % LOG_BUFFER_SIZE];
+		head_.store(head + 1, std::memory_order_release);
+		return true;
 	}
 
-	// 设置线程池的工作模式
-	void setMode(PoolMode mode)
+	// 所属线程已经退出，取完剩下的记录就可以释放
+	void close() { closed_ = true; }
+	bool isClosed() const { return closed_; }
+
+private:
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_; // 后台线程读
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_; // 所属线程写
+	std::atomic_bool closed_;
+	LogRecord records_[LOG_BUFFER_SIZE];
+};
+
+// 异步日志：每个线程写自己的缓冲区，不竞争任何锁，后台线程定期取出交给输出函数
+// 默认输出到std::cerr，可以用setSink换成别的输出；全局唯一，程序结束时不析构，避免分离线程退出时访问已经析构的对象
+class AsyncLogger
+{
+public:
+	// 输出函数：原始记录和格式化之后的文本，只在后台线程（或者调用flush的线程）中调用
+	using LogSink = std::function<void(const LogRecord&, const std::string&)>;
+
+	static AsyncLogger& instance()
 	{
-		if (checkRunningState())
-			return;
-		poolMode_ = mode;
+		static AsyncLogger* logger = new AsyncLogger();
+		return *logger;
 	}
 
-	// 设置task任务队列上线阈值
-	void setTaskQueMaxThreshHold(int threshhold)
+	void log(LogLevel level, const char* format, long long arg0 = 0, long long arg1 = 0)
 	{
-		if (checkRunningState())
-			return;
-		taskQueMaxThreshHold_ = threshhold;
+		LogRecord record{ level, std::chrono::steady_clock::now(), std::this_thread::get_id(), format, { arg0, arg1 } };
+		if (!localBuffer().tryPush(record))
+			dropped_++;
 	}
 
-	// 设置线程池cached模式下线程阈值
-	void setThreadSizeThreshHold(int threshhold)
+	void setSink(LogSink sink)
 	{
-		if (checkRunningState())
-			return;
-		if (poolMode_ == PoolMode::MODE_CACHED)
-		{
-			threadSizeThreshHold_ = threshhold;
-		}
+		std::lock_guard<std::mutex> lock(drainMtx_);
+		sink_ = std::move(sink);
 	}
 
-	// 给线程池提交任务
-	// 使用可变参模板编程，让submitTask可以接收任意任务函数和任意数量的参数
-	// pool.submitTask(sum1, 10, 20); 
-	// 返回值future<>  Func 函数对象指针  Args 参数列表
-	template<typename Func, typename... Args>		// -> 指定返回值类型，给auto提示
-	auto submitTask(Func&& func, Args&&... args) -> std::future<decltype(func(args...))>	// 推导函数调用之后的返回值（函数，参数）
+	// 立即取出所有线程已经写入的日志并输出
+	void flush()
 	{
-		// 打包任务，放入任务队列里面 RType是类型   函数，参数， 返回类型 = RType
-		using RType = decltype(func(args...));
-		//task	指针，指向packaged_task<RType()包		 // void()
-		// auto = std::shared_ptr<std::packaged_task<RType()>>    packaged_task 需要函数返回值，参数列表，bind 绑定只需包含返回类型就好了
-		auto task = std::make_shared<std::packaged_task<RType()>>(
-		std::bind(std::forward<Func>(func), std::forward<Args>(args)...));		// 把任意参数的绑定到无参函数对象
+		std::lock_guard<std::mutex> lock(drainMtx_);
+		drain();
+	}
 
-		std::future<RType> result = task->get_future();	// 提前绑定结果，  该任务在任务队列 用std::function<void()> 执行
-		// 获取锁
-		std::unique_lock<std::mutex> lock(taskQueMtx_);
-		// 用户提交任务，最长不能阻塞超过1s，否则判断提交任务失败，返回
-		if (!notFull_.wait_for(lock, std::chrono::seconds(1),
-			[&]()->bool { return taskQue_.size() < (size_t)taskQueMaxThreshHold_; }))
-		{
-			// 表示notFull_等待1s种，条件依然没有满足
-			std::cerr << "task queue is full, submit task fail." << std::endl;
-			auto task = std::make_shared<std::packaged_task<RType()>>(
-				[]()->RType { return RType(); });
-			// packaged_task是类，使用要解引用
-			(*task)(); 
-			return task->get_future();
-		}
-
-		// 如果有空余，把任务放入任务队列中
-		// using Task = std::function<void()>;	//function执行pack包的任务
-		// task的智能指针计数+1
-		// 前面的 task 可能是 int() test(), 或者 double()  test() 任务。
-		// function 对task进行封装， 全部封装成void()
-		taskQue_.emplace([task]() {(*task)();}); //task是智能指针 延长生命周期  函数对象延长了生命周期 //不能按引用，引用出作用域就没了
-		taskSize_++;
+	// 有线程写过日志时立即输出，从来没有写过日志时不创建后台线程
+	static void flushIfUsed()
+	{
+		if (used())
+			instance().flush();
+	}
 
-		// 因为新放了任务，任务队列肯定不空了，在notEmpty_上进行通知，赶快分配线程执行任务
-		notEmpty_.notify_all();
+	// 缓冲区满了被丢弃的日志条数
+	uint64_t getDroppedSize() const
+	{
+		return dropped_;
+	}
 
-		// cached模式 任务处理比较紧急 场景：小而快的任务 需要根据任务数量和空闲线程的数量，判断是否需要创建新的线程出来
-		if (poolMode_ == PoolMode::MODE_CACHED
-			&& taskSize_ > idleThreadSize_
-			&& curThreadSize_ < threadSizeThreshHold_)
+	static const char* levelName(LogLevel level)
+	{
+		switch (level)
 		{
-			std::cout << ">>> create new thread..." << std::endl;
-
-			// 创建新的线程对象
-			auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
-			int threadId = ptr->getId();
-			threads_.emplace(threadId, std::move(ptr));
-			// 启动线程
-			threads_[threadId]->start();
-			// 修改线程个数相关的变量
-			curThreadSize_++;
-			idleThreadSize_++;
+		case LogLevel::LOG_ERROR: return "ERROR";
+		case LogLevel::LOG_WARN: return "WARN";
+		case LogLevel::LOG_INFO: return "INFO";
+		case LogLevel::LOG_DEBUG: return "DEBUG";
+		default: return "TRACE";
 		}
-
-		// 返回任务的Result对象
-		return result;
 	}
 
-	// 开启线程池
-	void start(int initThreadSize = std::thread::hardware_concurrency())
+private:
+	static std::atomic_bool& used()
 	{
-		// 设置线程池的运行状态
-		isPoolRunning_ = true;
+		static std::atomic_bool flag(false);
+		return flag;
+	}
 
-		// 记录初始线程个数
-		initThreadSize_ = initThreadSize;
-		curThreadSize_ = initThreadSize;
+	AsyncLogger()
+		: dropped_(0)
+		, sink_([](const LogRecord& record, const std::string& message)
+			{
+				std::cerr << "[" << levelName(record.level) << "] tid:" << record.threadId
+					<< " " << message << std::endl;
+			})
+	{
+		used() = true;
+		std::thread t([this]()
+		{
+			while (true)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_INTERVAL));
+				flush();
+			}
+		});
+		t.detach();
+	}
 
-		// 创建线程对象
-		for (int i = 0; i < initThreadSize_; i++)
+	// 线程退出时关闭自己的缓冲区，缓冲区由后台线程取完以后释放
+	struct LocalBuffer
+	{
+		std::shared_ptr<LogBuffer> buffer;
+		~LocalBuffer()
 		{
-			// 创建thread线程对象的时候，把线程函数给到thread线程对象
-			auto ptr = std::make_unique<Thread>(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1));
-			int threadId = ptr->getId();
-			threads_.emplace(threadId, std::move(ptr));
-			// threads_.emplace_back(std::move(ptr));
+			if (buffer)
+				buffer->close();
 		}
+	};
 
-		// 启动所有线程  std::vector<Thread*> threads_;
-		for (int i = 0; i < initThreadSize_; i++)
+	LogBuffer& localBuffer()
+	{
+		static thread_local LocalBuffer local;
+		if (!local.buffer)
 		{
-			threads_[i]->start(); // 需要去执行一个线程函数
-			idleThreadSize_++;    // 记录初始空闲线程的数量
+			local.buffer = std::make_shared<LogBuffer>();
+			std::lock_guard<std::mutex> lock(buffersMtx_);
+			buffers_.push_back(local.buffer);
 		}
+		return *local.buffer;
 	}
 
-	ThreadPool(const ThreadPool&) = delete;
-	ThreadPool& operator=(const ThreadPool&) = delete;
-
-private:
-	// 定义线程函数
-	void threadFunc(int threadid) // 线程池执行该任务，传入该线程的id
+	// 调用者持有drainMtx_
+	void drain()
 	{
-		auto lastTime = std::chrono::high_resolution_clock().now();
+		std::vector<std::shared_ptr<LogBuffer>> buffers;
+		{
+			std::lock_guard<std::mutex> lock(buffersMtx_);
+			buffers = buffers_;
+		}
 
-		// 所有任务必须执行完成，线程池才可以回收所有线程资源
-		while(true)
+		LogRecord record;
+		char message[256];
+		for (auto& buffer : buffers)
 		{
-			Task task;  // std::function<void()> 函数对象
+			// 先看关闭标志再取：关闭之后不会再有新记录，取空了就可以释放
+			bool closed = buffer->isClosed();
+			while (buffer->tryPop(record))
+			{
+				snprintf(message, sizeof(message), record.format, record.args[0], record.args[1]);
+				sink_(record, message);
+			}
+			if (closed)
 			{
-				// 先获取锁
-				std::unique_lock<std::mutex> lock(taskQueMtx_);
+				std::lock_guard<std::mutex> lock(buffersMtx_);
+				buffers_.erase(std::find(buffers_.begin(), buffers_.end(), buffer));
+			}
+		}
+	}
+
+	std::vector<std::shared_ptr<LogBuffer>> buffers_; // 所有线程的缓冲区
+	std::mutex buffersMtx_; // 保护buffers_，只在线程第一次写日志和后台线程取日志时获取
+	std::atomic<uint64_t> dropped_;
+	LogSink sink_;
+	std::mutex drainMtx_; // 保证同一时间只有一个线程在取日志
+};
 
-				std::cout << "tid:" << std::this_thread::get_id()
-					<< "尝试获取任务..." << std::endl;
+// 记录日志，格式串是printf格式，参数只能是整数，级别低于THREADPOOL_LOG_LEVEL时整个调用编译掉，参数也不会求值
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_ERROR
+#define THREADPOOL_LOG_ERROR(...) AsyncLogger::instance().log(LogLevel::LOG_ERROR, __VA_ARGS__)
+#else
+#define THREADPOOL_LOG_ERROR(...) ((void)0)
+#endif
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_WARN
+#define THREADPOOL_LOG_WARN(...) AsyncLogger::instance().log(LogLevel::LOG_WARN, __VA_ARGS__)
+#else
+#define THREADPOOL_LOG_WARN(...) ((void)0)
+#endif
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_INFO
+#define THREADPOOL_LOG_INFO(...) AsyncLogger::instance().log(LogLevel::LOG_INFO, __VA_ARGS__)
+#else
+#define THREADPOOL_LOG_INFO(...) ((void)0)
+#endif
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_DEBUG
+#define THREADPOOL_LOG_DEBUG(...) AsyncLogger::instance().log(LogLevel::LOG_DEBUG, __VA_ARGS__)
+#else
+#define THREADPOOL_LOG_DEBUG(...) ((void)0)
+#endif
+#if THREADPOOL_LOG_LEVEL >= THREADPOOL_LOG_LEVEL_TRACE
+#define THREADPOOL_LOG_TRACE(...) AsyncLogger::instance().log(LogLevel::LOG_TRACE, __VA_ARGS__)
+#else
+#define THREADPOOL_LOG_TRACE(...) ((void)0)
+#endif
 
-				// cached模式下，有可能已经创建了很多的线程，但是空闲时间超过60s，应该把多余的线程
-				// 结束回收掉（超过initThreadSize_数量的线程要进行回收）
-				// 当前时间 - 上一次线程执行的时间 > 60s
+// 跟踪事件的类型，见ThreadPool::startTrace()
+enum class TraceEventType : uint8_t
+{
+	TRACE_SUBMIT,		// 提交任务，参数是这一批的任务数
+	TRACE_DEQUEUE,		// 取到一个任务，参数为1表示是从别的队列窃取来的
+	TRACE_RUN_BEGIN,	// 开始执行任务
+	TRACE_RUN_END,		// 任务执行完
+	TRACE_PARK,			// 线程挂起
+	TRACE_UNPARK,		// 线程醒来（被唤醒或者超时）
+	TRACE_GROW,			// cached模式提交任务时发现积压，唤醒控制线程增加线程
+	TRACE_SPAWN,		// 创建线程，参数是新线程的id
+	TRACE_RECLAIM,		// 线程空闲回收，参数是线程的id
+	TRACE_LOCK_BEGIN,	// 开始等待taskQueMtx_，只记录有竞争的情况
+	TRACE_LOCK_END,		// 拿到了taskQueMtx_
+};
 
-				// 每一秒中返回一次   怎么区分：超时返回？还是有任务待执行返回
-				// 锁 + 双重判断
-				while (taskQue_.size() == 0)
-				{
-					// 线程池要结束，回收线程资源
-					if (!isPoolRunning_)
-					{
-						threads_.erase(threadid); // std::this_thread::getid()
-						std::cout << "threadid:" << std::this_thread::get_id() << " exit!"
-							<< std::endl;
-						exitCond_.notify_all();
-						return; // 线程函数结束，线程结束
-					}
+// 跟踪导出的格式
+enum class TraceFormat
+{
+	TRACE_CHROME_JSON,	// Chrome trace JSON，chrome://tracing和Perfetto UI都能打开
+	TRACE_PERFETTO,		// Perfetto的protobuf格式（TrackEvent）
+};
 
-					if (poolMode_ == PoolMode::MODE_CACHED)
-					{
-						// 条件变量，超时返回了
-						if (std::cv_status::timeout ==
-							notEmpty_.wait_for(lock, std::chrono::seconds(1)))
-						{
-							auto now = std::chrono::high_resolution_clock().now();
-							auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-							if (dur.count() >= THREAD_MAX_IDLE_TIME
-								&& curThreadSize_ > initThreadSize_)
-							{
-								// 开始回收当前线程
-								// 记录线程数量的相关变量的值修改
-								// 把线程对象从线程列表容器中删除   没有办法 threadFunc《=》thread对象
-								// threadid => thread对象 => 删除
-								threads_.erase(threadid); // std::this_thread::getid()
-								curThreadSize_--;
-								idleThreadSize_--;
-
-								std::cout << "threadid:" << std::this_thread::get_id() << " exit!"
-									<< std::endl;
-								return;
-							}
-						}
-					}
-					else
-					{
-						// 等待notEmpty条件
-						notEmpty_.wait(lock);
-					}
-				}
+// 跟踪用的时钟：x86上直接读TSC，比steady_clock便宜；导出时按开始跟踪和导出时的两次对时换算成纳秒
+inline uint64_t traceClock()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	return __rdtsc();
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#else
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
 
-				idleThreadSize_--;
+// 一个导出的跟踪事件，time是traceClock()的值
+struct TraceEvent
+{
+	uint64_t time;
+	TraceEventType type;
+	uint64_t arg;
+};
 
-				std::cout << "tid:" << std::this_thread::get_id()
-					<< "获取任务成功..." << std::endl;
+// 一个线程的跟踪缓冲区：只有所属线程写，满了覆盖最早的事件，记录时不加锁也不申请内存
+// 每个槽位是一个顺序锁：导出线程读的过程中被覆盖的事件直接丢掉
+class alignas(CACHE_LINE_SIZE) TraceBuffer
+{
+public:
+	TraceBuffer(int id, int threadId)
+		: id_(id)
+		, threadId_(threadId)
+		, tail_(0)
+		, closed_(false)
+	{}
+	TraceBuffer(const TraceBuffer&) = delete;
+	TraceBuffer& operator=(const TraceBuffer&) = delete;
 
-				// 从任务队列中取一个任务出来
-				task = taskQue_.front();
-				taskQue_.pop();
-				taskSize_--;
+	// 所属线程写入一个事件，owner是记录事件的线程池
+	void push(const void* owner, TraceEventType type, uint64_t arg, uint64_t time)
+	{
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		Slot& slot = slots_[tail % TRACE_BUFFER_SIZE];
+		slot.seq.store(WRITING, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.owner.store(owner, std::memory_order_relaxed);
+		slot.time.store(time, std::memory_order_relaxed);
+		slot.info.store((arg << 8) | (uint64_t)type, std::memory_order_relaxed);
+		slot.seq.store(tail, std::memory_order_release);
+		tail_.store(tail + 1, std::memory_order_relaxed);
+	}
 
-				// 如果依然有剩余任务，继续通知其它得线程执行任务
-				if (taskQue_.size() > 0)
-				{
-					notEmpty_.notify_all();
-				}
+	// 取出owner记录的、time不早于since的事件，按记录的顺序
+	void collect(const void* owner, uint64_t since, std::vector<TraceEvent>& events) const
+	{
+		size_t tail = tail_.load(std::memory_order_acquire);
+		size_t begin = tail > (size_t)TRACE_BUFFER_SIZE ? tail - TRACE_BUFFER_SIZE : 0;
+		for (size_t i = begin; i < tail; i++)
+		{
+			const Slot& slot = slots_[i % TRACE_BUFFER_SIZE];
+			if (slot.seq.load(std::memory_order_acquire) != i)
+				continue;
+			const void* slotOwner = slot.owner.load(std::memory_order_relaxed);
+			uint64_t time = slot.time.load(std::memory_order_relaxed);
+			uint64_t info = slot.info.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.seq.load(std::memory_order_relaxed) != i)
+				continue;
+			if (slotOwner == owner && time >= since)
+				events.push_back(TraceEvent{ time, (TraceEventType)(info & 0xff), info >> 8 });
+		}
+	}
 
-				// 取出一个任务，进行通知，通知可以继续提交生产任务
-				notFull_.notify_all();
-			} // 就应该把锁释放掉
+	int getId() const { return id_; }
+	int getThreadId() const { return threadId_; }
 
-			// 当前线程负责执行这个任务 task函数对象，  函数指针， 指向nullptr
-			if (task != nullptr)
-			{
-				task(); // 执行function<void()> 
-			}
+	// 所属线程已经退出，缓冲区留着给之后导出
+	void close() { closed_ = true; }
+	bool isClosed() const { return closed_; }
 
-			idleThreadSize_++;
-			lastTime = std::chrono::high_resolution_clock().now(); // 更新线程执行完任务的时间
-		}
+private:
+	static const size_t WRITING = SIZE_MAX; // 正在写的槽位的序号
+
+	struct Slot
+	{
+		std::atomic<size_t> seq{ WRITING }; // 槽位里是第几个事件
+		std::atomic<const void*> owner{ nullptr };
+		std::atomic<uint64_t> time{ 0 };
+		std::atomic<uint64_t> info{ 0 }; // 低8位是事件类型，其余是参数
+	};
+
+	int id_; // 导出时的线程编号
+	int threadId_; // 线程池的线程id，不是线程池的线程为-1
+	std::atomic<size_t> tail_;
+	std::atomic_bool closed_;
+	Slot slots_[TRACE_BUFFER_SIZE];
+};
+
+// 一个线程导出的跟踪事件
+struct TraceThread
+{
+	int id;
+	int threadId;
+	std::vector<TraceEvent> events;
+};
+
+// 导出Perfetto格式用的protobuf编码，只有用到的几种字段类型
+class ProtoWriter
+{
+public:
+	void writeVarint(int field, uint64_t value)
+	{
+		putVarint((uint64_t)field << 3);
+		putVarint(value);
 	}
 
-	// 检查pool的运行状态
-	bool checkRunningState() const
+	void writeBytes(int field, const std::string& value)
 	{
-		return isPoolRunning_;
+		putVarint(((uint64_t)field << 3) | 2);
+		putVarint(value.size());
+		data_ += value;
 	}
 
+	void writeMessage(int field, const ProtoWriter& message)
+	{
+		writeBytes(field, message.data_);
+	}
+
+	const std::string& data() const { return data_; }
+
 private:
-	std::unordered_map<int, std::unique_ptr<Thread>> threads_; // 线程列表
+	void putVarint(uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			data_.push_back((char)(value | 0x80));
+			value >>= 7;
+		}
+		data_.push_back((char)value);
+	}
 
-	int initThreadSize_;  // 初始的线程数量
-	int threadSizeThreshHold_; // 线程数量上限阈值
-	std::atomic_int curThreadSize_;	// 记录当前线程池里面线程的总数量
-	std::atomic_int idleThreadSize_; // 记录空闲线程的数量
+	std::string data_;
+};
 
-	// Task任务 =》 函数对象  中间层，不能确定任务的返回值，用；lambda执行
-	using Task = std::function<void()>;
-	std::queue<Task> taskQue_; // 任务队列  线程池安装，不会释放掉
-	std::atomic_int taskSize_; // 任务的数量
-	int taskQueMaxThreshHold_;  // 任务队列数量上限阈值
+// 所有线程的跟踪缓冲区，全局唯一，程序结束时不析构；线程第一次记录事件时才创建自己的缓冲区
+class TraceRecorder
+{
+public:
+	static TraceRecorder& instance()
+	{
+		static TraceRecorder* recorder = new TraceRecorder();
+		return *recorder;
+	}
 
-	std::mutex taskQueMtx_; // 保证任务队列的线程安全
-	std::condition_variable notFull_; // 表示任务队列不满
-	std::condition_variable notEmpty_; // 表示任务队列不空
-	std::condition_variable exitCond_; // 等到线程资源全部回收
+	void record(const void* owner, TraceEventType type, uint64_t arg = 0)
+	{
+		localBuffer().push(owner, type, arg, traceClock());
+	}
 
-	PoolMode poolMode_; // 当前线程池的工作模式
-	std::atomic_bool isPoolRunning_; // 表示当前线程池的启动状态
+	// 线程池的线程一启动就登记自己的id，导出时用来给线程命名；这时还不创建缓冲区
+	static void setThreadId(int threadId)
+	{
+		localThreadId() = threadId;
+	}
+
+	// 取出owner从since开始的事件，每个有事件的线程一项
+	std::vector<TraceThread> collect(const void* owner, uint64_t since)
+	{
+		std::vector<std::shared_ptr<TraceBuffer>> buffers;
+		{
+			std::lock_guard<std::mutex> lock(buffersMtx_);
+			buffers = buffers_;
+		}
+		std::vector<TraceThread> result;
+		for (auto& buffer : buffers)
+		{
+			TraceThread thread{ buffer->getId(), buffer->getThreadId(), {} };
+			buffer->collect(owner, since, thread.events);
+			if (!thread.events.empty())
+				result.push_back(std::move(thread));
+		}
+		return result;
+	}
+
+	// 导出成Chrome trace JSON，事件的time已经换算成从开始跟踪算起的纳秒
+	static void writeChromeJson(std::ostream& out, const std::vector<TraceThread>& threads)
+	{
+		out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		bool first = true;
+		char line[256];
+		for (const TraceThread& thread : threads)
+		{
+			snprintf(line, sizeof(line), "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",", thread.id, threadName(thread).c_str());
+			out << line;
+			first = false;
+			for (const TraceEvent& event : thread.events)
+			{
+				double ts = event.time / 1000.0;
+				const char* name = eventName(event.type);
+				switch (event.type)
+				{
+				case TraceEventType::TRACE_RUN_BEGIN:
+				case TraceEventType::TRACE_PARK:
+				case TraceEventType::TRACE_LOCK_BEGIN:
+					snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", name, thread.id, ts);
+					break;
+				case TraceEventType::TRACE_RUN_END:
+				case TraceEventType::TRACE_UNPARK:
+				case TraceEventType::TRACE_LOCK_END:
+					snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", name, thread.id, ts);
+					break;
+				default:
+					snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"%s\":%llu}}",
+						name, thread.id, ts, argName(event.type), (unsigned long long)event.arg);
+					break;
+				}
+				out << line;
+			}
+		}
+		out << "\n]}\n";
+	}
+
+	// 导出成Perfetto的protobuf格式：每个线程一条track，执行、挂起、等锁是slice，其它是instant
+	// 同一个序列里的事件按时间排好序再写
+	static void writePerfetto(std::ostream& out, const std::vector<TraceThread>& threads)
+	{
+		const int SEQUENCE_ID = 1;
+		std::vector<std::pair<uint64_t, std::pair<const TraceThread*, const TraceEvent*>>> events;
+		bool first = true;
+		for (const TraceThread& thread : threads)
+		{
+			ProtoWriter threadDesc;
+			threadDesc.writeVarint(1, 1); // pid
+			threadDesc.writeVarint(2, (uint64_t)thread.id); // tid
+			threadDesc.writeBytes(5, threadName(thread)); // thread_name
+			ProtoWriter trackDesc;
+			trackDesc.writeVarint(1, (uint64_t)thread.id); // uuid
+			trackDesc.writeMessage(4, threadDesc); // thread
+			ProtoWriter packet;
+			packet.writeVarint(10, SEQUENCE_ID); // trusted_packet_sequence_id
+			if (first)
+				packet.writeVarint(13, 1); // sequence_flags = SEQ_INCREMENTAL_STATE_CLEARED
+			packet.writeMessage(60, trackDesc); // track_descriptor
+			writePacket(out, packet);
+			first = false;
+
+			for (const TraceEvent& event : thread.events)
+			{
+				events.push_back({ event.time, { &thread, &event } });
+			}
+		}
+		std::stable_sort(events.begin(), events.end(),
+			[](const decltype(events)::value_type& a, const decltype(events)::value_type& b) { return a.first < b.first; });
+
+		for (auto& item : events)
+		{
+			const TraceThread& thread = *item.second.first;
+			const TraceEvent& event = *item.second.second;
+			ProtoWriter trackEvent;
+			switch (event.type)
+			{
+			case TraceEventType::TRACE_RUN_BEGIN:
+			case TraceEventType::TRACE_PARK:
+			case TraceEventType::TRACE_LOCK_BEGIN:
+				trackEvent.writeVarint(9, 1); // type = TYPE_SLICE_BEGIN
+				trackEvent.writeBytes(23, eventName(event.type)); // name
+				break;
+			case TraceEventType::TRACE_RUN_END:
+			case TraceEventType::TRACE_UNPARK:
+			case TraceEventType::TRACE_LOCK_END:
+				trackEvent.writeVarint(9, 2); // type = TYPE_SLICE_END
+				break;
+			default:
+			{
+				trackEvent.writeVarint(9, 3); // type = TYPE_INSTANT
+				trackEvent.writeBytes(23, eventName(event.type));
+				ProtoWriter annotation;
+				annotation.writeBytes(10, argName(event.type)); // name
+				annotation.writeVarint(3, event.arg); // uint_value
+				trackEvent.writeMessage(4, annotation); // debug_annotations
+				break;
+			}
+			}
+			trackEvent.writeVarint(11, (uint64_t)thread.id); // track_uuid
+			ProtoWriter packet;
+			packet.writeVarint(8, event.time); // timestamp
+			packet.writeVarint(10, SEQUENCE_ID);
+			packet.writeMessage(11, trackEvent); // track_event
+			writePacket(out, packet);
+		}
+	}
+
+	static const char* eventName(TraceEventType type)
+	{
+		switch (type)
+		{
+		case TraceEventType::TRACE_SUBMIT: return "submit";
+		case TraceEventType::TRACE_DEQUEUE: return "dequeue";
+		case TraceEventType::TRACE_RUN_BEGIN:
+		case TraceEventType::TRACE_RUN_END: return "run";
+		case TraceEventType::TRACE_PARK:
+		case TraceEventType::TRACE_UNPARK: return "park";
+		case TraceEventType::TRACE_GROW: return "grow";
+		case TraceEventType::TRACE_SPAWN: return "spawn";
+		case TraceEventType::TRACE_RECLAIM: return "reclaim";
+		default: return "lock taskQueMtx_";
+		}
+	}
+
+private:
+	static const char* argName(TraceEventType type)
+	{
+		switch (type)
+		{
+		case TraceEventType::TRACE_SUBMIT: return "count";
+		case TraceEventType::TRACE_DEQUEUE: return "steal";
+		case TraceEventType::TRACE_GROW: return "backlog";
+		default: return "threadid";
+		}
+	}
+
+	static std::string threadName(const TraceThread& thread)
+	{
+		if (thread.threadId >= 0)
+			return "worker " + std::to_string(thread.threadId);
+		return "thread " + std::to_string(thread.id);
+	}
+
+	// Trace消息的packet字段（编号1），整个文件就是一串packet
+	static void writePacket(std::ostream& out, const ProtoWriter& packet)
+	{
+		ProtoWriter trace;
+		trace.writeMessage(1, packet);
+		out.write(trace.data().data(), (std::streamsize)trace.data().size());
+	}
+
+	TraceRecorder()
+		: nextId_(1)
+	{}
+
+	static int& localThreadId()
+	{
+		static thread_local int threadId = -1;
+		return threadId;
+	}
+
+	// 线程退出时关闭自己的缓冲区；已经退出的线程只保留最近TRACE_RETIRED_BUFFER_SIZE个，cached模式反复创建线程也不会一直涨
+	struct LocalBuffer
+	{
+		std::shared_ptr<TraceBuffer> buffer;
+		~LocalBuffer()
+		{
+			if (buffer)
+				buffer->close();
+		}
+	};
+
+	TraceBuffer& localBuffer()
+	{
+		static thread_local LocalBuffer local;
+		if (!local.buffer)
+		{
+			std::lock_guard<std::mutex> lock(buffersMtx_);
+			int closed = 0;
+			for (auto it = buffers_.rbegin(); it != buffers_.rend(); )
+			{
+				if ((*it)->isClosed() && ++closed > TRACE_RETIRED_BUFFER_SIZE)
+					it = std::vector<std::shared_ptr<TraceBuffer>>::reverse_iterator(buffers_.erase(std::next(it).base()));
+				else
+					++it;
+			}
+			local.buffer = std::make_shared<TraceBuffer>(nextId_++, localThreadId());
+			buffers_.push_back(local.buffer);
+		}
+		return *local.buffer;
+	}
+
+	std::vector<std::shared_ptr<TraceBuffer>> buffers_; // 所有线程的缓冲区，按创建的顺序
+	std::mutex buffersMtx_; // 保护buffers_，只在线程第一次记录事件和导出时获取
+	int nextId_;
+};
+
+// 线程类型
+class Thread
+{
+public:
+	// 线程函数对象类型，线程执行的任务函数（包含该线程id）
+	using ThreadFunc = std::function<void(int)>;
+
+	// 线程构造  cpu是要绑定的CPU编号，-1表示不绑定
+	Thread(ThreadFunc func, int cpu = -1)
+		: func_(func)
+		, threadId_(generateId_++)
+		, cpu_(cpu)
+	{}
+	// 线程析构  线程函数必须已经返回或者马上返回，不能在线程自己里面析构
+	~Thread()
+	{
+		join();
+	}
+
+	// 启动线程
+	void start()
+	{
+		// 创建一个线程来执行一个线程函数 pthread_create
+		thread_ = std::thread(func_, threadId_);  // C++11来说 线程对象thread_  和线程函数func_
+		if (cpu_ >= 0)
+		{
+			bindThreadToCpu(thread_, cpu_);
+		}
+	}
+
+	// 等待线程函数返回  pthread_join
+	void join()
+	{
+		if (thread_.joinable())
+			thread_.join();
+	}
+
+	// 获取线程id
+	int getId()const
+	{
+		return threadId_;
+	}
+private:
+	ThreadFunc func_;
+	std::thread thread_;
+	static int generateId_;
+	int threadId_;  // 保存线程id
+	int cpu_;       // 绑定的CPU，-1表示不绑定
+};
+
+int Thread::generateId_ = 0;	// 静态成员变量，全类共享，不占用对象内存，且只在程序的全局数据区分配一次内存空间
+
+// 线程池内部小对象（结果状态、放不进Task的函数对象、协程帧）的分配器
+// 按大小分成SLAB_CLASS_SIZE档，每个线程一个缓存：分配和同一线程的释放只操作自己的空闲链表，不加锁
+// 别的线程释放的块用CAS挂到所属缓存的远程链表上，所属线程空闲链表用完时一次全部取回
+// 线程退出时缓存留给之后创建的线程继续使用；申请的内存不还给系统，总量不超过使用的峰值
+class SlabAllocator
+{
+public:
+	static void* allocate(size_t size)
+	{
+		int index = classIndex(size);
+		Cache* cache = index >= 0 ? localCache() : nullptr;
+		if (cache == nullptr)
+		{
+			// 太大的对象，或者线程已经在退出，直接用operator new，头部owner为nullptr
+			Header* header = static_cast<Header*>(::operator new(sizeof(Header) + size));
+			header->owner = nullptr;
+			header->index = 0;
+			return header + 1;
+		}
+
+		FreeBlock* block = cache->freeList[index];
+		if (block == nullptr)
+		{
+			block = cache->remoteFree[index].exchange(nullptr, std::memory_order_acquire);
+			if (block == nullptr)
+				block = refill(cache, index);
+		}
+		cache->freeList[index] = block->next;
+		return block;
+	}
+
+	static void deallocate(void* ptr)
+	{
+		if (ptr == nullptr)
+			return;
+		Header* header = static_cast<Header*>(ptr) - 1;
+		Cache* owner = header->owner;
+		if (owner == nullptr)
+		{
+			::operator delete(header);
+			return;
+		}
+
+		FreeBlock* block = static_cast<FreeBlock*>(ptr);
+		size_t index = header->index;
+		if (owner == localCache())
+		{
+			block->next = owner->freeList[index];
+			owner->freeList[index] = block;
+			return;
+		}
+		// 别的线程的缓存：压进远程链表，只有所属线程会一次整个取走，不会有ABA问题
+		FreeBlock* head = owner->remoteFree[index].load(std::memory_order_relaxed);
+		do
+		{
+			block->next = head;
+		} while (!owner->remoteFree[index].compare_exchange_weak(head, block,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+private:
+	struct Cache;
+
+	// 每个块前面的头部，记录所属的缓存和档位，释放时不需要知道大小
+	struct alignas(std::max_align_t) Header
+	{
+		Cache* owner;
+		size_t index;
+	};
+
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct Cache
+	{
+		Cache()
+			: nextOrphan(nullptr)
+		{
+			for (int i = 0; i < SLAB_CLASS_SIZE; i++)
+			{
+				freeList[i] = nullptr;
+				remoteFree[i] = nullptr;
+			}
+		}
+
+		FreeBlock* freeList[SLAB_CLASS_SIZE]; // 只有所属线程访问
+		unsigned char padding[CACHE_LINE_SIZE]; // 隔开freeList和remoteFree，避免伪共享
+		std::atomic<FreeBlock*> remoteFree[SLAB_CLASS_SIZE]; // 别的线程释放的块
+		std::vector<void*> chunks; // 向系统申请的内存
+		Cache* nextOrphan; // 没有线程使用的缓存链表
+	};
+
+	// 所有线程共用：线程退出后留下的缓存
+	struct Registry
+	{
+		std::mutex mtx;
+		Cache* orphans = nullptr;
+	};
+
+	// 线程退出时把缓存交给Registry
+	struct CacheGuard
+	{
+		~CacheGuard()
+		{
+			Cache*& cache = localSlot();
+			Registry& registry = instance();
+			{
+				std::lock_guard<std::mutex> lock(registry.mtx);
+				cache->nextOrphan = registry.orphans;
+				registry.orphans = cache;
+			}
+			cache = nullptr;
+			exitedSlot() = true;
+		}
+	};
+
+	static int classIndex(size_t size)
+	{
+		for (int i = 0; i < SLAB_CLASS_SIZE; i++)
+		{
+			if (size <= ((size_t)SLAB_MIN_BLOCK_SIZE << i))
+				return i;
+		}
+		return -1;
+	}
+
+	// 不会析构，线程退出时析构的对象也可以安全地释放内存
+	static Registry& instance()
+	{
+		static Registry* registry = new Registry();
+		return *registry;
+	}
+
+	static Cache*& localSlot()
+	{
+		static thread_local Cache* cache = nullptr;
+		return cache;
+	}
+
+	static bool& exitedSlot()
+	{
+		static thread_local bool exited = false;
+		return exited;
+	}
+
+	// 当前线程的缓存，第一次使用时优先接手退出的线程留下的缓存；线程正在退出时返回nullptr
+	static Cache* localCache()
+	{
+		Cache*& cache = localSlot();
+		if (cache == nullptr && !exitedSlot())
+		{
+			Registry& registry = instance();
+			{
+				std::lock_guard<std::mutex> lock(registry.mtx);
+				cache = registry.orphans;
+				if (cache != nullptr)
+					registry.orphans = cache->nextOrphan;
+			}
+			if (cache == nullptr)
+				cache = new Cache();
+			cache->nextOrphan = nullptr;
+			static thread_local CacheGuard guard;
+			(void)guard;
+		}
+		return cache;
+	}
+
+	// 空闲链表和远程链表都空了，申请一块内存切成这一档的块
+	static FreeBlock* refill(Cache* cache, int index)
+	{
+		size_t blockSize = sizeof(Header) + ((size_t)SLAB_MIN_BLOCK_SIZE << index);
+		size_t count = std::max<size_t>(1, SLAB_CHUNK_SIZE / blockSize);
+		unsigned char* chunk = static_cast<unsigned char*>(::operator new(blockSize * count));
+		cache->chunks.push_back(chunk);
+
+		FreeBlock* head = nullptr;
+		for (size_t i = count; i > 0; i--)
+		{
+			Header* header = reinterpret_cast<Header*>(chunk + (i - 1) * blockSize);
+			header->owner = cache;
+			header->index = (size_t)index;
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(header + 1);
+			block->next = head;
+			head = block;
+		}
+		return head;
+	}
+};
+
+// 线程池内部的任务类型：只能移动、不能拷贝的类型擦除函数对象，代替std::function<void()>
+// 可调用对象不超过TASK_INLINE_SIZE字节时直接存放在Task内部，提交小任务不需要申请堆内存
+// 整个Task正好占一个缓存行
+class Task
+{
+public:
+	Task() noexcept
+		: ops_(nullptr)
+	{}
+
+	template<typename Func, typename = typename std::enable_if<
+		!std::is_same<typename std::decay<Func>::type, Task>::value>::type>
+	Task(Func&& func)
+		: ops_(nullptr)
+	{
+		using F = typename std::decay<Func>::type;
+		// 放得下、对齐要求不超过缓冲区、移动不会抛异常，才能放在内部，否则放到堆上
+		constexpr bool isInline = sizeof(F) <= TASK_INLINE_SIZE
+			&& alignof(F) <= alignof(std::max_align_t)
+			&& std::is_nothrow_move_constructible<F>::value;
+		construct<F>(std::forward<Func>(func), std::integral_constant<bool, isInline>());
+	}
+
+	~Task()
+	{
+		reset();
+	}
+
+	Task(Task&& other) noexcept
+		: ops_(nullptr)
+	{
+		moveFrom(other);
+	}
+
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			moveFrom(other);
+		}
+		return *this;
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	// 执行任务
+	void operator()()
+	{
+		ops_->invoke(storage_);
+	}
+
+	// 是否保存了可调用对象
+	explicit operator bool() const noexcept
+	{
+		return ops_ != nullptr;
+	}
+
+	// 可调用对象有isCancelled()并且返回true时，任务已经被取消，可以不执行直接从队列里清掉
+	bool isCancelled() const
+	{
+		return ops_ != nullptr && ops_->cancelled(storage_);
+	}
+
+private:
+	static const size_t TASK_INLINE_SIZE = CACHE_LINE_SIZE - sizeof(void*);
+
+	// 每种可调用对象类型一张函数表，代替虚函数
+	struct Ops
+	{
+		void (*invoke)(void* storage);
+		void (*move)(void* dst, void* src);	// 从src移动构造到dst，并析构src
+		void (*destroy)(void* storage);
+		bool (*cancelled)(const void* storage);
+	};
+
+	template<typename F, typename = void>
+	struct HasIsCancelled : std::false_type {};
+
+	template<typename F>
+	struct HasIsCancelled<F, decltype((void)std::declval<const F&>().isCancelled())> : std::true_type {};
+
+	template<typename F>
+	static bool isCancelled(const F& func, std::true_type) { return func.isCancelled(); }
+
+	template<typename F>
+	static bool isCancelled(const F&, std::false_type) { return false; }
+
+	// 可调用对象直接构造在storage_里面
+	template<typename F>
+	struct InlineOps
+	{
+		static void invoke(void* storage) { (*static_cast<F*>(storage))(); }
+		static void move(void* dst, void* src)
+		{
+			new (dst) F(std::move(*static_cast<F*>(src)));
+			static_cast<F*>(src)->~F();
+		}
+		static void destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+		static bool cancelled(const void* storage) { return isCancelled(*static_cast<const F*>(storage), HasIsCancelled<F>()); }
+		static const Ops table;
+	};
+
+	// 可调用对象放在SlabAllocator分配的内存上，storage_里面只保存指针
+	template<typename F>
+	struct HeapOps
+	{
+		static void invoke(void* storage) { (**static_cast<F**>(storage))(); }
+		static void move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+		static void destroy(void* storage)
+		{
+			F* func = *static_cast<F**>(storage);
+			func->~F();
+			SlabAllocator::deallocate(func);
+		}
+		static bool cancelled(const void* storage) { return isCancelled(**static_cast<F* const*>(storage), HasIsCancelled<F>()); }
+		static const Ops table;
+	};
+
+	// 对齐要求超过SlabAllocator的可调用对象，用new分配
+	template<typename F>
+	struct AlignedHeapOps
+	{
+		static void invoke(void* storage) { (**static_cast<F**>(storage))(); }
+		static void move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+		static void destroy(void* storage) { delete *static_cast<F**>(storage); }
+		static bool cancelled(const void* storage) { return isCancelled(**static_cast<F* const*>(storage), HasIsCancelled<F>()); }
+		static const Ops table;
+	};
+
+	template<typename F, typename Func>
+	void construct(Func&& func, std::true_type)
+	{
+		new (storage_) F(std::forward<Func>(func));
+		ops_ = &InlineOps<F>::table;
+	}
+
+	template<typename F, typename Func>
+	void construct(Func&& func, std::false_type)
+	{
+		constructHeap<F>(std::forward<Func>(func), std::integral_constant<bool, (alignof(F) <= alignof(std::max_align_t))>());
+	}
+
+	template<typename F, typename Func>
+	void constructHeap(Func&& func, std::true_type)
+	{
+		void* memory = SlabAllocator::allocate(sizeof(F));
+		try
+		{
+			*reinterpret_cast<F**>(storage_) = new (memory) F(std::forward<Func>(func));
+		}
+		catch (...)
+		{
+			SlabAllocator::deallocate(memory);
+			throw;
+		}
+		ops_ = &HeapOps<F>::table;
+	}
+
+	template<typename F, typename Func>
+	void constructHeap(Func&& func, std::false_type)
+	{
+		*reinterpret_cast<F**>(storage_) = new F(std::forward<Func>(func));
+		ops_ = &AlignedHeapOps<F>::table;
+	}
+
+	void moveFrom(Task& other) noexcept
+	{
+		if (other.ops_ != nullptr)
+		{
+			other.ops_->move(storage_, other.storage_);
+			ops_ = other.ops_;
+			other.ops_ = nullptr;
+		}
+	}
+
+	void reset() noexcept
+	{
+		if (ops_ != nullptr)
+		{
+			ops_->destroy(storage_);
+			ops_ = nullptr;
+		}
+	}
+
+private:
+	alignas(std::max_align_t) unsigned char storage_[TASK_INLINE_SIZE];
+	const Ops* ops_;
+};
+
+template<typename F>
+const Task::Ops Task::InlineOps<F>::table = { &Task::InlineOps<F>::invoke, &Task::InlineOps<F>::move, &Task::InlineOps<F>::destroy, &Task::InlineOps<F>::cancelled };
+
+template<typename F>
+const Task::Ops Task::HeapOps<F>::table = { &Task::HeapOps<F>::invoke, &Task::HeapOps<F>::move, &Task::HeapOps<F>::destroy, &Task::HeapOps<F>::cancelled };
+
+template<typename F>
+const Task::Ops Task::AlignedHeapOps<F>::table = { &Task::AlignedHeapOps<F>::invoke, &Task::AlignedHeapOps<F>::move, &Task::AlignedHeapOps<F>::destroy, &Task::AlignedHeapOps<F>::cancelled };
+
+// 任务队列满了提交失败时，Future::get()抛出的异常
+class TaskRejectedError : public std::runtime_error
+{
+public:
+	TaskRejectedError()
+		: std::runtime_error("task queue is full, submit task fail.")
+	{}
+
+protected:
+	explicit TaskRejectedError(const char* what)
+		: std::runtime_error(what)
+	{}
+};
+
+// 线程池已经关闭、提交失败时，Future::get()抛出的异常；是TaskRejectedError的子类，原来捕获TaskRejectedError的代码不用改
+class PoolShutdownError : public TaskRejectedError
+{
+public:
+	PoolShutdownError()
+		: TaskRejectedError("thread pool has been shut down, submit task fail.")
+	{}
+};
+
+// BasicThreadPool的编译期配置，每个策略把setXxx设置的运行时值换成实际生效的值
+// Dynamic开头的策略保持运行时可配置；其它策略是编译期常量，线程循环里对应的判断整个编译掉
+
+// 任务队列策略：有锁队列还是无锁队列
+struct DynamicQueuePolicy
+{
+	static TaskQueMode mode(TaskQueMode configured) { return configured; } // setTaskQueMode决定
+};
+
+struct LockedQueuePolicy
+{
+	static constexpr TaskQueMode mode(TaskQueMode) { return TaskQueMode::MODE_LOCKED; }
+};
+
+struct LockFreeQueuePolicy
+{
+	static constexpr TaskQueMode mode(TaskQueMode) { return TaskQueMode::MODE_LOCK_FREE; }
+};
+
+// 等待策略：空闲线程挂起之前自旋多久，单位：微秒
+struct DynamicWaitPolicy
+{
+	static int spinTime(int configured) { return configured; } // setIdleSpinTime决定，没有设置时单核机器上不自旋
+};
+
+struct ParkWaitPolicy
+{
+	static constexpr int spinTime(int) { return 0; } // 没有任务马上挂起
+};
+
+// 统计策略：是否记录每个线程的计数、延迟直方图和跟踪事件
+struct FullStatsPolicy
+{
+	static constexpr bool enabled() { return true; }
+};
+
+struct NoStatsPolicy
+{
+	static constexpr bool enabled() { return false; } // snapshotStats里每个线程的计数都是0，startTrace不记录事件
+};
+
+// 增长策略：线程池的工作模式
+struct DynamicGrowthPolicy
+{
+	static PoolMode mode(PoolMode configured) { return configured; } // setMode决定
+};
+
+struct FixedGrowthPolicy
+{
+	static constexpr PoolMode mode(PoolMode) { return PoolMode::MODE_FIXED; }
+};
+
+struct CachedGrowthPolicy
+{
+	static constexpr PoolMode mode(PoolMode) { return PoolMode::MODE_CACHED; }
+};
+
+template<typename QueuePolicy, typename WaitPolicy, typename StatsPolicy, typename GrowthPolicy>
+class BasicThreadPool;
+
+// 默认的线程池，全部运行时可配置；Future的后续任务、Strand、执行器组、阻塞区域、Reactor、TaskGraph都基于它
+using ThreadPool = BasicThreadPool<DynamicQueuePolicy, DynamicWaitPolicy, FullStatsPolicy, DynamicGrowthPolicy>;
+
+// 固定线程数、有锁队列、不统计的线程池，线程循环里没有模式判断
+using FixedThreadPool = BasicThreadPool<LockedQueuePolicy, DynamicWaitPolicy, NoStatsPolicy, FixedGrowthPolicy>;
+
+// 任务在执行之前被取消，Future::get()抛出的异常
+class TaskCancelledError : public std::runtime_error
+{
+public:
+	TaskCancelledError()
+		: std::runtime_error("task was cancelled.")
+	{}
+};
+
+// 取消令牌，由CancellationSource发出，可以拷贝，和同一个source的所有令牌共享取消状态
+// 默认构造的令牌永远不会被取消
+class CancellationToken
+{
+public:
+	CancellationToken() = default;
+
+	bool isCancelled() const
+	{
+		return state_ != nullptr && state_->load(std::memory_order_acquire);
+	}
+
+	// 是否关联了CancellationSource
+	bool canBeCancelled() const
+	{
+		return state_ != nullptr;
+	}
+
+private:
+	friend class CancellationSource;
+
+	explicit CancellationToken(std::shared_ptr<std::atomic_bool> state)
+		: state_(std::move(state))
+	{}
+
+	std::shared_ptr<std::atomic_bool> state_;
+};
+
+// 发出取消令牌，cancel()之后所有令牌都变成已取消，只能取消一次
+// CancellationSource source;
+// pool.submitTask(source.token(), handler, request);
+// source.cancel(); // 还在排队的任务不再执行，Future得到TaskCancelledError
+class CancellationSource
+{
+public:
+	CancellationSource()
+		: state_(std::make_shared<std::atomic_bool>(false))
+	{}
+
+	CancellationToken token() const
+	{
+		return CancellationToken(state_);
+	}
+
+	void cancel()
+	{
+		if (!state_->exchange(true, std::memory_order_acq_rel))
+			epoch().fetch_add(1, std::memory_order_release);
+	}
+
+	bool isCancelled() const
+	{
+		return state_->load(std::memory_order_acquire);
+	}
+
+	// 每次有source被取消加一，线程池据此判断任务队列里可能有已经取消的任务，需要清理
+	static std::atomic<uint64_t>& epoch()
+	{
+		static std::atomic<uint64_t> value(0);
+		return value;
+	}
+
+private:
+	std::shared_ptr<std::atomic_bool> state_;
+};
+
+// Future和Promise共享的结果状态，侵入式引用计数，代替std::shared_ptr和std::packaged_task
+// 完成时只有一次原子交换，只有在有线程等待结果或者挂了后续任务时才需要加锁
+class FutureStateBase
+{
+public:
+	FutureStateBase()
+		: refCount_(2)	// 一个Promise，一个Future
+		, status_(STATUS_PENDING)
+		, continuationPool_(nullptr)
+	{}
+
+	// 等待结果就绪
+	void wait()
+	{
+		if (status_.load(std::memory_order_acquire) == STATUS_READY)
+			return;
+		std::unique_lock<std::mutex> lock(mtx_);
+		int expected = STATUS_PENDING;
+		status_.compare_exchange_strong(expected, STATUS_WAITING);
+		cond_.wait(lock, [&]()->bool { return status_.load(std::memory_order_acquire) == STATUS_READY; });
+	}
+
+	// 最多等待timeout，返回结果是否就绪
+	template<typename Rep, typename Period>
+	std::future_status waitFor(const std::chrono::duration<Rep, Period>& timeout)
+	{
+		if (status_.load(std::memory_order_acquire) == STATUS_READY)
+			return std::future_status::ready;
+		std::unique_lock<std::mutex> lock(mtx_);
+		int expected = STATUS_PENDING;
+		status_.compare_exchange_strong(expected, STATUS_WAITING);
+		bool ready = cond_.wait_for(lock, timeout,
+			[&]()->bool { return status_.load(std::memory_order_acquire) == STATUS_READY; });
+		return ready ? std::future_status::ready : std::future_status::timeout;
+	}
+
+	bool isReady() const
+	{
+		return status_.load(std::memory_order_acquire) == STATUS_READY;
+	}
+
+	// 结果状态每个任务一个，从SlabAllocator分配
+	static void* operator new(size_t size)
+	{
+		return SlabAllocator::allocate(size);
+	}
+	static void operator delete(void* ptr)
+	{
+		SlabAllocator::deallocate(ptr);
+	}
+
+	void setException(std::exception_ptr exception)
+	{
+		exception_ = exception;
+		markReady();
+	}
+
+	// 结果就绪之后执行task，pool为nullptr时在完成任务的线程上直接执行，否则交给pool调度
+	// 已经就绪的话马上执行；可以挂多个，按挂上的顺序执行
+	void setContinuation(Task&& task, ThreadPool* pool)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			// 先把状态改成WAITING，markReady看到之后一定会加锁来取后续任务
+			int expected = STATUS_PENDING;
+			if (status_.compare_exchange_strong(expected, STATUS_WAITING) || expected == STATUS_WAITING)
+			{
+				if (continuation_)
+				{
+					Task first(std::move(continuation_));
+					ThreadPool* firstPool = continuationPool_;
+					continuation_ = Task([first = std::move(first), firstPool, task = std::move(task), pool]() mutable {
+						runContinuation(first, firstPool);
+						runContinuation(task, pool);
+					});
+					continuationPool_ = nullptr;
+				}
+				else
+				{
+					continuation_ = std::move(task);
+					continuationPool_ = pool;
+				}
+				return;
+			}
+		}
+		runContinuation(task, pool);
+	}
+
+protected:
+	~FutureStateBase() = default;
+
+	// 值已经写好，标记就绪，有线程在等待或者挂了后续任务时才加锁
+	void markReady()
+	{
+		if (status_.exchange(STATUS_READY, std::memory_order_acq_rel) == STATUS_WAITING)
+		{
+			Task task;
+			ThreadPool* pool;
+			{
+				std::lock_guard<std::mutex> lock(mtx_);
+				cond_.notify_all();
+				task = std::move(continuation_);
+				pool = continuationPool_;
+			}
+			if (task)
+				runContinuation(task, pool);
+		}
+	}
+
+	// 定义在ThreadPool后面
+	static void runContinuation(Task& task, ThreadPool* pool);
+
+	// 取结果之前调用，任务抛出了异常的话在这里重新抛出
+	void rethrowIfFailed()
+	{
+		if (exception_)
+			std::rethrow_exception(exception_);
+	}
+
+	enum
+	{
+		STATUS_PENDING,	// 任务还没有执行完
+		STATUS_WAITING,	// 任务还没有执行完，并且有线程在等待
+		STATUS_READY,	// 结果已经就绪
+	};
+
+	std::atomic_int refCount_;
+	std::atomic_int status_;
+	std::exception_ptr exception_;
+	std::mutex mtx_;
+	std::condition_variable cond_;
+	Task continuation_;	// 结果就绪之后要执行的任务
+	ThreadPool* continuationPool_;
+};
+
+template<typename T>
+class FutureState : public FutureStateBase
+{
+public:
+	FutureState()
+		: hasValue_(false)
+	{}
+
+	void release()
+	{
+		if (refCount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	// 执行任务，保存返回值或者异常
+	template<typename Func>
+	void run(Func& func)
+	{
+		try
+		{
+			new (&value_) T(func());
+			hasValue_ = true;
+		}
+		catch (...)
+		{
+			setException(std::current_exception());
+			return;
+		}
+		// markReady会执行后续任务，它抛出的异常不能再当作任务的异常写进已经就绪的状态
+		markReady();
+	}
+
+	// 取出结果，只能调用一次
+	T takeValue()
+	{
+		wait();
+		rethrowIfFailed();
+		return std::move(*reinterpret_cast<T*>(&value_));
+	}
+
+private:
+	~FutureState()
+	{
+		if (hasValue_)
+			reinterpret_cast<T*>(&value_)->~T();
+	}
+
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type value_;
+	bool hasValue_;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase
+{
+public:
+	void release()
+	{
+		if (refCount_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	template<typename Func>
+	void run(Func& func)
+	{
+		try
+		{
+			func();
+		}
+		catch (...)
+		{
+			setException(std::current_exception());
+			return;
+		}
+		markReady();
+	}
+
+	void takeValue()
+	{
+		wait();
+		rethrowIfFailed();
+	}
+
+private:
+	~FutureState() = default;
+};
+
+template<typename T, typename Func>
+struct ContinuationResult
+{
+	using type = decltype(std::declval<Func&>()(std::declval<T>()));
+};
+
+template<typename Func>
+struct ContinuationResult<void, Func>
+{
+	using type = decltype(std::declval<Func&>()());
+};
+
+// submitTask的返回值，用法和std::future一样：get() wait() wait_for() valid()
+// 另外可以用then()挂后续任务，后续任务调度到提交任务的线程池上
+template<typename T>
+class Future
+{
+public:
+	Future() noexcept
+		: state_(nullptr)
+		, pool_(nullptr)
+	{}
+	explicit Future(FutureState<T>* state, ThreadPool* pool = nullptr) noexcept
+		: state_(state)
+		, pool_(pool)
+	{}
+	~Future()
+	{
+		if (state_ != nullptr)
+			state_->release();
+	}
+	Future(Future&& other) noexcept
+		: state_(other.state_)
+		, pool_(other.pool_)
+	{
+		other.state_ = nullptr;
+	}
+	Future& operator=(Future&& other) noexcept
+	{
+		std::swap(state_, other.state_);
+		std::swap(pool_, other.pool_);
+		return *this;
+	}
+	Future(const Future&) = delete;
+	Future& operator=(const Future&) = delete;
+
+	// 获取任务的返回值，任务还没执行完会阻塞，之后Future不再有效
+	// 线程池自己的线程等待子任务时用pool.helpWhileWaiting(future)，等待期间执行其它任务
+	// 无效的Future（默认构造、get过、trySubmit提交失败）调用get/wait/wait_for/is_ready/then抛出future_error(no_state)
+	T get()
+	{
+		checkState();
+		Future self(std::move(*this)); // 离开作用域时释放状态
+		return self.state_->takeValue();
+	}
+
+	void wait() const
+	{
+		checkState();
+		state_->wait();
+	}
+
+	template<typename Rep, typename Period>
+	std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+	{
+		checkState();
+		return state_->waitFor(timeout);
+	}
+
+	bool valid() const noexcept
+	{
+		return state_ != nullptr;
+	}
+
+	bool is_ready() const
+	{
+		checkState();
+		return state_->isReady();
+	}
+
+	// 结果就绪之后用结果调用func（T是void时不带参数），返回func结果的Future，之后这个Future不再有效
+	// 任务抛出异常时不调用func，异常传给返回的Future
+	// 在线程池的线程上完成时直接在这个线程上执行func，否则放进线程池的任务队列
+	template<typename Func>
+	Future<typename ContinuationResult<T, Func>::type> then(Func&& func);
+
+#ifdef THREADPOOL_HAS_COROUTINE
+	// 协程里co_await std::move(future)：不阻塞线程，结果就绪之后协程在线程池的线程上继续执行
+	class Awaiter
+	{
+	public:
+		explicit Awaiter(Future&& future) noexcept
+			: future_(std::move(future))
+		{}
+		bool await_ready() const
+		{
+			return future_.is_ready();
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			// 挂上之后协程可能马上在别的线程上恢复，之后不能再访问this
+			future_.state_->setContinuation(Task([handle]() { handle.resume(); }), future_.pool_);
+		}
+		T await_resume()
+		{
+			return future_.get();
+		}
+
+	private:
+		Future future_;
+	};
+
+	Awaiter operator co_await() &&
+	{
+		return Awaiter(std::move(*this));
+	}
+#endif
+
+private:
+	template<typename, typename, typename, typename> friend class BasicThreadPool;
+
+	// 和std::future一样，没有共享状态时抛出异常
+	void checkState() const
+	{
+		if (state_ == nullptr)
+			throw std::future_error(std::future_errc::no_state);
+	}
+
+	FutureState<T>* state_;
+	ThreadPool* pool_;	// 后续任务调度到这个线程池，nullptr表示在完成任务的线程上直接执行
+};
+
+// 任务一端持有的结果状态，任务执行完写入结果；没执行就被销毁时，Future得到broken_promise异常
+template<typename T>
+class Promise
+{
+public:
+	explicit Promise(FutureState<T>* state) noexcept
+		: state_(state)
+	{}
+	~Promise()
+	{
+		if (state_ != nullptr)
+		{
+			if (!state_->isReady())
+				state_->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+			state_->release();
+		}
+	}
+	Promise(Promise&& other) noexcept
+		: state_(other.state_)
+	{
+		other.state_ = nullptr;
+	}
+	Promise& operator=(Promise&&) = delete;
+	Promise(const Promise&) = delete;
+	Promise& operator=(const Promise&) = delete;
+
+	template<typename Func>
+	void run(Func& func)
+	{
+		state_->run(func);
+	}
+
+	void setException(std::exception_ptr exception)
+	{
+		state_->setException(exception);
+	}
+
+private:
+	FutureState<T>* state_;
+};
+
+// 用前一个任务的结果调用后续任务
+template<typename Func, typename T>
+auto callContinuation(Func& func, Future<T>& prev) -> decltype(func(prev.get()))
+{
+	return func(prev.get());
+}
+
+template<typename Func>
+auto callContinuation(Func& func, Future<void>& prev) -> decltype(func())
+{
+	prev.get();
+	return func();
+}
+
+template<typename T>
+template<typename Func>
+Future<typename ContinuationResult<T, Func>::type> Future<T>::then(Func&& func)
+{
+	using RType = typename ContinuationResult<T, Func>::type;
+	checkState();
+	auto state = new FutureState<RType>();
+	Future<RType> result(state, pool_);
+
+	FutureState<T>* prevState = state_;
+	ThreadPool* pool = pool_;
+	// 后续任务持有前一个Future，执行时取出结果，没执行就被销毁时返回的Future得到broken_promise
+	Task task([prev = std::move(*this), promise = Promise<RType>(state), func = std::forward<Func>(func)]() mutable {
+		auto call = [&]()->RType { return callContinuation(func, prev); };
+		promise.run(call);
+	});
+	prevState->setContinuation(std::move(task), pool);
+	return result;
+}
+
+// when_all的结果：每个任务的返回值，void任务没有返回值
+template<typename T>
+struct WhenAllResult
+{
+	using type = std::vector<T>;
+};
+
+template<>
+struct WhenAllResult<void>
+{
+	using type = void;
+};
+
+// when_any的结果：最先完成的任务的下标，和传进去的全部Future
+template<typename T>
+struct WhenAnyResult
+{
+	size_t index;
+	std::vector<Future<T>> futures;
+};
+
+#ifdef THREADPOOL_HAS_COROUTINE
+template<typename T = void>
+class CoroTask;
+
+// CoroTask的promise_type公共部分：记下等待它的协程，结束时对称转移回去，不占用线程栈
+class CoroTaskPromiseBase
+{
+public:
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().continuation_;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	// 协程帧从SlabAllocator分配
+	static void* operator new(size_t size)
+	{
+		return SlabAllocator::allocate(size);
+	}
+	static void operator delete(void* ptr)
+	{
+		SlabAllocator::deallocate(ptr);
+	}
+
+	// 创建时不执行，被co_await的时候才开始
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	FinalAwaiter final_suspend() const noexcept { return {}; }
+	void unhandled_exception() noexcept
+	{
+		exception_ = std::current_exception();
+	}
+	void setContinuation(std::coroutine_handle<> continuation) noexcept
+	{
+		continuation_ = continuation;
+	}
+
+protected:
+	void rethrowIfFailed()
+	{
+		if (exception_)
+			std::rethrow_exception(exception_);
+	}
+
+	std::coroutine_handle<> continuation_; // 等待这个协程结束的协程
+	std::exception_ptr exception_;
+};
+
+template<typename T>
+class CoroTaskPromise : public CoroTaskPromiseBase
+{
+public:
+	CoroTask<T> get_return_object() noexcept;
+
+	template<typename U>
+	void return_value(U&& value)
+	{
+		value_.emplace(std::forward<U>(value));
+	}
+
+	T takeValue()
+	{
+		rethrowIfFailed();
+		return std::move(*value_);
+	}
+
+private:
+	std::optional<T> value_;
+};
+
+template<>
+class CoroTaskPromise<void> : public CoroTaskPromiseBase
+{
+public:
+	CoroTask<void> get_return_object() noexcept;
+
+	void return_void() noexcept {}
+
+	void takeValue()
+	{
+		rethrowIfFailed();
+	}
+};
+
+// 返回值为T的协程，co_await它时开始执行，结束后直接恢复等待它的协程，不需要阻塞的get()
+// 交给ThreadPool::spawn()可以在线程池上启动，得到一个Future
+// （名字不叫Task，Task已经是线程池内部的任务类型）
+template<typename T>
+class CoroTask
+{
+public:
+	using promise_type = CoroTaskPromise<T>;
+
+	CoroTask() noexcept = default;
+	explicit CoroTask(std::coroutine_handle<promise_type> handle) noexcept
+		: handle_(handle)
+	{}
+	~CoroTask()
+	{
+		if (handle_)
+			handle_.destroy();
+	}
+	CoroTask(CoroTask&& other) noexcept
+		: handle_(std::exchange(other.handle_, nullptr))
+	{}
+	CoroTask& operator=(CoroTask&& other) noexcept
+	{
+		std::swap(handle_, other.handle_);
+		return *this;
+	}
+	CoroTask(const CoroTask&) = delete;
+	CoroTask& operator=(const CoroTask&) = delete;
+
+	bool valid() const noexcept
+	{
+		return (bool)handle_;
+	}
+
+	class Awaiter
+	{
+	public:
+		explicit Awaiter(std::coroutine_handle<promise_type> handle) noexcept
+			: handle_(handle)
+		{}
+		bool await_ready() const noexcept
+		{
+			return handle_.done();
+		}
+		// 对称转移：直接切换到被等待的协程，不经过任务队列
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+		{
+			handle_.promise().setContinuation(continuation);
+			return handle_;
+		}
+		T await_resume()
+		{
+			return handle_.promise().takeValue();
+		}
+
+	private:
+		std::coroutine_handle<promise_type> handle_;
+	};
+
+	Awaiter operator co_await() && noexcept
+	{
+		return Awaiter(handle_);
+	}
+
+private:
+	std::coroutine_handle<promise_type> handle_;
+};
+
+template<typename T>
+CoroTask<T> CoroTaskPromise<T>::get_return_object() noexcept
+{
+	return CoroTask<T>(std::coroutine_handle<CoroTaskPromise<T>>::from_promise(*this));
+}
+
+inline CoroTask<void> CoroTaskPromise<void>::get_return_object() noexcept
+{
+	return CoroTask<void>(std::coroutine_handle<CoroTaskPromise<void>>::from_promise(*this));
+}
+
+// ThreadPool::spawn内部使用的协程，创建后马上执行，结束时自己销毁
+struct DetachedCoroutine
+{
+	struct promise_type
+	{
+		static void* operator new(size_t size) { return SlabAllocator::allocate(size); }
+		static void operator delete(void* ptr) { SlabAllocator::deallocate(ptr); }
+		DetachedCoroutine get_return_object() const noexcept { return {}; }
+		std::suspend_never initial_suspend() const noexcept { return {}; }
+		std::suspend_never final_suspend() const noexcept { return {}; }
+		void return_void() const noexcept {}
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+};
+#endif
+
+// 用保存在tuple里的参数调用函数，和std::bind一样参数以左值传入
+template<typename Func, typename Tuple, size_t... Index>
+auto applyTuple(Func& func, Tuple& args, std::index_sequence<Index...>)
+	-> decltype(func(std::get<Index>(args)...))
+{
+	return func(std::get<Index>(args)...);
+}
+
+// 每个初始线程私有的任务队列，线程内部提交的普通任务放在这里
+// 所属线程在队尾push/pop（后进先出，缓存友好），其它空闲线程从队头窃取（先进先出，偷走最老的任务）
+// 每个队列一把自己的锁，只有窃取时才会和所属线程竞争，不再所有线程抢同一把taskQueMtx_
+template<typename T>
+class WorkStealingQueue
+{
+public:
+	WorkStealingQueue() = default;
+	~WorkStealingQueue() = default;
+	WorkStealingQueue(const WorkStealingQueue&) = delete;
+	WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+	// 所属线程放入任务
+	void push(T&& item)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		que_.push_back(std::move(item));
+	}
+
+	// 所属线程一次放入多个任务，队列里最多limit个，返回放入的个数
+	size_t pushBatch(T* items, size_t count, size_t limit)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		size_t size = que_.size() < limit ? std::min(count, limit - que_.size()) : 0;
+		for (size_t i = 0; i < size; i++)
+		{
+			que_.push_back(std::move(items[i]));
+		}
+		return size;
+	}
+
+	// 所属线程取出最新放入的任务
+	bool tryPop(T& item)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (que_.empty())
+			return false;
+		item = std::move(que_.back());
+		que_.pop_back();
+		return true;
+	}
+
+	// 其它线程窃取最早放入的任务
+	bool trySteal(T& item)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (que_.empty())
+			return false;
+		item = std::move(que_.front());
+		que_.pop_front();
+		return true;
+	}
+private:
+	std::deque<T> que_;
+	std::mutex mtx_;
+};
+
+// 有界的多生产者多消费者无锁环形队列
+// 每个槽位有一个序号seq：seq == pos 表示可以写入，seq == pos + 1 表示可以读取，
+// 生产者/消费者各自用一次CAS抢占位置，不需要锁。槽位按缓存行对齐，相邻槽位的读写不会伪共享
+template<typename T>
+class LockFreeTaskQueue
+{
+public:
+	// 容量向上取整为2的幂，用位与代替取模
+	LockFreeTaskQueue(size_t capacity)
+		: enqueuePos_(0)
+		, dequeuePos_(0)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		// C++14下new Slot[]不保证按缓存行对齐，多申请一个缓存行自己对齐
+		memory_ = ::operator new(size * sizeof(Slot) + CACHE_LINE_SIZE);
+		slots_ = reinterpret_cast<Slot*>(((uintptr_t)memory_ + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+		mask_ = size - 1;
+		for (size_t i = 0; i < size; i++)
+		{
+			new (&slots_[i]) Slot();
+			slots_[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+	~LockFreeTaskQueue()
+	{
+		for (size_t i = 0; i <= mask_; i++)
+		{
+			slots_[i].~Slot();
+		}
+		::operator delete(memory_);
+	}
+	LockFreeTaskQueue(const LockFreeTaskQueue&) = delete;
+	LockFreeTaskQueue& operator=(const LockFreeTaskQueue&) = delete;
+
+	// 放入任务，队列满了返回false，只有成功时才会移走item
+	bool tryPush(T& item)
+	{
+		Slot* slot;
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			slot = &slots_[pos & mask_];
+			size_t seq = slot->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0)
+			{
+				// 槽位空闲，抢占这个位置
+				if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// 槽位上一轮的数据还没被取走，队列满了
+				return false;
+			}
+			else
+			{
+				// 被其它生产者抢先了，重新读取位置
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		slot->data = std::move(item);
+		slot->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 一次CAS占住连续的多个空槽位，返回放入的个数，可能少于count，队列满了返回0
+	size_t tryPushBatch(T* items, size_t count)
+	{
+		size_t size;
+		size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			// 从pos开始数有多少个连续的空槽位
+			size = 0;
+			while (size < count && size <= mask_
+				&& slots_[(pos + size) & mask_].seq.load(std::memory_order_acquire) == pos + size)
+			{
+				size++;
+			}
+
+			if (size == 0)
+			{
+				intptr_t diff = (intptr_t)slots_[pos & mask_].seq.load(std::memory_order_acquire) - (intptr_t)pos;
+				if (diff < 0)
+					return 0;
+				pos = enqueuePos_.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			// 位置没有被其它生产者改过，这段槽位就都是自己的
+			if (enqueuePos_.compare_exchange_weak(pos, pos + size, std::memory_order_relaxed))
+				break;
+		}
+
+		for (size_t i = 0; i < size; i++)
+		{
+			Slot& slot = slots_[(pos + i) & mask_];
+			slot.data = std::move(items[i]);
+			slot.seq.store(pos + i + 1, std::memory_order_release);
+		}
+		return size;
+	}
+
+	// 取出任务，队列空了返回false
+	bool tryPop(T& item)
+	{
+		Slot* slot;
+		size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+		while (true)
+		{
+			slot = &slots_[pos & mask_];
+			size_t seq = slot->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (diff == 0)
+			{
+				if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0)
+			{
+				// 槽位还没有写入数据，队列空了
+				return false;
+			}
+			else
+			{
+				pos = dequeuePos_.load(std::memory_order_relaxed);
+			}
+		}
+		item = std::move(slot->data);
+		// 序号加上容量，留给下一轮的生产者
+		slot->seq.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 队列的实际容量
+	size_t capacity() const
+	{
+		return mask_ + 1;
+	}
+private:
+	struct alignas(CACHE_LINE_SIZE) Slot
+	{
+		std::atomic<size_t> seq;
+		T data;
+	};
+
+	void* memory_;	// 申请到的内存，slots_是其中按缓存行对齐的起点
+	Slot* slots_;
+	size_t mask_;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueuePos_; // 生产者和消费者的位置放在不同的缓存行
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeuePos_;
+};
+
+// 信号量类，每个线程一个，空闲线程挂起时等在自己的信号量上，提交任务时只唤醒其中一个
+class Semaphore
+{
+public:
+	Semaphore(int limit = 0)
+		: resLimit_(limit)
+	{}
+	~Semaphore() = default;
+
+	// 获取一个信号量资源，没有资源的话阻塞当前线程
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		cond_.wait(lock, [&]()->bool { return resLimit_ > 0; });
+		resLimit_--;
+	}
+
+	// 最多等待timeout，超时没有获取到资源返回false
+	template<typename Rep, typename Period>
+	bool waitFor(const std::chrono::duration<Rep, Period>& timeout)
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		if (!cond_.wait_for(lock, timeout, [&]()->bool { return resLimit_ > 0; }))
+			return false;
+		resLimit_--;
+		return true;
+	}
+
+	// 增加一个信号量资源，唤醒等待的线程
+	void post()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		resLimit_++;
+		cond_.notify_one();
+	}
+private:
+	int resLimit_;
+	std::mutex mtx_;
+	std::condition_variable cond_;
+};
+
+// 自旋等待时告诉CPU当前在忙等，降低功耗，让出流水线给同一个核心上的其它超线程
+inline void cpuRelax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// 带截止时间的任务队列，截止时间最早的先出队（最小堆），每个优先级一个，使用自己的锁
+class DeadlineTaskQueue
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	DeadlineTaskQueue()
+		: seq_(0)
+		, size_(0)
+		, earliest_(0)
+	{}
+	DeadlineTaskQueue(const DeadlineTaskQueue&) = delete;
+	DeadlineTaskQueue& operator=(const DeadlineTaskQueue&) = delete;
+
+	// 队列里已经有limit个任务时放不进去，task不动
+	bool tryPush(Clock::time_point deadline, Task& task, size_t limit)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (heap_.size() >= limit)
+			return false;
+		heap_.push_back(Item{ deadline, seq_++, std::move(task) });
+		std::push_heap(heap_.begin(), heap_.end(), Later());
+		earliest_ = heap_.front().deadline.time_since_epoch().count();
+		size_++;
+		return true;
+	}
+
+	// 取出最早提交的任务，用于POLICY_DROP_OLDEST，只在队列满了时调用，遍历一遍没关系
+	bool tryPopOldest(Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (heap_.empty())
+			return false;
+		auto oldest = std::min_element(heap_.begin(), heap_.end(),
+			[](const Item& a, const Item& b) { return a.seq < b.seq; });
+		task = std::move(oldest->task);
+		*oldest = std::move(heap_.back());
+		heap_.pop_back();
+		std::make_heap(heap_.begin(), heap_.end(), Later());
+		if (!heap_.empty())
+			earliest_ = heap_.front().deadline.time_since_epoch().count();
+		size_--;
+		return true;
+	}
+
+	// 取出截止时间最早的任务
+	bool tryPop(Task& task)
+	{
+		if (size_ == 0)
+			return false;
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (heap_.empty())
+			return false;
+		std::pop_heap(heap_.begin(), heap_.end(), Later());
+		task = std::move(heap_.back().task);
+		heap_.pop_back();
+		if (!heap_.empty())
+			earliest_ = heap_.front().deadline.time_since_epoch().count();
+		size_--;
+		return true;
+	}
+
+	// 最早的截止时间是否已经到了，不加锁，只用来判断要不要先取这个队列
+	bool isDue(Clock::time_point now) const
+	{
+		return size_ > 0 && earliest_ <= now.time_since_epoch().count();
+	}
+
+private:
+	struct Item
+	{
+		Clock::time_point deadline;
+		uint64_t seq;	// 截止时间相同的按提交顺序
+		Task task;
+	};
+
+	// 堆顶是截止时间最早的
+	struct Later
+	{
+		bool operator()(const Item& a, const Item& b) const
+		{
+			return a.deadline > b.deadline || (a.deadline == b.deadline && a.seq > b.seq);
+		}
+	};
+
+	std::vector<Item> heap_;
+	uint64_t seq_;
+	std::atomic_int size_;
+	std::atomic<Clock::rep> earliest_;
+	std::mutex mtx_;
+};
+
+// 分层时间轮：submitAfter/submitEvery的定时器由一个定时线程管理，到时间之后才放进线程池的任务队列，等待期间不占用线程池的线程
+// 共TIMER_WHEEL_LEVEL_SIZE层，每层TIMER_WHEEL_SLOT_SIZE个槽，第0层每槽1ms，上一层每槽是下一层转一圈的时间，更远的定时器先放在最高层
+// 每个槽是侵入式双向链表，插入和取消都是O(1)；槽从空变成不空时按到期时间放进一个小根堆，堆里只有槽，没有定时器
+// 定时线程只在最早的槽到期时醒来，把槽里的定时器按剩余时间放到下层的槽，已经到期的交给线程池（和Kafka的分层时间轮一样）
+// 定时器节点成块申请、用完放回空闲链表；节点带代数，重用时加一，句柄按代数判断定时器是不是已经不在了
+class TimerHandle;
+
+class TimerWheel
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using Dispatcher = std::function<void(Task&)>;
+
+	static const uint64_t NO_EXPIRATION = UINT64_MAX; // 空槽的到期时间
+
+	struct Bucket;
+
+	// 一个定时器
+	struct Node
+	{
+		Node* prev = nullptr;
+		Node* next = nullptr; // 在槽里时是槽的链表，空闲时是空闲链表
+		Bucket* bucket = nullptr; // 所在的槽，不在任何槽里时为nullptr
+		uint64_t expiration = 0; // 到期时间，单位：ms，从时间轮创建开始算
+		uint64_t period = 0; // 周期，单位：ms，0表示一次性的定时器
+		uint64_t generation = 0; // 节点每重用一次加一
+		bool running = false; // 周期任务正在线程池里执行，不在任何槽里
+		bool cancelled = false; // 周期任务执行期间被取消了，执行完不再放回时间轮
+		Task task; // 一次性任务到期时整个交给线程池，周期任务每次到期执行一遍
+	};
+
+	struct Bucket
+	{
+		Node* head = nullptr;
+		uint64_t expiration = NO_EXPIRATION; // 槽的到期时间，空槽为NO_EXPIRATION
+	};
+
+	explicit TimerWheel(Dispatcher dispatch)
+		: dispatch_(std::move(dispatch))
+		, startTime_(Clock::now())
+		, stopped_(false)
+		, size_(0)
+		, freeList_(nullptr)
+	{
+		for (uint64_t& time : currentTime_)
+		{
+			time = 0;
+		}
+	}
+
+	~TimerWheel()
+	{
+		stop();
+	}
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	// 添加一个定时器，delay之后执行task，period不为0时之后每隔period执行一次
+	// 已经到期的直接在当前线程交给线程池；时间轮已经停止时task被丢弃，返回无效的句柄
+	// 第一次添加定时器时才创建定时线程
+	TimerHandle add(Task&& task, std::chrono::nanoseconds delay, std::chrono::nanoseconds period);
+
+	// 取消定时器，成功返回true；一次性的定时器已经到期交给线程池、或者已经取消过返回false
+	bool cancel(Node* node, uint64_t generation)
+	{
+		Task dead; // 任务的析构可能执行用户代码（比如Future的后续任务），放到锁外面
+		std::unique_lock<std::mutex> lock(mtx_);
+		if (node->generation != generation || node->cancelled)
+			return false;
+		if (node->running)
+		{
+			// 周期任务正在执行，执行完不再放回时间轮
+			node->cancelled = true;
+			return true;
+		}
+		unlink(node);
+		dead = std::move(node->task);
+		freeNode(node);
+		return true;
+	}
+
+	// 停掉定时线程，还没到期的定时器全部丢弃，一次性任务的Future抛出std::future_error(broken_promise)
+	// 正在线程池里执行的周期任务执行完之后不再放回时间轮
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			if (stopped_)
+				return;
+			stopped_ = true;
+		}
+		cond_.notify_all();
+		if (thread_.joinable())
+			thread_.join();
+
+		std::vector<Task> dead;
+		std::unique_lock<std::mutex> lock(mtx_);
+		for (auto& level : buckets_)
+		{
+			for (Bucket& bucket : level)
+			{
+				while (bucket.head != nullptr)
+				{
+					Node* node = bucket.head;
+					unlink(node);
+					dead.emplace_back(std::move(node->task));
+					freeNode(node);
+				}
+			}
+		}
+		queue_ = decltype(queue_)();
+		lock.unlock();
+	}
+
+	// 还没到期的定时器数量，正在执行的周期任务不算
+	int size()
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		return (int)size_;
+	}
+
+private:
+	// 周期任务每次到期交给线程池的任务：执行一遍节点里的任务，再放回时间轮
+	// 被背压策略丢弃、或者关闭时没有执行，也要放回时间轮，周期任务不会因为一次没执行就停了
+	class PeriodicRun
+	{
+	public:
+		PeriodicRun(TimerWheel* wheel, Node* node) noexcept
+			: wheel_(wheel)
+			, node_(node)
+		{}
+		PeriodicRun(PeriodicRun&& other) noexcept
+			: wheel_(other.wheel_)
+			, node_(other.node_)
+		{
+			other.wheel_ = nullptr;
+		}
+		PeriodicRun(const PeriodicRun&) = delete;
+		PeriodicRun& operator=(const PeriodicRun&) = delete;
+		PeriodicRun& operator=(PeriodicRun&&) = delete;
+
+		~PeriodicRun()
+		{
+			if (wheel_ != nullptr)
+				wheel_->rearm(node_);
+		}
+
+		void operator()()
+		{
+			try
+			{
+				node_->task();
+			}
+			catch (...)
+			{
+				// 周期任务没有Future可以传递异常，记一条日志，下个周期照常执行
+				THREADPOOL_LOG_WARN("periodic task threw an exception.");
+			}
+			TimerWheel* wheel = wheel_;
+			wheel_ = nullptr;
+			wheel->rearm(node_);
+		}
+
+	private:
+		TimerWheel* wheel_;
+		Node* node_;
+	};
+
+	// 每层一个槽的时间跨度，单位：ms
+	static uint64_t tickOf(int level)
+	{
+		return (uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * level);
+	}
+
+	// 从时间轮创建开始过了delay之后的时间，向上取整到ms，用作到期时间，定时器不会比要求的时间早执行
+	uint64_t nowTick(std::chrono::nanoseconds delay) const
+	{
+		auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - startTime_) + delay;
+		return (uint64_t)((elapsed.count() + 999999) / 1000000);
+	}
+
+	// 从时间轮创建开始经过的时间，向下取整到ms，判断是否到期用这个，到期时间之前不会被当作已经到期
+	uint64_t elapsedTick() const
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - startTime_).count();
+	}
+
+	// 把节点放到对应的槽里，已经到期的返回false；槽从空变成最早到期时需要唤醒定时线程，wakeup置为true
+	bool insert(Node* node, bool& wakeup)
+	{
+		uint64_t expiration = node->expiration;
+		if (expiration <= currentTime_[0])
+			return false;
+		for (int level = 0; level < TIMER_WHEEL_LEVEL_SIZE; level++)
+		{
+			uint64_t tick = tickOf(level);
+			uint64_t interval = tick << TIMER_WHEEL_SLOT_BITS;
+			if (expiration >= currentTime_[level] + interval)
+			{
+				if (level + 1 < TIMER_WHEEL_LEVEL_SIZE)
+					continue;
+				// 超过了最高层一圈的时间，先放在最高层最晚的槽里，到时再重新放
+				expiration = currentTime_[level] + interval - tick;
+			}
+
+			uint64_t virtualId = expiration / tick;
+			Bucket& bucket = buckets_[level][virtualId & (TIMER_WHEEL_SLOT_SIZE - 1)];
+			node->prev = nullptr;
+			node->next = bucket.head;
+			if (bucket.head != nullptr)
+				bucket.head->prev = node;
+			bucket.head = node;
+			node->bucket = &bucket;
+			size_++;
+
+			uint64_t bucketExpiration = virtualId * tick;
+			if (bucket.expiration != bucketExpiration)
+			{
+				bucket.expiration = bucketExpiration;
+				queue_.emplace(bucketExpiration, &bucket);
+				if (queue_.top().second == &bucket)
+					wakeup = true;
+			}
+			return true;
+		}
+		return false;
+	}
+
+	// 把节点从槽里摘下来，槽留在堆里，到期时是空的就什么也不做
+	void unlink(Node* node)
+	{
+		if (node->prev != nullptr)
+			node->prev->next = node->next;
+		else
+			node->bucket->head = node->next;
+		if (node->next != nullptr)
+			node->next->prev = node->prev;
+		node->prev = nullptr;
+		node->next = nullptr;
+		node->bucket = nullptr;
+		size_--;
+	}
+
+	// 时间轮的时间走到time，每层的时间按本层的槽跨度对齐
+	void advanceClock(uint64_t time)
+	{
+		for (int level = 0; level < TIMER_WHEEL_LEVEL_SIZE; level++)
+		{
+			uint64_t tick = tickOf(level);
+			if (time >= currentTime_[level] + tick)
+				currentTime_[level] = time - time % tick;
+		}
+	}
+
+	// 到期的定时器变成交给线程池的任务：一次性的取出任务、释放节点；周期的标记为正在执行
+	Task takeDue(Node* node)
+	{
+		if (node->period == 0)
+		{
+			Task task = std::move(node->task);
+			freeNode(node);
+			return task;
+		}
+		node->running = true;
+		return Task(PeriodicRun(this, node));
+	}
+
+	// 周期任务执行完（或者没有执行就被丢弃），按原来的节奏放回时间轮，错过的周期直接跳过，同一个任务不会同时执行两次
+	void rearm(Node* node)
+	{
+		Task dead;
+		Task due;
+		std::unique_lock<std::mutex> lock(mtx_);
+		node->running = false;
+		if (node->cancelled || stopped_)
+		{
+			dead = std::move(node->task);
+			freeNode(node);
+			return;
+		}
+		uint64_t now = elapsedTick();
+		uint64_t missed = now >= node->expiration ? (now - node->expiration) / node->period + 1 : 1;
+		node->expiration += missed * node->period;
+		bool wakeup = false;
+		if (insert(node, wakeup))
+		{
+			lock.unlock();
+			if (wakeup)
+				cond_.notify_one();
+			return;
+		}
+		due = takeDue(node);
+		lock.unlock();
+		dispatch_(due);
+	}
+
+	Node* allocNode()
+	{
+		if (freeList_ == nullptr)
+		{
+			std::unique_ptr<Node[]> block(new Node[TIMER_NODE_BLOCK_SIZE]);
+			for (int i = TIMER_NODE_BLOCK_SIZE - 1; i >= 0; i--)
+			{
+				block[i].next = freeList_;
+				freeList_ = &block[i];
+			}
+			blocks_.push_back(std::move(block));
+		}
+		Node* node = freeList_;
+		freeList_ = node->next;
+		node->next = nullptr;
+		return node;
+	}
+
+	// 任务要先移走，节点里只剩空任务
+	void freeNode(Node* node)
+	{
+		node->generation++;
+		node->period = 0;
+		node->running = false;
+		node->cancelled = false;
+		node->next = freeList_;
+		freeList_ = node;
+	}
+
+	// 定时线程：等最早的槽到期，把槽里的定时器重新放，到期的在锁外面交给线程池
+	void threadFunc()
+	{
+		std::vector<Task> due;
+		std::unique_lock<std::mutex> lock(mtx_);
+		while (!stopped_)
+		{
+			if (queue_.empty())
+			{
+				cond_.wait(lock);
+				continue;
+			}
+			std::pair<uint64_t, Bucket*> top = queue_.top();
+			if (top.second->expiration != top.first)
+			{
+				// 槽到期过又重新用了，这是旧的堆元素
+				queue_.pop();
+				continue;
+			}
+			if (top.first > elapsedTick())
+			{
+				cond_.wait_until(lock, startTime_ + std::chrono::milliseconds(top.first));
+				continue;
+			}
+
+			queue_.pop();
+			advanceClock(top.first);
+			Node* node = top.second->head;
+			top.second->head = nullptr;
+			top.second->expiration = NO_EXPIRATION;
+			while (node != nullptr)
+			{
+				Node* next = node->next;
+				node->prev = nullptr;
+				node->next = nullptr;
+				node->bucket = nullptr;
+				size_--;
+				bool wakeup = false;
+				if (!insert(node, wakeup))
+					due.emplace_back(takeDue(node));
+				node = next;
+			}
+
+			if (!due.empty())
+			{
+				lock.unlock();
+				for (Task& task : due)
+				{
+					dispatch_(task);
+				}
+				due.clear();
+				lock.lock();
+			}
+		}
+	}
+
+	Dispatcher dispatch_; // 把到期的任务交给线程池
+	Clock::time_point startTime_; // 时间轮的时间从这里开始算
+	std::mutex mtx_; // 保护下面所有的成员
+	std::condition_variable cond_; // 定时线程等最早的槽到期，或者有更早的槽
+	std::thread thread_; // 定时线程
+	bool stopped_; // 已经停止，不再接受定时器
+	size_t size_; // 在槽里的定时器数量
+	uint64_t currentTime_[TIMER_WHEEL_LEVEL_SIZE]; // 每层当前的时间，按本层的槽跨度对齐
+	Bucket buckets_[TIMER_WHEEL_LEVEL_SIZE][TIMER_WHEEL_SLOT_SIZE]; // 每层的槽
+	std::priority_queue<std::pair<uint64_t, Bucket*>, std::vector<std::pair<uint64_t, Bucket*>>,
+		std::greater<std::pair<uint64_t, Bucket*>>> queue_; // 不空的槽按到期时间排序，槽的到期时间变了旧元素留在堆里，取出时跳过
+	std::vector<std::unique_ptr<Node[]>> blocks_; // 定时器节点，成块申请，时间轮析构时释放
+	Node* freeList_; // 空闲的节点
+
+	friend class TimerHandle;
+};
+
+// 定时器句柄，submitAfter/submitEvery返回，可以拷贝；默认构造的句柄不对应任何定时器
+// 线程池析构之后不能再使用
+// auto heartbeat = pool.submitEvery(std::chrono::seconds(1), sendHeartbeat);
+// heartbeat.cancel();
+class TimerHandle
+{
+public:
+	TimerHandle() noexcept
+		: wheel_(nullptr)
+		, node_(nullptr)
+		, generation_(0)
+	{}
+
+	// 取消定时器：还没到期的一次性任务不再执行，Future抛出std::future_error(broken_promise)；
+	// 周期任务之后不再执行，正在执行的这一次会执行完。已经到期交给线程池、或者已经取消过返回false
+	bool cancel()
+	{
+		return wheel_ != nullptr && wheel_->cancel(node_, generation_);
+	}
+
+	// 是否对应一个定时器（定时器可能已经到期或者取消了）
+	bool valid() const noexcept
+	{
+		return wheel_ != nullptr;
+	}
+
+private:
+	friend class TimerWheel;
+
+	TimerHandle(TimerWheel* wheel, TimerWheel::Node* node, uint64_t generation) noexcept
+		: wheel_(wheel)
+		, node_(node)
+		, generation_(generation)
+	{}
+
+	TimerWheel* wheel_;
+	TimerWheel::Node* node_;
+	uint64_t generation_;
+};
+
+inline TimerHandle TimerWheel::add(Task&& task, std::chrono::nanoseconds delay, std::chrono::nanoseconds period)
+{
+	Task dead;
+	std::unique_lock<std::mutex> lock(mtx_);
+	if (stopped_)
+	{
+		dead = std::move(task);
+		return TimerHandle();
+	}
+	if (!thread_.joinable())
+		thread_ = std::thread([this]() { threadFunc(); });
+	// 没有定时器时时间轮的时间可能落后很多，先追上现在的时间，新的定时器直接放到合适的层
+	if (size_ == 0)
+		advanceClock(elapsedTick());
+
+	Node* node = allocNode();
+	node->task = std::move(task);
+	node->expiration = nowTick(delay);
+	node->period = period.count() > 0 ? std::max<uint64_t>((uint64_t)((period.count() + 999999) / 1000000), 1) : 0;
+	TimerHandle handle(this, node, node->generation);
+
+	bool wakeup = false;
+	if (insert(node, wakeup))
+	{
+		lock.unlock();
+		if (wakeup)
+			cond_.notify_one();
+		return handle;
+	}
+
+	// 已经到期，直接交给线程池
+	Task due = takeDue(node);
+	lock.unlock();
+	dispatch_(due);
+	return handle;
+}
+
+// strand的共享状态：任务按提交顺序串在一个侵入式的多生产者单消费者无锁链表上（Vyukov队列），提交只有一次原子交换
+// size_从0变成1的提交者负责把strand作为一个任务放进线程池，执行时连续执行最多STRAND_BATCH_SIZE个任务，
+// 还有剩余就重新排到线程池队列的后面；任何时候最多只有一个线程在执行这个strand的任务，所以不需要锁
+// 由Strand句柄和排在线程池里的激活任务共同持有
+class StrandState : public std::enable_shared_from_this<StrandState>
+{
+public:
+	StrandState(ThreadPool* pool, TaskPriority priority)
+		: pool_(pool)
+		, priority_(priority)
+		, tail_(&stub_)
+		, head_(&stub_)
+		, size_(0)
+		, ticket_(0)
+	{
+		stub_.next.store(nullptr, std::memory_order_relaxed);
+	}
+
+	~StrandState()
+	{
+		// 还有任务的时候一定有激活任务持有这个状态，走到这里链表应该是空的
+		Node* node;
+		while (size_ > 0 && (node = pop()) != nullptr)
+		{
+			destroyNode(node);
+			size_--;
+		}
+	}
+
+	StrandState(const StrandState&) = delete;
+	StrandState& operator=(const StrandState&) = delete;
+
+	// 当前线程正在执行的strand，没有为nullptr
+	static const StrandState*& current()
+	{
+		static thread_local const StrandState* strand = nullptr;
+		return strand;
+	}
+
+	ThreadPool* pool() const
+	{
+		return pool_;
+	}
+
+	// 放入一个任务，链表从空变成不空时把strand放进线程池
+	void push(Task&& task)
+	{
+		link(createNode(std::move(task)));
+		if (size_.fetch_add(1, std::memory_order_acq_rel) == 0)
+			schedule(BackpressurePolicy::POLICY_CALLER_RUNS);
+	}
+
+private:
+	struct Node
+	{
+		std::atomic<Node*> next;
+		Task task;
+	};
+
+	// 一次激活：执行最多一批任务；没有执行就被丢弃时（POLICY_DROP_OLDEST、关闭时丢弃排队的任务）
+	// 丢弃已经排队的任务，它们的Future抛出std::future_error(broken_promise)，之后提交的任务照常执行
+	class Activation
+	{
+	public:
+		Activation(std::shared_ptr<StrandState> state, uint64_t ticket) noexcept
+			: state_(std::move(state))
+			, ticket_(ticket)
+		{}
+		Activation(Activation&& other) noexcept = default;
+		Activation(const Activation&) = delete;
+		Activation& operator=(const Activation&) = delete;
+
+		~Activation()
+		{
+			// 放进线程池失败的激活对应的票号已经作废，不算丢弃
+			if (state_ != nullptr && state_->ticket_.load(std::memory_order_acquire) == ticket_)
+				state_->abandon();
+		}
+
+		void operator()()
+		{
+			std::shared_ptr<StrandState> state = std::move(state_);
+			state->run();
+		}
+
+	private:
+		std::shared_ptr<StrandState> state_;
+		uint64_t ticket_;
+	};
+
+	Node* createNode(Task&& task)
+	{
+		Node* node = static_cast<Node*>(SlabAllocator::allocate(sizeof(Node)));
+		new (&node->next) std::atomic<Node*>(nullptr);
+		new (&node->task) Task(std::move(task));
+		return node;
+	}
+
+	static void destroyNode(Node* node)
+	{
+		node->task.~Task();
+		node->next.~atomic();
+		SlabAllocator::deallocate(node);
+	}
+
+	// 生产者：交换尾指针，再把前一个节点接上，两步之间消费者看到的链表是断开的
+	void link(Node* node)
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+		Node* prev = tail_.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	// 消费者：取出最早的节点，链表为空或者生产者还没接上时返回nullptr
+	Node* pop()
+	{
+		Node* head = head_;
+		Node* next = head->next.load(std::memory_order_acquire);
+		if (head == &stub_)
+		{
+			if (next == nullptr)
+				return nullptr;
+			head_ = next;
+			head = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next != nullptr)
+		{
+			head_ = next;
+			return head;
+		}
+		if (head != tail_.load(std::memory_order_acquire))
+			return nullptr;
+		// 只剩最后一个节点，放回哨兵节点再取，保证链表里总有一个节点
+		link(&stub_);
+		next = head->next.load(std::memory_order_acquire);
+		if (next != nullptr)
+		{
+			head_ = next;
+			return head;
+		}
+		return nullptr;
+	}
+
+	// size_已经计入的任务一定在链表里，只是生产者可能还没接上，等一下就好
+	Node* popWait()
+	{
+		Node* node;
+		while ((node = pop()) == nullptr)
+		{
+			cpuRelax();
+		}
+		return node;
+	}
+
+	// 把strand作为一个任务放进线程池，policy决定队列满了时怎么办
+	inline bool schedule(BackpressurePolicy policy);
+
+	// 激活任务：执行一批，还有剩余就重新排队，队列满了放不进去就在当前线程接着执行
+	void run()
+	{
+		const StrandState*& current = StrandState::current();
+		const StrandState* outer = current;
+		current = this;
+		size_t remaining = size_.load(std::memory_order_acquire);
+		while (remaining > 0)
+		{
+			size_t batch = std::min<size_t>(remaining, STRAND_BATCH_SIZE);
+			for (size_t i = 0; i < batch; i++)
+			{
+				Node* node = popWait();
+				node->task();
+				destroyNode(node);
+			}
+			remaining = size_.fetch_sub(batch, std::memory_order_acq_rel) - batch;
+			if (remaining > 0 && schedule(BackpressurePolicy::POLICY_FAIL_FAST))
+				break;
+		}
+		current = outer;
+	}
+
+	// 激活任务没有执行就被丢弃了：丢掉已经计入的任务，之后还有任务的话重新激活
+	void abandon()
+	{
+		size_t count = size_.load(std::memory_order_acquire);
+		for (size_t i = 0; i < count; i++)
+		{
+			destroyNode(popWait());
+		}
+		if (size_.fetch_sub(count, std::memory_order_acq_rel) > count)
+			schedule(BackpressurePolicy::POLICY_CALLER_RUNS);
+	}
+
+	ThreadPool* pool_; // 任务在这个线程池上执行
+	TaskPriority priority_; // 激活任务的优先级
+	Node stub_; // 哨兵节点，链表里总至少有一个节点
+	std::atomic<Node*> tail_; // 生产者写
+	Node* head_; // 只有持有执行权的线程（正在执行激活任务的线程）访问
+	std::atomic<size_t> size_; // 已经提交还没执行完的任务数
+	std::atomic<uint64_t> ticket_; // 激活任务的票号，放进线程池失败时作废
+};
+
+// 串行执行器，由ThreadPool::makeStrand()创建：同一个strand上提交的任务按提交顺序执行，不会同时执行两个
+// 不同的strand之间、strand和普通任务之间照常并行；可以拷贝，拷贝出来的句柄是同一个strand
+// 用来代替在任务里为每个连接、每个账户加锁，等锁的任务不会占着线程
+// Strand conn = pool.makeStrand();
+// conn.submitTask(onRead, buffer);  // 同一个连接的读写按顺序执行
+// conn.submitTask(onWrite, reply);
+class Strand
+{
+public:
+	// 默认构造的strand不能提交任务
+	Strand() = default;
+
+	// 提交任务，返回值和ThreadPool::submitTask一样；线程池已经关闭时提交失败，get()抛出PoolShutdownError
+	// strand放不进线程池的队列时（队列满了），由提交线程直接执行积压的任务，不会丢掉已经接受的任务
+	template<typename Func, typename... Args>
+	auto submitTask(Func&& func, Args&&... args) -> Future<decltype(func(args...))>;
+
+	bool valid() const
+	{
+		return state_ != nullptr;
+	}
+
+	// 当前线程是否正在执行这个strand的任务
+	bool runningInThisThread() const
+	{
+		return state_ != nullptr && StrandState::current() == state_.get();
+	}
+
+private:
+	template<typename, typename, typename, typename> friend class BasicThreadPool;
+
+	explicit Strand(std::shared_ptr<StrandState> state)
+		: state_(std::move(state))
+	{}
+
+	std::shared_ptr<StrandState> state_;
+};
+
+// 阻塞区域的守卫，由ThreadPool::blockingRegion()返回，析构时离开阻塞区域；只能移动，不能拷贝
+class BlockingRegion
+{
+public:
+	BlockingRegion() noexcept
+		: pool_(nullptr)
+	{}
+
+	BlockingRegion(BlockingRegion&& other) noexcept
+		: pool_(other.pool_)
+	{
+		other.pool_ = nullptr;
+	}
+
+	BlockingRegion(const BlockingRegion&) = delete;
+	BlockingRegion& operator=(const BlockingRegion&) = delete;
+	BlockingRegion& operator=(BlockingRegion&&) = delete;
+
+	inline ~BlockingRegion();
+
+private:
+	template<typename, typename, typename, typename> friend class BasicThreadPool;
+
+	explicit BlockingRegion(ThreadPool* pool) noexcept
+		: pool_(pool)
+	{}
+
+	ThreadPool* pool_; // 不是线程池的线程时为nullptr，什么也不做
+};
+
+// 执行器组的配置，见ThreadPool::makeExecutorGroup()
+struct ExecutorGroupConfig
+{
+	int weight = 1;				// 权重，几个组都有任务排队时，各组执行的任务数和权重成正比
+	int maxConcurrency = 0;		// 配额：组里最多同时执行的任务数，0表示不限制
+	int maxQueueSize = TASK_MAX_THRESHHOLD;	// 组里最多排队的任务数，满了提交失败
+	TaskPriority priority = TaskPriority::PRIORITY_NORMAL;	// 组的任务在线程池里的优先级
+};
+
+// 一个执行器组的状态，由线程池持有，线程池析构时释放；除了config都由线程池的groupMtx_保护
+struct ExecutorGroupState
+{
+	ThreadPool* pool = nullptr;
+	ExecutorGroupConfig config;
+	std::deque<Task> taskQue;	// 排队的任务
+	int runningSize = 0;		// 正在执行的任务数
+	uint64_t pass = 0;			// 虚拟时间，每开始执行一个任务增加GROUP_STRIDE / weight，有任务可执行的组里虚拟时间最小的先执行
+};
+
+// 执行器组，由ThreadPool::makeExecutorGroup()创建：一个逻辑上独立的线程池，有自己的队列、优先级和配额，
+// 但是不单独创建线程，所有的组共用所属线程池的线程，线程总数还是线程池的线程数，不会超额订阅
+// 几个组都有任务时按权重公平分配线程，一个组没有任务时它的份额自动给别的组用
+// ThreadPool pool;
+// pool.start();
+// ExecutorGroupConfig io;
+// io.maxConcurrency = 4;
+// ExecutorGroup ioGroup = pool.makeExecutorGroup(io);
+// ExecutorGroupConfig cpu;
+// cpu.weight = 3;
+// ExecutorGroup cpuGroup = pool.makeExecutorGroup(cpu);
+// ioGroup.submitTask(readFile, path);
+// cpuGroup.submitTask(compress, block);
+class ExecutorGroup
+{
+public:
+	// 默认构造的组不能提交任务
+	ExecutorGroup() = default;
+
+	// 提交任务，返回值和ThreadPool::submitTask一样；组的队列满了时提交失败，get()抛出TaskRejectedError，线程池已经关闭时抛出PoolShutdownError
+	template<typename Func, typename... Args>
+	auto submitTask(Func&& func, Args&&... args) -> Future<decltype(func(args...))>;
+
+	bool valid() const
+	{
+		return state_ != nullptr;
+	}
+
+	// 组里排队的任务数量，包括因为配额还不能执行的
+	inline int getTaskSize() const;
+
+	// 组里正在执行的任务数量
+	inline int getRunningSize() const;
+
+private:
+	template<typename, typename, typename, typename> friend class BasicThreadPool;
+
+	explicit ExecutorGroup(ExecutorGroupState* state)
+		: state_(state)
+	{}
+
+	ExecutorGroupState* state_ = nullptr;
+};
+
+// parallel_for/parallel_reduce的共享状态：区间切成chunks块，记录领取进度、完成的块数和第一个异常
+// 由调用线程和线程池中的任务共同持有，调用线程返回之后才开始执行的任务领不到块，直接结束
+class ParallelState
+{
+public:
+	ParallelState(size_t chunks)
+		: next_(0)
+		, done_(0)
+		, chunks_(chunks)
+	{}
+
+	// 执行第index块，异常先保存起来，等调用线程重新抛出
+	template<typename RunChunk>
+	void runChunk(const RunChunk& run, size_t index)
+	{
+		try
+		{
+			run(index);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			if (!exception_)
+				exception_ = std::current_exception();
+		}
+
+		if (done_.fetch_add(1) + 1 == chunks_)
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			cond_.notify_all();
+		}
+	}
+
+	// 不断领取还没有执行的块，直到全部被领完
+	template<typename RunChunk>
+	void claimChunks(const RunChunk* run)
+	{
+		size_t index;
+		while ((index = next_.fetch_add(1)) < chunks_)
+		{
+			runChunk(*run, index);
+		}
+	}
+
+	bool isDone() const
+	{
+		return done_ == chunks_;
+	}
+
+	// 等待所有块执行完，有异常的话重新抛出
+	void wait()
+	{
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			cond_.wait(lock, [&]()->bool { return done_ == chunks_; });
+		}
+		if (exception_)
+			std::rethrow_exception(exception_);
+	}
+
+private:
+	std::atomic<size_t> next_;	// 下一个要领取的块
+	std::atomic<size_t> done_;	// 已经执行完的块数
+	size_t chunks_;
+	std::exception_ptr exception_;
+	std::mutex mtx_;
+	std::condition_variable cond_;
+};
+
+// 延迟直方图的快照，按2的幂分桶：第0个桶是0ns，第i个桶是[2^(i-1), 2^i)ns
+struct LatencyHistogram
+{
+	uint64_t buckets[HISTOGRAM_BUCKET_SIZE] = {};
+	uint64_t count = 0;	// 记录的次数
+	uint64_t sum = 0;	// 总时间，单位：纳秒
+	uint64_t max = 0;	// 最大值，单位：纳秒
+
+	// 平均值，单位：纳秒
+	uint64_t mean() const
+	{
+		return count == 0 ? 0 : sum / count;
+	}
+
+	// 百分位数的近似值（所在桶的上界），p取值[0, 1]，单位：纳秒
+	uint64_t percentile(double p) const
+	{
+		uint64_t rank = (uint64_t)(p * (double)count + 0.5);
+		uint64_t seen = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKET_SIZE; i++)
+		{
+			seen += buckets[i];
+			if (seen >= rank && seen > 0)
+				return std::min(bucketUpperBound(i), max);
+		}
+		return max;
+	}
+
+	void merge(const LatencyHistogram& other)
+	{
+		for (int i = 0; i < HISTOGRAM_BUCKET_SIZE; i++)
+			buckets[i] += other.buckets[i];
+		count += other.count;
+		sum += other.sum;
+		max = std::max(max, other.max);
+	}
+
+	// 第index个桶的上界
+	static uint64_t bucketUpperBound(int index)
+	{
+		return index == 0 ? 0 : ((uint64_t)1 << index) - 1;
+	}
+
+	// 纳秒数所在的桶：二进制位数
+	static int bucketIndex(uint64_t ns)
+	{
+		if (ns == 0)
+			return 0;
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long pos;
+		_BitScanReverse64(&pos, ns);
+		int index = (int)pos + 1;
+#elif defined(__GNUC__)
+		int index = 64 - __builtin_clzll(ns);
+#else
+		int index = 0;
+		for (; ns != 0; ns >>= 1)
+			index++;
+#endif
+		return std::min(index, HISTOGRAM_BUCKET_SIZE - 1);
+	}
+};
+
+// 一个工作线程的统计快照
+struct WorkerStatsSnapshot
+{
+	int threadId = -1;		// 线程id，汇总的快照为-1
+	int index = -1;			// start创建的线程的下标，cached模式后来增加的线程为-1
+	uint64_t executed = 0;	// 执行的任务数
+	uint64_t steals = 0;	// 从其它线程或者其它节点的队列取到的任务数
+	uint64_t parks = 0;		// 挂起的次数
+	uint64_t unparks = 0;	// 挂起之后被唤醒的次数（不包括超时）
+	uint64_t overruns = 0;	// 执行时间超过预算的任务数
+	LatencyHistogram queueWait;	// 任务从提交到开始执行的时间
+	LatencyHistogram runTime;	// 任务执行的时间
+
+	void merge(const WorkerStatsSnapshot& other)
+	{
+		executed += other.executed;
+		steals += other.steals;
+		parks += other.parks;
+		unparks += other.unparks;
+		overruns += other.overruns;
+		queueWait.merge(other.queueWait);
+		runTime.merge(other.runTime);
+	}
+};
+
+// 线程池的统计快照，由ThreadPool::snapshotStats()返回
+struct PoolStats
+{
+	int taskSize = 0;		// 排队中的任务数量
+	int curThreadSize = 0;	// 线程总数
+	int idleThreadSize = 0;	// 空闲线程数
+	int laneTaskSize[TASK_PRIORITY_SIZE] = {};	// 每个优先级排队中的任务数量
+	uint64_t rejectedTaskSize = 0;		// 因为队列满了提交失败的任务数
+	uint64_t droppedTaskSize = 0;		// POLICY_DROP_OLDEST丢弃的任务数
+	uint64_t callerRunsTaskSize = 0;	// POLICY_CALLER_RUNS由提交线程执行的任务数
+	uint64_t cancelledTaskSize = 0;		// 执行之前被取消的任务数
+	bool overloaded = false;			// 是否超过了高水位，还没有降到低水位
+	int timerSize = 0;					// 还没到期的定时器数量（submitAfter/submitEvery）
+	int blockedThreadSize = 0;			// 在阻塞区域里的线程数量
+	int compensateThreadSize = 0;		// 阻塞区域创建的补偿线程数量
+	std::vector<WorkerStatsSnapshot> workers;	// 每个还在运行的线程
+	WorkerStatsSnapshot total;	// 所有线程的汇总，包括已经退出的线程
+};
+
+// 一个工作线程的统计计数，只有所属线程写，快照线程随时读，不需要锁也不需要原子的读改写
+// 按缓存行对齐，不同线程的计数不会伪共享
+class alignas(CACHE_LINE_SIZE) WorkerStats
+{
+public:
+	WorkerStats(int threadId, int index)
+		: threadId_(threadId)
+		, index_(index)
+	{}
+	WorkerStats(const WorkerStats&) = delete;
+	WorkerStats& operator=(const WorkerStats&) = delete;
+
+	void addExecuted() { increase(executed_); }
+	void addSteal() { increase(steals_); }
+	void addPark() { increase(parks_); }
+	void addUnpark() { increase(unparks_); }
+	void addOverrun() { increase(overruns_); }
+	void recordQueueWait(uint64_t ns) { queueWait_.record(ns); }
+	void recordRunTime(uint64_t ns) { runTime_.record(ns); }
+
+	// 只读排队的次数和总时间，比snapshot便宜
+	void queueWaitTotal(uint64_t& count, uint64_t& sum) const
+	{
+		count = queueWait_.count();
+		sum = queueWait_.sum();
+	}
+
+	WorkerStatsSnapshot snapshot() const
+	{
+		WorkerStatsSnapshot result;
+		result.threadId = threadId_;
+		result.index = index_;
+		result.executed = executed_.load(std::memory_order_relaxed);
+		result.steals = steals_.load(std::memory_order_relaxed);
+		result.parks = parks_.load(std::memory_order_relaxed);
+		result.unparks = unparks_.load(std::memory_order_relaxed);
+		result.overruns = overruns_.load(std::memory_order_relaxed);
+		queueWait_.snapshot(result.queueWait);
+		runTime_.snapshot(result.runTime);
+		return result;
+	}
+
+private:
+	using Counter = std::atomic<uint64_t>;
+
+	// 只有一个写线程，普通的读再写就够了，比fetch_add便宜
+	static void increase(Counter& counter, uint64_t value = 1)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	class Histogram
+	{
+	public:
+		void record(uint64_t ns)
+		{
+			increase(buckets_[LatencyHistogram::bucketIndex(ns)]);
+			increase(count_);
+			increase(sum_, ns);
+			if (ns > max_.load(std::memory_order_relaxed))
+				max_.store(ns, std::memory_order_relaxed);
+		}
+
+		uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+		uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+		void snapshot(LatencyHistogram& result) const
+		{
+			for (int i = 0; i < HISTOGRAM_BUCKET_SIZE; i++)
+				result.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+			result.count = count_.load(std::memory_order_relaxed);
+			result.sum = sum_.load(std::memory_order_relaxed);
+			result.max = max_.load(std::memory_order_relaxed);
+		}
+
+	private:
+		Counter buckets_[HISTOGRAM_BUCKET_SIZE] = {};
+		Counter count_{ 0 };
+		Counter sum_{ 0 };
+		Counter max_{ 0 };
+	};
+
+	int threadId_;
+	int index_;
+	Counter executed_{ 0 };
+	Counter steals_{ 0 };
+	Counter parks_{ 0 };
+	Counter unparks_{ 0 };
+	Counter overruns_{ 0 };
+	Histogram queueWait_;
+	Histogram runTime_;
+};
+
+// 线程池类型，模板参数是编译期配置，见上面的策略；一般直接用ThreadPool
+// ThreadPool以外的配置：Future的后续任务在完成任务的线程上直接执行，不能创建Strand、执行器组和阻塞区域
+template<typename QueuePolicy, typename WaitPolicy, typename StatsPolicy, typename GrowthPolicy>
+class BasicThreadPool
+{
+public:
+	// 线程池构造
+	BasicThreadPool()
+		: initThreadSize_(0)
+		, threadSizeThreshHold_(THREAD_MAX_THRESHHOLD)
+		, minThreadSize_(-1)
+		, spareThreadSize_(0)
+		, threadIdleTimeout_(std::chrono::seconds(THREAD_MAX_IDLE_TIME))
+		, growLatency_(std::chrono::microseconds(THREAD_GROW_LATENCY))
+		, controllerWakeup_(false)
+		, submitTimeout_(std::chrono::seconds(1))
+		, highWatermark_(0)
+		, lowWatermark_(0)
+		, taskQueMaxThreshHold_(TASK_MAX_THRESHHOLD)
+		, idleSpinTime_(-1)
+		, affinityMode_(AffinityMode::AFFINITY_NONE)
+		, backpressurePolicy_(BackpressurePolicy::POLICY_BLOCK)
+		, poolMode_(PoolMode::MODE_FIXED)
+		, taskQueMode_(TaskQueMode::MODE_LOCKED)
+		, isPoolRunning_(false)
+		, isShutdown_(false)
+		, discardPending_(false)
+		, curThreadSize_(0)
+		, overloaded_(false)
+		, idleWaiterSize_(0)
+		, taskSize_(0)
+		, deadlineTaskSize_(0)
+		, nodeTaskSize_(0)
+		, idleStackSize_(0)
+		, groupVirtualTime_(0)
+		, rejectedTaskSize_(0)
+		, droppedTaskSize_(0)
+		, callerRunsTaskSize_(0)
+		, cancelledTaskSize_(0)
+		, blockedThreadSize_(0)
+		, compensateThreadSize_(0)
+		, traceEnabled_(false)
+		, traceStartTick_(0)
+		, timerWheel_([this](Task& task) { dispatchTimerTask(task); })
+	{}
+
+	// 线程池析构
+	~BasicThreadPool()
+	{
+		shutdown(ShutdownMode::SHUTDOWN_DRAIN);
+	}
+
+	// 关闭线程池，之后外部线程提交的任务都会失败（按背压策略处理，POLICY_CALLER_RUNS由提交线程执行）
+	// 正在执行的任务执行完之前，线程池自己的线程还可以提交任务，SHUTDOWN_DRAIN下这些任务也会执行
+	// 除了SHUTDOWN_IMMEDIATE，返回时所有线程都已经结束并回收；可以多次调用，丢弃排队的任务之后再SHUTDOWN_DRAIN也不会恢复
+	// 挂起的线程和等待队列空位的提交线程都会马上被唤醒，等待的时间只取决于正在执行的最长的任务
+	// 不能在线程池自己的线程里调用
+	void shutdown(ShutdownMode mode = ShutdownMode::SHUTDOWN_DRAIN)
+	{
+		if (currentWorker().pool == this)
+		{
+			THREADPOOL_LOG_ERROR("shutdown() called from a pool thread, ignored.");
+			return;
+		}
+
+		std::lock_guard<std::mutex> guard(shutdownMtx_);
+		if (mode != ShutdownMode::SHUTDOWN_DRAIN)
+		{
+			discardPending_ = true;
+		}
+
+		if (!isShutdown_.exchange(true))
+		{
+			isPoolRunning_ = false;
+
+			// 停掉定时线程，还没到期的定时器不再交给线程池
+			timerWheel_.stop();
+
+			// 先停掉cached模式的控制线程，之后不会再增加线程
+			if (controller_.joinable())
+			{
+				controllerSem_.post();
+				controller_.join();
+			}
+
+			// 唤醒所有挂起的线程，正在执行任务的线程执行完会自己看到isPoolRunning_
+			wakeAllIdleThreads();
+
+			// 唤醒等待队列空位的提交线程，它们会看到isShutdown_，提交失败返回
+			std::lock_guard<std::mutex> lock(taskQueMtx_);
+			for (TaskLane& lane : lanes_)
+			{
+				lane.notFull.notify_all();
+				lane.deadlineNotFull.notify_all();
+			}
+			for (auto& que : nodeQues_)
+			{
+				que->notFull.notify_all();
+			}
+		}
+		else if (mode != ShutdownMode::SHUTDOWN_DRAIN)
+		{
+			// 之前是SHUTDOWN_DRAIN，线程可能都在执行任务，不用唤醒；挂起的线程已经被唤醒过了
+			wakeAllIdleThreads();
+		}
+
+		if (discardPending_)
+		{
+			discardGroupTasks();
+		}
+
+		if (mode == ShutdownMode::SHUTDOWN_IMMEDIATE)
+			return;
+
+		joinThreads();
+
+		// 线程退出的日志在后台线程输出，这里输出掉，程序马上结束时不会丢失
+		AsyncLogger::flushIfUsed();
+	}
+
+	// 线程池自己的线程在任务里等待子任务的结果：等待期间继续执行队列中的其它任务，不会把线程卡住
+	// 所有线程都在等子任务时，子任务也能被等待的线程执行，fixed模式下嵌套get()不会死锁
+	// 不是这个线程池的线程调用时就是future.get()
+	// int sum = pool.helpWhileWaiting(child);
+	template<typename T>
+	T helpWhileWaiting(Future<T>& future)
+	{
+		if (currentWorker().pool == this)
+		{
+			while (!future.is_ready())
+			{
+				// 没有别的任务时等一小会儿：结果就绪马上返回，期间新来的任务下一轮再执行
+				if (!runPendingTask())
+					future.wait_for(std::chrono::microseconds(HELP_WAIT_INTERVAL));
+			}
+		}
+		return future.get();
+	}
+
+	template<typename T>
+	T helpWhileWaiting(Future<T>&& future)
+	{
+		return helpWhileWaiting(future);
+	}
+
+	// 在线程池自己的线程上执行一个排队的任务，用于长时间运行的任务主动让出；没有任务或者不是线程池的线程返回false
+	bool yield()
+	{
+		return currentWorker().pool == this && runPendingTask();
+	}
+
+	// 等待所有排队的任务和正在执行的任务都执行完，期间提交的任务也会等待；由完成最后一个任务的线程唤醒，不轮询
+	// 不能在线程池自己的线程里调用，线程池还没有启动时排队的任务不会执行，这时不要调用
+	void waitIdle()
+	{
+		idleWaiterSize_++;
+		{
+			std::unique_lock<std::mutex> lock(idleWaitMtx_);
+			idleWaitCond_.wait(lock, [&]()->bool { return isIdle(); });
+		}
+		idleWaiterSize_--;
+	}
+
+	// 设置线程池的工作模式
+	void setMode(PoolMode mode)
+	{
+		if (checkRunningState())
+			return;
+		poolMode_ = mode;
+	}
+
+	// 设置任务队列的实现方式，无锁队列的容量由setTaskQueMaxThreshHold决定
+	void setTaskQueMode(TaskQueMode mode)
+	{
+		if (checkRunningState())
+			return;
+		taskQueMode_ = mode;
+	}
+
+	// 设置task任务队列上线阈值
+	void setTaskQueMaxThreshHold(int threshhold)
+	{
+		if (checkRunningState())
+			return;
+		taskQueMaxThreshHold_ = threshhold;
+	}
+
+	// 设置线程池cached模式下线程阈值
+	void setThreadSizeThreshHold(int threshhold)
+	{
+		if (checkRunningState())
+			return;
+		if (poolMode() == PoolMode::MODE_CACHED)
+		{
+			threadSizeThreshHold_ = threshhold;
+		}
+	}
+
+	// cached模式下线程数量的范围，运行中也可以修改：少于minSize时补足，多于minSize的空闲线程超时后回收
+	// 启动前不设置时，minSize就是start的初始线程数量
+	void setThreadSizeLimit(int minSize, int maxSize)
+	{
+		minThreadSize_ = minSize;
+		threadSizeThreshHold_ = std::max(minSize, maxSize);
+	}
+
+	// cached模式下保持的空闲线程数量，突发的任务不用等待创建线程，运行中也可以修改
+	void setSpareThreadSize(int size)
+	{
+		spareThreadSize_ = size;
+	}
+
+	// cached模式下多于最少数量的线程空闲超过timeout后回收，可以小于1s，运行中修改时从线程下一次挂起开始生效
+	void setThreadIdleTimeout(std::chrono::milliseconds timeout)
+	{
+		threadIdleTimeout_ = timeout;
+	}
+
+	// cached模式下任务平均排队时间超过latency并且有积压时才增加线程，运行中也可以修改
+	void setGrowLatency(std::chrono::microseconds latency)
+	{
+		growLatency_ = latency;
+	}
+
+	// 设置空闲线程挂起之前自旋等待任务的最长时间，单位：微秒，0表示不自旋直接挂起
+	// 不设置时默认THREAD_SPIN_TIME，单核机器上默认不自旋；设置了就按设置的值，单核机器上也一样
+	void setIdleSpinTime(int spinTime)
+	{
+		if (checkRunningState())
+			return;
+		idleSpinTime_ = spinTime;
+	}
+
+	// 设置任务队列满了时的处理方式，默认POLICY_BLOCK
+	void setBackpressurePolicy(BackpressurePolicy policy)
+	{
+		if (checkRunningState())
+			return;
+		backpressurePolicy_ = policy;
+	}
+
+	// 设置POLICY_BLOCK下提交任务最长的等待时间，默认1s
+	void setSubmitTimeout(std::chrono::milliseconds timeout)
+	{
+		if (checkRunningState())
+			return;
+		submitTimeout_ = timeout;
+	}
+
+	// 排队的任务数达到high时调用callback(true)，之后降到low以下时调用callback(false)，用于上游提前减载
+	// 回调在提交任务或者取任务的线程上直接调用，要足够快，不能在回调里提交任务；high为0表示不开启
+	using WatermarkCallback = std::function<void(bool)>;
+	void setWatermark(int high, int low, WatermarkCallback callback)
+	{
+		if (checkRunningState())
+			return;
+		highWatermark_ = high;
+		lowWatermark_ = low;
+		watermarkCallback_ = std::move(callback);
+	}
+
+	// 是否超过了高水位，还没有降到低水位
+	bool isOverloaded() const
+	{
+		return overloaded_;
+	}
+
+	// 设置工作线程绑定CPU的方式，AFFINITY_EXPLICIT时按cpus依次绑定，线程比CPU多时循环使用
+	// 只对start创建的线程生效，cached模式后来增加的线程不绑定
+	void setAffinity(AffinityMode mode, std::vector<int> cpus = std::vector<int>())
+	{
+		if (checkRunningState())
+			return;
+		affinityMode_ = mode;
+		affinityCpus_ = std::move(cpus);
+	}
+
+	// NUMA节点的数量，submitTask(node, ...)的node取值范围是[0, getNodeSize())
+	int getNodeSize() const
+	{
+		return topology_.nodeSize();
+	}
+
+	// 给线程池提交任务
+	// 使用可变参模板编程，让submitTask可以接收任意任务函数和任意数量的参数
+	// pool.submitTask(sum1, 10, 20); 
+	// 返回值Future<>  Func 函数对象指针  Args 参数列表
+	template<typename Func, typename... Args>		// -> 指定返回值类型，给auto提示
+	auto submitTask(Func&& func, Args&&... args) -> Future<decltype(func(args...))>	// 推导函数调用之后的返回值（函数，参数）
+	{
+		// 打包任务，放入任务队列里面 RType是类型   函数，参数， 返回类型 = RType
+		using RType = decltype(func(args...));
+		Future<RType> result;
+		Task item = packageTask(result, std::forward<Func>(func), std::forward<Args>(args)...);
+		if (!pushTask(item))
+		{
+			// 表示等待1s种，任务队列依然是满的，或者线程池已经关闭
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+
+		// 返回任务的Result对象
+		return result;
+	}
+
+#ifdef THREADPOOL_HAS_PMR
+	// 任务的函数和参数从resource分配，比如一个请求的整棵任务树共用一个monotonic_buffer_resource，
+	// 请求结束时一次释放。resource要比这些任务活得久，并且自己保证线程安全（或者只在一个线程上提交和执行）
+	// std::pmr::synchronized_pool_resource resource;
+	// pool.submitTask(&resource, sum1, 10, 20);
+	template<typename Func, typename... Args>
+	auto submitTask(std::pmr::memory_resource* resource, Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		Future<RType> result;
+		auto body = packageCall(result, std::forward<Func>(func), std::forward<Args>(args)...);
+		Task item(ResourceTask<decltype(body)>(resource, std::move(body)));
+		if (!pushTask(item))
+		{
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+		return result;
+	}
+#endif
+
+	// 带取消令牌提交任务：开始执行之前令牌被取消的话不再执行，Future得到TaskCancelledError
+	// 有锁队列满了的时候会先清掉已经取消的任务，取消的任务不会一直占着队列的位置
+	// pool.submitTask(source.token(), sum1, 10, 20);
+	template<typename Func, typename... Args>
+	auto submitTask(const CancellationToken& token, Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		return submitTask(token, std::chrono::nanoseconds(0), std::forward<Func>(func), std::forward<Args>(args)...);
+	}
+
+	// 同上，另外给任务一个执行时间预算，执行时间超过budget的任务计入统计的overruns
+	// pool.submitTask(source.token(), std::chrono::milliseconds(5), sum1, 10, 20);
+	template<typename Rep, typename Period, typename Func, typename... Args>
+	auto submitTask(const CancellationToken& token, std::chrono::duration<Rep, Period> budget, Func&& func, Args&&... args)
+		-> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		// 已经取消了，不用进队列
+		if (token.isCancelled())
+		{
+			cancelledTaskSize_++;
+			return cancelledFuture<RType>();
+		}
+
+		auto state = new FutureState<RType>();
+		Future<RType> result(state, continuationPool());
+		Task item(CancellableCall<RType, typename std::decay<Func>::type, std::tuple<typename std::decay<Args>::type...>>(
+			this, Promise<RType>(state), token, std::chrono::duration_cast<std::chrono::nanoseconds>(budget),
+			std::forward<Func>(func), std::make_tuple(std::forward<Args>(args)...)));
+		if (!pushTask(item))
+		{
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+		return result;
+	}
+
+	// 按优先级提交任务，高优先级的任务先执行，每个优先级有自己的任务队列和阈值
+	// pool.submitTask(TaskPriority::PRIORITY_HIGH, sum1, 10, 20);
+	template<typename Func, typename... Args>
+	auto submitTask(TaskPriority priority, Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		Future<RType> result;
+		Task item = packageTask(result, std::forward<Func>(func), std::forward<Args>(args)...);
+		if (!pushTask(item, priority))
+		{
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+		return result;
+	}
+
+	// 按指定的策略提交任务，不使用线程池默认的策略
+	// pool.submitTask(BackpressurePolicy::POLICY_CALLER_RUNS, sum1, 10, 20);
+	template<typename Func, typename... Args>
+	auto submitTask(BackpressurePolicy policy, Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		Future<RType> result;
+		Task item = packageTask(result, std::forward<Func>(func), std::forward<Args>(args)...);
+		if (!pushTask(item, TaskPriority::PRIORITY_NORMAL, policy))
+		{
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+		return result;
+	}
+
+	// 尝试提交任务，队列满了不等待，立即返回无效的Future（valid()为false）
+	// 线程池自己的线程先放进自己的队列，自己的队列和共享队列都到了阈值才失败
+	template<typename Func, typename... Args>
+	auto trySubmit(Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		Future<RType> result;
+		Task item = packageTask(result, std::forward<Func>(func), std::forward<Args>(args)...);
+		if (!pushTask(item, TaskPriority::PRIORITY_NORMAL, BackpressurePolicy::POLICY_FAIL_FAST))
+			return Future<RType>();
+		return result;
+	}
+
+	// 提交带截止时间的任务，截止时间到了的任务比所有优先级的普通任务都先执行，还没到时在本优先级里按截止时间先后执行
+	// 截止时间只影响执行顺序，过了截止时间的任务仍然会执行；每个优先级的截止时间队列也受队列阈值限制，满了按线程池的策略处理
+	template<typename Func, typename... Args>
+	auto submitTask(TaskPriority priority, std::chrono::steady_clock::time_point deadline,
+		Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		Future<RType> result;
+		Task item = packageTask(result, std::forward<Func>(func), std::forward<Args>(args)...);
+		if (!pushDeadlineTask(item, priority, deadline, backpressurePolicy_))
+		{
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+		return result;
+	}
+
+	// 提交带截止时间的普通优先级任务
+	template<typename Func, typename... Args>
+	auto submitTask(std::chrono::steady_clock::time_point deadline, Func&& func, Args&&... args)
+		-> Future<decltype(func(args...))>
+	{
+		return submitTask(TaskPriority::PRIORITY_NORMAL, deadline,
+			std::forward<Func>(func), std::forward<Args>(args)...);
+	}
+
+	// 提交任务到指定的NUMA节点，该节点上的线程优先执行，其它节点的线程空闲时也会来取，不会饿死
+	// 线程没有绑定CPU时所有线程都不属于任何节点，节点只是一个普通的队列；每个节点的队列也受队列阈值限制，满了按线程池的策略处理
+	// pool.submitTask(node, sum1, 10, 20);
+	template<typename Func, typename... Args>
+	auto submitTask(int node, Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		Future<RType> result;
+		Task item = packageTask(result, std::forward<Func>(func), std::forward<Args>(args)...);
+		if (node < 0 || node >= (int)nodeQues_.size())
+		{
+			// 节点编号不对，当作普通任务提交
+			if (!pushTask(item))
+			{
+				logRejected();
+				return rejectedFuture<RType>();
+			}
+			return result;
+		}
+		if (!pushNodeTask(item, node, backpressurePolicy_))
+		{
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+		return result;
+	}
+
+	// 延迟delay之后再提交任务，等待期间由线程池的定时线程管理，不占用线程池的线程，cached模式也不会因此增加线程
+	// 定时器的精度是1ms，不会比delay早执行；关闭线程池时还没到期的任务不再执行，Future抛出std::future_error(broken_promise)
+	// pool.submitAfter(std::chrono::milliseconds(100), sum1, 10, 20);
+	template<typename Rep, typename Period, typename Func, typename... Args>
+	auto submitAfter(std::chrono::duration<Rep, Period> delay, Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		TimerHandle handle;
+		return submitAfter(handle, delay, std::forward<Func>(func), std::forward<Args>(args)...);
+	}
+
+	// 同上，另外通过handle返回定时器句柄，到期之前可以取消
+	// TimerHandle timeout;
+	// auto result = pool.submitAfter(timeout, std::chrono::seconds(5), onTimeout);
+	// timeout.cancel();
+	template<typename Rep, typename Period, typename Func, typename... Args>
+	auto submitAfter(TimerHandle& handle, std::chrono::duration<Rep, Period> delay, Func&& func, Args&&... args)
+		-> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		// 不用packageTask：排队时间从到期交给线程池开始算，不包括定时的时间
+		auto state = new FutureState<RType>();
+		Future<RType> result(state, continuationPool());
+		Task item([promise = Promise<RType>(state), func = std::forward<Func>(func),
+			args = std::make_tuple(std::forward<Args>(args)...)]() mutable
+		{
+			auto call = [&]()->RType { return applyTuple(func, args, std::index_sequence_for<Args...>()); };
+			promise.run(call);
+		});
+		handle = timerWheel_.add(std::move(item), std::chrono::duration_cast<std::chrono::nanoseconds>(delay),
+			std::chrono::nanoseconds(0));
+		if (!handle.valid())
+		{
+			rejectedTaskSize_++;
+			THREADPOOL_LOG_WARN("thread pool has been shut down, submit task fail.");
+			return failedFuture<RType>(true);
+		}
+		return result;
+	}
+
+	// 每隔period执行一次func，第一次在period之后；返回值被忽略，抛出的异常记一条日志，之后照常执行
+	// 上一次执行完才会放回时间轮，同一个任务不会同时执行两次，执行时间超过period时错过的周期直接跳过
+	// 返回的句柄用来停止，关闭线程池时自动停止，提交失败返回无效的句柄
+	// auto flush = pool.submitEvery(std::chrono::seconds(1), flushLogs);
+	// flush.cancel();
+	template<typename Rep, typename Period, typename Func, typename... Args>
+	TimerHandle submitEvery(std::chrono::duration<Rep, Period> period, Func&& func, Args&&... args)
+	{
+		// 每次执行都用同一份函数和参数，以左值传入
+		Task item([func = std::forward<Func>(func), args = std::make_tuple(std::forward<Args>(args)...)]() mutable
+		{
+			applyTuple(func, args, std::index_sequence_for<Args...>());
+		});
+		auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(period);
+		TimerHandle handle = timerWheel_.add(std::move(item), interval, std::max(interval, std::chrono::nanoseconds(1)));
+		if (!handle.valid())
+		{
+			rejectedTaskSize_++;
+			THREADPOOL_LOG_WARN("thread pool has been shut down, submit task fail.");
+		}
+		return handle;
+	}
+
+	// 创建一个串行执行器：提交到同一个strand的任务按顺序执行、不会同时执行，strand作为一个整体在线程池里调度
+	// priority是strand放进线程池时的优先级；strand不能比线程池活得久
+	Strand makeStrand(TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+	{
+		return Strand(std::make_shared<StrandState>(defaultPool(), priority));
+	}
+
+	// 创建一个执行器组：有自己的队列、优先级和配额，和其它组按权重公平地共用这个线程池的线程
+	// 组在线程池析构时释放，ExecutorGroup句柄不能比线程池活得久
+	ExecutorGroup makeExecutorGroup(const ExecutorGroupConfig& config = ExecutorGroupConfig())
+	{
+		std::unique_ptr<ExecutorGroupState> group(new ExecutorGroupState());
+		group->pool = defaultPool();
+		group->config = config;
+		group->config.weight = std::max(config.weight, 1);
+		group->config.maxQueueSize = std::max(config.maxQueueSize, 1);
+		ExecutorGroup result(group.get());
+		std::lock_guard<std::mutex> lock(groupMtx_);
+		group->pass = groupVirtualTime_;
+		groups_.push_back(std::move(group));
+		return result;
+	}
+
+	// 当前任务接下来要阻塞（等IO、等锁、sleep），返回的守卫析构之前这个线程不算线程池的计算能力：
+	// 没有挂起的线程可以接手排队的任务时，临时创建一个补偿线程，阻塞的线程都回来之后补偿线程空闲时自己退出
+	// 线程总数仍然受setThreadSizeThreshHold限制；可以嵌套，只有最外层生效；不是这个线程池的线程调用时什么也不做
+	// {
+	//     BlockingRegion region = pool.blockingRegion();
+	//     n = recv(fd, buffer, size, 0);
+	// }
+	BlockingRegion blockingRegion()
+	{
+		WorkerContext& context = currentWorker();
+		if (context.pool != this)
+			return BlockingRegion();
+		if (context.blockingDepth++ == 0)
+			enterBlocking();
+		return BlockingRegion(defaultPool());
+	}
+
+	// 提交一个会阻塞的任务，整个任务在blockingRegion()里执行，fixed模式下几个阻塞的任务不会饿死计算任务
+	// pool.submitBlocking(readFile, path);
+	template<typename Func, typename... Args>
+	auto submitBlocking(Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+	{
+		using RType = decltype(func(args...));
+		auto state = new FutureState<RType>();
+		Future<RType> result(state, continuationPool());
+		// 只有函数本身在阻塞区域里，结果就绪时挂的后续任务不算
+		Task item([this, promise = Promise<RType>(state), func = std::forward<Func>(func),
+			args = std::make_tuple(std::forward<Args>(args)...),
+			submitTime = submitClock()]() mutable
+		{
+			recordQueueWait(submitTime);
+			auto call = [&]()->RType
+			{
+				BlockingRegion region = blockingRegion();
+				return applyTuple(func, args, std::index_sequence_for<Args...>());
+			};
+			promise.run(call);
+		});
+		if (!pushTask(item))
+		{
+			logRejected();
+			return rejectedFuture<RType>();
+		}
+		return result;
+	}
+
+	// 开始记录调度事件：提交、取任务、执行、挂起/唤醒、cached模式的增长、线程创建/回收、taskQueMtx_上的竞争
+	// 每个线程写自己的环形缓冲区，不加锁；没有开始跟踪时每个埋点只多读一次标志
+	// 运行中也可以开始，之前记录的事件不再导出
+	void startTrace()
+	{
+		std::lock_guard<std::mutex> lock(traceMtx_);
+		traceStartTick_ = traceClock();
+		traceStartTime_ = std::chrono::steady_clock::now();
+		traceEnabled_ = true;
+	}
+
+	void stopTrace()
+	{
+		traceEnabled_ = false;
+	}
+
+	// 导出开始跟踪以来的事件（每个线程最近TRACE_BUFFER_SIZE个），跟踪中也可以导出，时间从开始跟踪算起
+	// pool.startTrace(); ... pool.dumpTrace("pool.json");  用chrome://tracing或者ui.perfetto.dev打开
+	void dumpTrace(std::ostream& out, TraceFormat format = TraceFormat::TRACE_CHROME_JSON)
+	{
+		uint64_t startTick;
+		std::chrono::steady_clock::time_point startTime;
+		{
+			std::lock_guard<std::mutex> lock(traceMtx_);
+			startTick = traceStartTick_;
+			startTime = traceStartTime_;
+		}
+		std::vector<TraceThread> threads = TraceRecorder::instance().collect(this, startTick);
+
+		// 用开始跟踪和现在两次对时算出时钟频率，TSC的值换算成纳秒
+		uint64_t endTick = traceClock();
+		double elapsed = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - startTime).count();
+		double nanosPerTick = endTick > startTick ? elapsed / (double)(endTick - startTick) : 1.0;
+		for (TraceThread& thread : threads)
+		{
+			for (TraceEvent& event : thread.events)
+			{
+				event.time = (uint64_t)((double)(event.time - startTick) * nanosPerTick);
+			}
+		}
+
+		if (format == TraceFormat::TRACE_PERFETTO)
+			TraceRecorder::writePerfetto(out, threads);
+		else
+			TraceRecorder::writeChromeJson(out, threads);
+	}
+
+	// 导出到文件，文件打不开时返回false
+	bool dumpTrace(const std::string& path, TraceFormat format = TraceFormat::TRACE_CHROME_JSON)
+	{
+		std::ofstream file(path, std::ios::binary);
+		if (!file)
+		{
+			THREADPOOL_LOG_ERROR("open trace file fail.");
+			return false;
+		}
+		dumpTrace(file, format);
+		return (bool)file;
+	}
+
+	// 某个优先级正在排队的任务数量（不包括工作窃取模式下线程自己队列里的任务）
+	int getTaskSize(TaskPriority priority) const
+	{
+		return lanes_[(int)priority].taskSize;
+	}
+
+	// 线程池的统计快照：队列深度、线程数量，以及每个线程执行的任务数、窃取次数、挂起次数和延迟直方图
+	// 各个计数是分别读取的，彼此之间不保证是同一时刻的值，适合定期采集
+	PoolStats snapshotStats()
+	{
+		PoolStats result;
+		result.taskSize = taskSize_;
+		result.curThreadSize = curThreadSize_;
+		for (int i = 0; i < TASK_PRIORITY_SIZE; i++)
+		{
+			result.laneTaskSize[i] = lanes_[i].taskSize;
+		}
+		result.rejectedTaskSize = rejectedTaskSize_;
+		result.droppedTaskSize = droppedTaskSize_;
+		result.callerRunsTaskSize = callerRunsTaskSize_;
+		result.cancelledTaskSize = cancelledTaskSize_;
+		result.overloaded = overloaded_;
+		result.timerSize = timerWheel_.size();
+		result.blockedThreadSize = blockedThreadSize_;
+		result.compensateThreadSize = compensateThreadSize_;
+
+		std::lock_guard<std::mutex> lock(statsMtx_);
+		result.idleThreadSize = std::max(result.curThreadSize - busyThreadSizeLocked(), 0);
+		result.total = retiredStats_;
+		for (WorkerState* state : workerStates_)
+		{
+			result.workers.push_back(state->stats.snapshot());
+			result.total.merge(result.workers.back());
+		}
+		return result;
+	}
+
+	// 批量提交任务：对[first, last)中的每个元素提交一个func(元素)任务
+	// 整批任务只获取一次锁，唤醒的线程数不超过任务数，cached模式整批只判断一次要不要创建线程
+	// 队列满了没有放进去的任务，和submitTask一样返回默认值结果
+	template<typename Iterator, typename Func>
+	auto submitBatch(Iterator first, Iterator last, Func&& func)
+		-> std::vector<Future<decltype(func(*first))>>
+	{
+		using RType = decltype(func(*first));
+		std::vector<Future<RType>> results;
+		std::vector<Task> items;
+		size_t count = (size_t)std::distance(first, last);
+		results.resize(count);
+		items.reserve(count);
+		for (size_t i = 0; first != last; ++first, ++i)
+		{
+			items.emplace_back(packageTask(results[i], func, *first));
+		}
+
+		size_t pushed = pushTasks(items.data(), count);
+		if (pushed < count)
+		{
+			logRejected();
+			for (size_t i = pushed; i < count; i++)
+			{
+				results[i] = rejectedFuture<RType>();
+			}
+		}
+		return results;
+	}
+
+	// 一次提交多个无参任务，返回每个任务的Future
+	// auto results = pool.submitAll([]{ return 1; }, []{ return 2.0; });
+	template<typename... Funcs>
+	auto submitAll(Funcs&&... funcs) -> std::tuple<Future<decltype(funcs())>...>
+	{
+		static_assert(sizeof...(Funcs) > 0, "submitAll needs at least one task");
+		return submitAllImpl(std::index_sequence_for<Funcs...>(), std::forward<Funcs>(funcs)...);
+	}
+
+	// 所有任务完成之后就绪，结果按传入的顺序排列；有任务抛出异常时得到排在最前面的那个异常
+	// 不阻塞调用线程，每个Future完成时只做一次原子减法，最后一个完成的线程收集结果
+	// futures里有无效的Future时抛出future_error(no_state)
+	template<typename T>
+	Future<typename WhenAllResult<T>::type> when_all(std::vector<Future<T>> futures)
+	{
+		using RType = typename WhenAllResult<T>::type;
+		for (const Future<T>& future : futures)
+			future.checkState();
+		struct Shared
+		{
+			Shared(std::vector<Future<T>>&& futures, FutureState<RType>* state)
+				: futures(std::move(futures))
+				, remaining(this->futures.size())
+				, promise(state)
+			{}
+			std::vector<Future<T>> futures;
+			std::atomic<size_t> remaining;
+			Promise<RType> promise;
+		};
+
+		auto state = new FutureState<RType>();
+		Future<RType> result(state, continuationPool());
+		auto shared = std::make_shared<Shared>(std::move(futures), state);
+		if (shared->futures.empty())
+		{
+			auto call = [&]()->RType { return collectResults(shared->futures); };
+			shared->promise.run(call);
+			return result;
+		}
+		for (Future<T>& future : shared->futures)
+		{
+			future.state_->setContinuation(Task([shared]() {
+				if (--shared->remaining == 0)
+				{
+					auto call = [&]()->RType { return collectResults(shared->futures); };
+					shared->promise.run(call);
+				}
+			}), nullptr);
+		}
+		return result;
+	}
+
+	// 任意一个任务完成之后就绪，结果里是它的下标和全部Future，futures为空时立即就绪，index为0
+	// futures里有无效的Future时抛出future_error(no_state)
+	template<typename T>
+	Future<WhenAnyResult<T>> when_any(std::vector<Future<T>> futures)
+	{
+		for (const Future<T>& future : futures)
+			future.checkState();
+		struct Shared
+		{
+			Shared(std::vector<Future<T>>&& futures, FutureState<WhenAnyResult<T>>* state)
+				: futures(std::move(futures))
+				, done(false)
+				, promise(state)
+			{}
+			std::vector<Future<T>> futures;
+			std::atomic_bool done;
+			Promise<WhenAnyResult<T>> promise;
+		};
+
+		auto state = new FutureState<WhenAnyResult<T>>();
+		Future<WhenAnyResult<T>> result(state, continuationPool());
+		auto shared = std::make_shared<Shared>(std::move(futures), state);
+		if (shared->futures.empty())
+		{
+			auto call = [&]()->WhenAnyResult<T> { return WhenAnyResult<T>{ 0, std::move(shared->futures) }; };
+			shared->promise.run(call);
+			return result;
+		}
+		// 先取出所有状态，第一个完成的任务会把futures整个移走
+		std::vector<FutureState<T>*> states;
+		for (Future<T>& future : shared->futures)
+			states.push_back(future.state_);
+		for (size_t i = 0; i < states.size(); i++)
+		{
+			states[i]->setContinuation(Task([shared, i]() {
+				if (!shared->done.exchange(true))
+				{
+					auto call = [&]()->WhenAnyResult<T> { return WhenAnyResult<T>{ i, std::move(shared->futures) }; };
+					shared->promise.run(call);
+				}
+			}), nullptr);
+		}
+		return result;
+	}
+
+#ifdef THREADPOOL_HAS_COROUTINE
+	// co_await pool.schedule()之后，协程在线程池的线程上继续执行，和普通任务走同一个任务队列
+	// 挂起的协程不占线程，几个线程就可以推进成千上万个协程
+	// 任务队列满了提交失败（或者等待恢复的任务被丢弃）时，co_await抛出TaskRejectedError；
+	// POLICY_CALLER_RUNS下直接在当前线程上继续执行
+	class ScheduleAwaiter
+	{
+	public:
+		explicit ScheduleAwaiter(BasicThreadPool* pool) noexcept
+			: pool_(pool)
+			, rejected_(false)
+		{}
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			handle_ = handle;
+			Task task(ResumeTask(this));
+			pool_->pushTask(task);
+			// 放进去的任务由线程池恢复协程；没放进去的任务在这里析构时恢复协程，之后不能再访问this
+		}
+		void await_resume() const
+		{
+			if (rejected_)
+				throw TaskRejectedError();
+		}
+
+	private:
+		// 恢复协程的任务，没有执行就被销毁时标记失败并恢复协程，协程不会永远挂着
+		struct ResumeTask
+		{
+			explicit ResumeTask(ScheduleAwaiter* awaiter) noexcept
+				: awaiter(awaiter)
+			{}
+			ResumeTask(ResumeTask&& other) noexcept
+				: awaiter(std::exchange(other.awaiter, nullptr))
+			{}
+			~ResumeTask()
+			{
+				if (awaiter != nullptr)
+				{
+					awaiter->rejected_ = true;
+					awaiter->handle_.resume();
+				}
+			}
+			void operator()()
+			{
+				std::exchange(awaiter, nullptr)->handle_.resume();
+			}
+
+			ScheduleAwaiter* awaiter;
+		};
+
+		BasicThreadPool* pool_;
+		std::coroutine_handle<> handle_;
+		bool rejected_;
+	};
+
+	ScheduleAwaiter schedule() noexcept
+	{
+		return ScheduleAwaiter(this);
+	}
+
+	// 在线程池上启动协程，返回它的结果
+	// Future<int> result = pool.spawn(compute(pool));
+	template<typename T>
+	Future<T> spawn(CoroTask<T> task)
+	{
+		auto state = new FutureState<T>();
+		Future<T> result(state, continuationPool());
+		spawnImpl(this, std::move(task), Promise<T>(state));
+		return result;
+	}
+#endif
+
+	// 并行执行body(i)，i取遍[first, last)，first/last可以是整数或者随机访问迭代器
+	// 区间切成不小于grain的块：工作窃取模式下递归二分，分出去的一半放进自己的队列等其它线程窃取；
+	// 其它模式按当前线程数静态切块。调用线程也参与执行，不会阻塞干等
+	// pool.parallel_for(0, n, 1024, [&](int i) { out[i] = in[i] * 2; });
+	template<typename Index, typename Body>
+	void parallel_for(Index first, Index last, size_t grain, Body&& body)
+	{
+		size_t count = (size_t)(last - first);
+		if (count == 0)
+			return;
+		auto run = [&](Index begin, Index end, size_t)
+		{
+			for (Index i = begin; i != end; ++i)
+				body(i);
+		};
+		parallelChunks(first, count, chunkSize(count, grain), run);
+	}
+
+	// 并行归约：对[first, last)中的每个i求map(i)，再用combine两两合并，init是合并的初值
+	// combine需要满足结合律，各块的结果按区间顺序合并，不要求交换律
+	// int sum = pool.parallel_reduce(1, 101, 0, [](int i) { return i; }, [](int a, int b) { return a + b; });
+	template<typename Index, typename T, typename Map, typename Combine>
+	T parallel_reduce(Index first, Index last, T init, Map&& map, Combine&& combine)
+	{
+		size_t count = (size_t)(last - first);
+		if (count == 0)
+			return init;
+		size_t chunk = chunkSize(count, 0);
+		std::vector<T> partial((count + chunk - 1) / chunk, init);
+		auto run = [&](Index begin, Index end, size_t index)
+		{
+			T value = map(begin);
+			for (Index i = ++begin; i != end; ++i)
+				value = combine(value, map(i));
+			partial[index] = value;
+		};
+		parallelChunks(first, count, chunk, run);
+
+		T result = init;
+		for (T& value : partial)
+			result = combine(result, value);
+		return result;
+	}
+
+	// 并行变换：out[i] = op(first[i])，返回输出的末尾，和std::transform一样可以原地变换
+	// 按输出数组的缓存行对齐切成缓存大小的块，线程动态领取；op是模板参数，每块的内层循环可以被编译器向量化
+	// pool.parallel_transform(in.begin(), in.end(), out.begin(), [](float x) { return x * 2; });
+	template<typename InputIt, typename OutputIt, typename Op>
+	OutputIt parallel_transform(InputIt first, InputIt last, OutputIt out, Op&& op)
+	{
+		size_t count = (size_t)(last - first);
+		if (count == 0)
+			return out; // 空区间的out不能解引用
+		auto run = [&](size_t begin, size_t end, size_t)
+		{
+			InputIt in = first + begin;
+			OutputIt to = out + begin;
+			for (size_t n = end - begin; n > 0; --n, ++in, ++to)
+				*to = op(*in);
+		};
+		bulkChunks(bulkLayout(bulkAddress(out, 0), sizeof(*out), count), count, run);
+		return out + count;
+	}
+
+	// 两个输入的并行变换：out[i] = op(first1[i], first2[i])
+	template<typename InputIt1, typename InputIt2, typename OutputIt, typename Op>
+	OutputIt parallel_transform(InputIt1 first1, InputIt1 last1, InputIt2 first2, OutputIt out, Op&& op)
+	{
+		size_t count = (size_t)(last1 - first1);
+		if (count == 0)
+			return out; // 空区间的out不能解引用
+		auto run = [&](size_t begin, size_t end, size_t)
+		{
+			InputIt1 in1 = first1 + begin;
+			InputIt2 in2 = first2 + begin;
+			OutputIt to = out + begin;
+			for (size_t n = end - begin; n > 0; --n, ++in1, ++in2, ++to)
+				*to = op(*in1, *in2);
+		};
+		bulkChunks(bulkLayout(bulkAddress(out, 0), sizeof(*out), count), count, run);
+		return out + count;
+	}
+
+	// 并行前缀和（包含当前元素）：out[i] = init op first[0] op ... op first[i]，返回输出的末尾，可以原地计算
+	// 先并行求每块的和，再依次算出每块的起始值，最后各块并行地从起始值开始扫描；op需要满足结合律
+	// pool.parallel_scan(in.begin(), in.end(), out.begin(), 0, [](int a, int b) { return a + b; });
+	template<typename InputIt, typename OutputIt, typename T, typename Op>
+	OutputIt parallel_scan(InputIt first, InputIt last, OutputIt out, T init, Op&& op)
+	{
+		size_t count = (size_t)(last - first);
+		if (count == 0)
+			return out;
+		// 两遍用同一个切法，第二遍的块和第一遍的和一一对应
+		BulkLayout layout = bulkLayout(bulkAddress(out, 0), sizeof(*out), count);
+		std::vector<T> partial(layout.chunks, init);
+		auto reduce = [&](size_t begin, size_t end, size_t index)
+		{
+			InputIt in = first + begin;
+			T value = *in;
+			for (size_t n = end - begin - 1; n > 0; --n)
+				value = op(value, *++in);
+			partial[index] = value;
+		};
+		bulkChunks(layout, count, reduce);
+
+		T carry = init;
+		for (T& value : partial)
+		{
+			T sum = op(carry, value);
+			value = carry;
+			carry = sum;
+		}
+
+		auto scan = [&](size_t begin, size_t end, size_t index)
+		{
+			InputIt in = first + begin;
+			OutputIt to = out + begin;
+			T value = partial[index];
+			for (size_t n = end - begin; n > 0; --n, ++in, ++to)
+			{
+				value = op(value, *in);
+				*to = value;
+			}
+		};
+		bulkChunks(layout, count, scan);
+		return out + count;
+	}
+
+	// 并行排序，和std::sort一样不保证相等元素的先后顺序：先把区间切成每个线程几段分别std::sort，
+	// 再两两归并，每一轮按缓存大小的输出块并行归并，块的边界用二分查找在两段里定位
+	// 归并需要一块和区间一样大的临时缓冲区，元素需要可以默认构造和移动赋值
+	template<typename RandomIt, typename Compare>
+	void parallel_sort(RandomIt first, RandomIt last, Compare comp)
+	{
+		using T = typename std::iterator_traits<RandomIt>::value_type;
+		size_t count = (size_t)(last - first);
+		size_t piece = bulkLayout(nullptr, sizeof(T), count).chunk;
+		// 每段是归并块的整数倍，归并块不会跨过两段的边界
+		size_t run = (chunkSize(count, 0) + piece - 1) / piece * piece;
+		if (run >= count)
+		{
+			std::sort(first, last, comp);
+			return;
+		}
+
+		auto sortRun = [&](size_t begin, size_t end, size_t)
+		{
+			std::sort(first + begin, first + end, comp);
+		};
+		parallelChunks((size_t)0, count, run, sortRun);
+
+		std::vector<T> buffer(count);
+		bool inBuffer = false;
+		for (; run < count; run *= 2)
+		{
+			if (!inBuffer)
+				mergeRuns(first, buffer.begin(), count, run, piece, comp);
+			else
+				mergeRuns(buffer.begin(), first, count, run, piece, comp);
+			inBuffer = !inBuffer;
+		}
+		if (inBuffer)
+		{
+			auto moveBack = [&](size_t begin, size_t end, size_t)
+			{
+				std::move(buffer.begin() + begin, buffer.begin() + end, first + begin);
+			};
+			parallelChunks((size_t)0, count, piece, moveBack);
+		}
+	}
+
+	template<typename RandomIt>
+	void parallel_sort(RandomIt first, RandomIt last)
+	{
+		parallel_sort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+	}
+
+	// 开启线程池
+	void start(int initThreadSize = std::thread::hardware_concurrency())
+	{
+		if (isShutdown_)
+		{
+			THREADPOOL_LOG_ERROR("thread pool has been shut down, can not start again.");
+			return;
+		}
+
+		// 设置线程池的运行状态
+		isPoolRunning_ = true;
+
+		// 记录初始线程个数
+		initThreadSize_ = initThreadSize;
+		curThreadSize_ = initThreadSize;
+		if (minThreadSize_ < 0)
+		{
+			minThreadSize_ = initThreadSize;
+		}
+
+		// 没有设置自旋时间时用默认值；单核机器上自旋只会占着唯一的CPU，不让提交任务的线程运行，默认不自旋
+		if (idleSpinTime_ < 0)
+		{
+			idleSpinTime_ = std::thread::hardware_concurrency() <= 1 ? 0 : THREAD_SPIN_TIME;
+		}
+
+		// 无锁队列需要在启动时按阈值一次分配好所有槽位
+		if (taskQueMode() == TaskQueMode::MODE_LOCK_FREE)
+		{
+			size_t capacity = taskQueMaxThreshHold_ < LOCK_FREE_QUE_MAX_SIZE
+				? (size_t)taskQueMaxThreshHold_ : (size_t)LOCK_FREE_QUE_MAX_SIZE;
+			for (TaskLane& lane : lanes_)
+			{
+				lane.lockFreeQue = std::make_unique<LockFreeTaskQueue<Task>>(capacity);
+			}
+		}
+
+		// 初始的每个线程一个自己的任务队列，线程内部提交的任务放在这里，线程启动前全部创建好，之后只读
+		// cached模式后来增加的线程没有自己的队列，内部提交的任务走共享队列
+		for (int i = 0; i < initThreadSize_; i++)
+		{
+			workQues_.emplace_back(std::make_unique<WorkStealingQueue<Task>>());
+		}
+
+		// 每个NUMA节点一个任务队列
+		for (int i = 0; i < topology_.nodeSize(); i++)
+		{
+			nodeQues_.emplace_back(std::make_unique<NodeTaskQueue>());
+		}
+
+		// 按绑定方式算出每个线程的CPU和所在节点，线程启动前全部算好，之后只读
+		for (int i = 0; i < initThreadSize_; i++)
+		{
+			int cpu = placeThread(i);
+			workerCpus_.push_back(cpu);
+			workerNodes_.push_back(cpu >= 0 ? topology_.nodeOfCpu(cpu) : -1);
+		}
+
+		// 创建线程对象
+		for (int i = 0; i < initThreadSize_; i++)
+		{
+			// 创建thread线程对象的时候，把线程函数给到thread线程对象
+			auto ptr = createThread(i, workerCpus_[i]);
+			int threadId = ptr->getId();
+			threads_.emplace(threadId, std::move(ptr));
+			// threads_.emplace_back(std::move(ptr));
+		}
+
+		// 启动所有线程  线程id是全局递增的，不一定从0开始，遍历容器启动
+		for (auto& item : threads_)
+		{
+			item.second->start(); // 需要去执行一个线程函数
+		}
+
+		// cached模式由控制线程增加线程，提交任务的线程不用等待创建线程
+		if (poolMode() == PoolMode::MODE_CACHED)
+		{
+			controller_ = std::thread([this]() { controllerFunc(); });
+		}
+	}
+
+	BasicThreadPool(const BasicThreadPool&) = delete;
+	BasicThreadPool& operator=(const BasicThreadPool&) = delete;
+
+private:
+	// 一个优先级的任务队列：普通任务先进先出，带截止时间的任务按截止时间排序
+	struct TaskLane
+	{
+		std::queue<Task> taskQue;                             // 有锁模式下的任务队列，由taskQueMtx_保护
+		std::unique_ptr<LockFreeTaskQueue<Task>> lockFreeQue; // 无锁模式下的任务队列，代替taskQue
+		DeadlineTaskQueue deadlineQue;                        // 带截止时间的任务
+		std::condition_variable notFull;                      // 表示任务队列不满
+		std::atomic_int waitingSubmitSize{ 0 };               // 因为队列满了在等待的提交线程数量
+		std::condition_variable deadlineNotFull;              // 表示带截止时间的任务队列不满，由taskQueMtx_配合等待
+		std::atomic_int waitingDeadlineSize{ 0 };             // 因为带截止时间的任务队列满了在等待的提交线程数量
+		std::atomic_int taskSize{ 0 };                        // 该优先级排队中的任务数量
+		std::atomic_int groupTaskSize{ 0 };                   // 该优先级的执行器组里可以执行的任务数量（不包括受配额限制的），由groupMtx_保护写
+		uint64_t purgeEpoch = 0;                              // 上次清理已取消任务时的CancellationSource::epoch()，由taskQueMtx_保护
+		char padding[CACHE_LINE_SIZE];                        // 相邻优先级的计数不在同一个缓存行
+	};
+
+	// 一个工作线程自己的状态，在线程自己的栈上，只有所属线程写
+	// 每执行一个任务都要改的计数放在这里，执行任务时只写自己的缓存行，不和其它线程争同一个全局计数
+	// 需要总数的地方（waitIdle()、cached模式的控制线程、统计快照）在statsMtx_下遍历累加
+	struct alignas(CACHE_LINE_SIZE) WorkerState
+	{
+		WorkerState(int threadId, int index)
+			: stats(threadId, index)
+		{}
+		WorkerState(const WorkerState&) = delete;
+		WorkerState& operator=(const WorkerState&) = delete;
+
+		// 本线程已经从队列取出、还没有执行完（或者丢弃）的任务数，大于0表示线程正在执行任务
+		// 等待时帮忙执行的任务会再加一；只有所属线程写，读写都不用原子的读改写
+		std::atomic_int runningTaskSize{ 0 };
+		WorkerStats stats; // 统计计数
+	};
+
+	// 一个NUMA节点的任务队列，先进先出
+	struct NodeTaskQueue
+	{
+		WorkStealingQueue<Task> taskQue;
+		std::atomic_int taskSize{ 0 }; // 该节点排队中的任务数量
+		std::condition_variable notFull; // 表示该节点的队列不满，由taskQueMtx_配合等待
+		std::atomic_int waitingSubmitSize{ 0 }; // 因为该节点的队列满了在等待的提交线程数量
+	};
+
+	// 定义线程函数  index是工作窃取模式下线程自己队列的下标，其它模式不使用
+	void threadFunc(int threadid, int index, bool compensating) // 线程池执行该任务，传入该线程的id
+	{
+		TraceRecorder::setThreadId(threadid);
+		currentWorker().pool = this;
+		currentWorker().index = index;
+		currentWorker().node = index >= 0 && index < (int)workerNodes_.size() ? workerNodes_[index] : -1;
+
+		WorkerState state(threadid, index);	// 本线程的状态，统计计数退出时合并到retiredStats_
+		WorkerStats& stats = state.stats;
+		currentWorker().state = &state;
+		currentWorker().stats = &stats;
+		registerWorker(&state);
+
+		Semaphore sem;					// 挂起时等待在自己的信号量上
+		int spinTime = WaitPolicy::spinTime(idleSpinTime_);	// 本次空闲的自旋时间，根据上一次自旋有没有等到任务调整
+		auto lastTime = std::chrono::high_resolution_clock().now();
+
+		// 所有任务必须执行完成，线程池才可以回收所有线程资源
+		while (true)
+		{
+			Task task;  // 类型擦除之后的void()函数对象
+			if (tryGetTask(index, task))
+			{
+				if (discardPending_)
+				{
+					// 关闭时丢弃排队的任务，先析构再算执行完，waitIdle()返回时Future都已经就绪
+					task = Task();
+					cancelledTaskSize_++;
+					finishTask();
+					continue;
+				}
+				// 当前线程负责执行这个任务 task函数对象
+				runTask(task, &stats); // 执行void()函数对象
+				finishTask();
+				lastTime = std::chrono::high_resolution_clock().now(); // 更新线程执行完任务的时间
+				continue;
+			}
+
+			// 线程池要结束，所有任务都取完了，线程函数返回，由shutdown()回收线程资源
+			if (!isPoolRunning_ && taskSize_ <= 0)
+			{
+				unregisterWorker(&state);
+				THREADPOOL_LOG_INFO("threadid:%lld exit!", (long long)threadid);
+				return; // 线程函数结束，线程结束
+			}
+
+			// 补偿线程在阻塞的线程都回来之后退出，补偿线程比阻塞的线程多的部分都可以退出
+			if (compensating && compensateThreadSize_ > blockedThreadSize_)
+			{
+				std::lock_guard<std::mutex> lock(taskQueMtx_);
+				if (isPoolRunning_ && compensateThreadSize_ > blockedThreadSize_)
+				{
+					compensateThreadSize_--;
+					retireThread(threadid, &state);
+					return;
+				}
+			}
+
+			// 先自旋等待一小段时间，突发的小任务不用经历挂起再唤醒
+			// 自旋等到了任务，下次继续按最长时间自旋；白白自旋了，下次自旋时间减半
+			if (spinTime > 0)
+			{
+				if (spinForTask(spinTime))
+				{
+					spinTime = WaitPolicy::spinTime(idleSpinTime_);
+					continue;
+				}
+				spinTime = std::max(spinTime / 2, (WaitPolicy::spinTime(idleSpinTime_) + 7) / 8);
+			}
+
+			// cached模式下，有可能已经创建了很多的线程，但是空闲时间超过threadIdleTimeout_，应该把多余的线程
+			// 结束回收掉（超过minThreadSize_数量的线程要进行回收，并且留下spareThreadSize_个空闲线程）
+			// 挂起时直接等待threadIdleTimeout_，不用每秒醒来检查一次
+			// 补偿线程挂起最多BLOCKING_THREAD_IDLE_TIME，醒来再看能不能退出
+			trace(TraceEventType::TRACE_PARK);
+			bool woken = true;
+			if (compensating)
+				parkThread(sem, true, std::chrono::milliseconds(BLOCKING_THREAD_IDLE_TIME));
+			else
+				woken = parkThread(sem, poolMode() == PoolMode::MODE_CACHED, threadIdleTimeout_.load());
+			trace(TraceEventType::TRACE_UNPARK);
+			if (!woken)
+			{
+				auto now = std::chrono::high_resolution_clock().now();
+				if (now - lastTime >= threadIdleTimeout_.load())
+				{
+					std::unique_lock<std::mutex> lock(taskQueMtx_);
+					// 关闭过程中不自己回收，和其它线程一样在上面退出，shutdown()拿到的线程列表才是完整的
+					if (isPoolRunning_ && curThreadSize_ > minThreadSize_ && idleThreadSize() > spareThreadSize_)
+					{
+						// 开始回收当前线程
+						retireThread(threadid, &state);
+						return;
+					}
+				}
+			}
+		}
+	}
+
+	// 当前线程自己退出：线程不能join自己，把线程对象移到exitedThreads_，由控制线程、阻塞区域或者shutdown()来join
+	// 调用者持有taskQueMtx_
+	void retireThread(int threadid, WorkerState* state)
+	{
+		trace(TraceEventType::TRACE_RECLAIM, (uint64_t)threadid);
+		unregisterWorker(state);
+		auto it = threads_.find(threadid);
+		exitedThreads_.emplace_back(std::move(it->second));
+		threads_.erase(it);
+		curThreadSize_--;
+
+		THREADPOOL_LOG_INFO("threadid:%lld exit!", (long long)threadid);
+	}
+
+	// 取一个任务，成功时taskSize_减一
+	// 顺序：自己的队列 -> 本节点的队列 -> 共享队列 -> 窃取其它线程的队列 -> 其它节点的队列
+	bool tryGetTask(int index, Task& task)
+	{
+		// 先看计数，没有任务时不用去拿锁
+		if (taskSize_ <= 0)
+			return false;
+
+		int node = currentWorker().node;
+		bool success = (index >= 0 && workQues_[index]->tryPop(task))
+			|| popNodeTask(node, task)
+			|| popInjectedTask(task);
+		bool stolen = false;
+		if (!success && (stealTask(index, task) || stealNodeTask(node, task)))
+		{
+			success = stolen = true;
+			if (StatsPolicy::enabled())
+				currentWorker().stats->addSteal();
+			THREADPOOL_LOG_TRACE("thread index:%lld steal task", (long long)index);
+		}
+
+		if (success)
+		{
+			trace(TraceEventType::TRACE_DEQUEUE, stolen ? 1 : 0);
+			// 先记为正在执行再减少排队数量，waitIdle()先读taskSize_再读各线程的计数，不会在两者之间看到线程池空闲
+			// 只有本线程写自己的计数，relaxed就够了：taskSize_--的释放语义保证读到新taskSize_的一方也能读到它
+			std::atomic_int& running = currentWorker().state->runningTaskSize;
+			running.store(running.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			taskSize_--;
+			checkLowWatermark();
+		}
+		return success;
+	}
+
+	// 自旋等待新任务，超过spinTime微秒还没有任务返回false
+	bool spinForTask(int spinTime)
+	{
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spinTime);
+		for (int i = 1; ; i++)
+		{
+			if (taskSize_ > 0 || !isPoolRunning_)
+				return true;
+			cpuRelax();
+			// 取时间也有开销，每自旋一批再检查一次
+			if ((i & 63) == 0 && std::chrono::steady_clock::now() >= deadline)
+				return false;
+		}
+	}
+
+	// 挂起当前线程，直到被提交任务的线程或者析构唤醒；timed为true时最多挂起timeout，超时返回false
+	bool parkThread(Semaphore& sem, bool timed, std::chrono::milliseconds timeout)
+	{
+		WorkerStats* stats = currentWorker().stats;
+		if (StatsPolicy::enabled())
+			stats->addPark();
+		THREADPOOL_LOG_TRACE("thread index:%lld park", (long long)currentWorker().index);
+		{
+			std::lock_guard<std::mutex> lock(idleMtx_);
+			idleStack_.push_back(&sem);
+			idleStackSize_++;
+		}
+
+		// 登记之后再检查一次：提交任务的一方先增加taskSize_再看空闲栈，两边至少有一方能看到对方，不会丢失唤醒
+		if (taskSize_ > 0 || !isPoolRunning_)
+		{
+			// 已经被别的线程弹出了，它在idleMtx_下post过，把这次post消费掉
+			if (!removeIdleThread(&sem))
+				sem.wait();
+			return true;
+		}
+
+		if (!timed)
+		{
+			sem.wait();
+			if (StatsPolicy::enabled())
+				stats->addUnpark();
+			return true;
+		}
+
+		if (sem.waitFor(timeout))
+		{
+			if (StatsPolicy::enabled())
+				stats->addUnpark();
+			return true;
+		}
+		// 超时的同时被唤醒了，按被唤醒处理
+		if (!removeIdleThread(&sem))
+		{
+			sem.wait();
+			return true;
+		}
+		return false;
+	}
+
+	// tryGetTask取到的任务执行完（或者被丢弃），线程池空闲了唤醒waitIdle()
+	void finishTask()
+	{
+		std::atomic_int& running = currentWorker().state->runningTaskSize;
+		int size = running.load(std::memory_order_relaxed) - 1;
+		// seq_cst写，和waitIdle()里的idleWaiterSize_++配对：要么这里看到有人在等，要么等待的一方看到计数已经为0
+		running.store(size, std::memory_order_seq_cst);
+		if (size == 0 && idleWaiterSize_ > 0)
+		{
+			std::lock_guard<std::mutex> lock(idleWaitMtx_);
+			if (isIdle())
+				idleWaitCond_.notify_all();
+		}
+	}
+
+	// 没有排队的任务，也没有正在执行的任务
+	bool isIdle()
+	{
+		return taskSize_ <= 0 && busyThreadSize() == 0;
+	}
+
+	// 正在执行任务的线程数量，遍历各线程的状态累加
+	int busyThreadSize()
+	{
+		std::lock_guard<std::mutex> lock(statsMtx_);
+		return busyThreadSizeLocked();
+	}
+
+	// 调用者持有statsMtx_
+	int busyThreadSizeLocked() const
+	{
+		int size = 0;
+		for (WorkerState* state : workerStates_)
+		{
+			if (state->runningTaskSize.load(std::memory_order_relaxed) > 0)
+				size++;
+		}
+		return size;
+	}
+
+	// 空闲线程的数量：刚创建、还没有登记状态的线程也算空闲
+	int idleThreadSize()
+	{
+		return std::max(curThreadSize_ - busyThreadSize(), 0);
+	}
+
+	// 等待所有线程返回并回收线程对象，调用线程需要持有shutdownMtx_
+	void joinThreads()
+	{
+		// 控制线程已经停了，cached模式的线程在关闭过程中也不会自己回收，线程列表不会再变
+		std::vector<std::unique_ptr<Thread>> threads;
+		{
+			std::lock_guard<std::mutex> lock(taskQueMtx_);
+			for (auto& item : threads_)
+			{
+				threads.emplace_back(std::move(item.second));
+			}
+			threads_.clear();
+			for (auto& thread : exitedThreads_)
+			{
+				threads.emplace_back(std::move(thread));
+			}
+			exitedThreads_.clear();
+		}
+		for (auto& thread : threads)
+		{
+			thread->join();
+		}
+	}
+
+	// 回收cached模式下已经自己退出的线程（以及退出的补偿线程），由控制线程定期调用，进入阻塞区域时也会调用
+	void reapExitedThreads()
+	{
+		std::vector<std::unique_ptr<Thread>> threads;
+		{
+			std::lock_guard<std::mutex> lock(taskQueMtx_);
+			threads.swap(exitedThreads_);
+		}
+		// 线程放进exitedThreads_之后只剩下返回，这里join不会等多久
+		for (auto& thread : threads)
+		{
+			thread->join();
+		}
+	}
+
+	// 执行一个任务，记录执行时间
+	void runTask(Task& task, WorkerStats* stats)
+	{
+		if (!StatsPolicy::enabled())
+		{
+			task();
+			return;
+		}
+		trace(TraceEventType::TRACE_RUN_BEGIN);
+		auto begin = std::chrono::steady_clock::now();
+		task();
+		stats->recordRunTime(elapsedNanos(begin));
+		stats->addExecuted();
+		trace(TraceEventType::TRACE_RUN_END);
+	}
+
+	// 记录一个跟踪事件，没有开始跟踪时只读一次标志
+	void trace(TraceEventType type, uint64_t arg = 0)
+	{
+		if (StatsPolicy::enabled() && traceEnabled_.load(std::memory_order_relaxed))
+			TraceRecorder::instance().record(this, type, arg);
+	}
+
+	// 获取taskQueMtx_，跟踪时记录有竞争的等锁时间
+	std::unique_lock<std::mutex> lockTaskQue()
+	{
+		if (!StatsPolicy::enabled() || !traceEnabled_.load(std::memory_order_relaxed))
+			return std::unique_lock<std::mutex>(taskQueMtx_);
+		std::unique_lock<std::mutex> lock(taskQueMtx_, std::try_to_lock);
+		if (!lock.owns_lock())
+		{
+			trace(TraceEventType::TRACE_LOCK_BEGIN);
+			lock.lock();
+			trace(TraceEventType::TRACE_LOCK_END);
+		}
+		return lock;
+	}
+
+	// 从begin到现在经过的纳秒数
+	static uint64_t elapsedNanos(std::chrono::steady_clock::time_point begin)
+	{
+		auto dur = std::chrono::steady_clock::now() - begin;
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count();
+	}
+
+	// 提交任务的时间，不统计的配置不读时钟
+	static std::chrono::steady_clock::time_point submitClock()
+	{
+		return StatsPolicy::enabled() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+	}
+
+	// 任务开始执行时记录它在队列中等待的时间，不是线程池的线程执行时不记录
+	static void recordQueueWait(std::chrono::steady_clock::time_point submitTime)
+	{
+		WorkerStats* stats = currentWorker().stats;
+		if (StatsPolicy::enabled() && stats != nullptr)
+			stats->recordQueueWait(elapsedNanos(submitTime));
+	}
+
+	void registerWorker(WorkerState* state)
+	{
+		std::lock_guard<std::mutex> lock(statsMtx_);
+		workerStates_.push_back(state);
+	}
+
+	// 线程退出前把自己的计数合并到retiredStats_，快照的汇总不会因为线程回收而变小
+	void unregisterWorker(WorkerState* state)
+	{
+		std::lock_guard<std::mutex> lock(statsMtx_);
+		retiredStats_.merge(state->stats.snapshot());
+		workerStates_.erase(std::find(workerStates_.begin(), workerStates_.end(), state));
+		currentWorker().state = nullptr;
+		currentWorker().stats = nullptr;
+	}
+
+	// 自己从空闲栈中移除，已经被别的线程弹出了返回false
+	bool removeIdleThread(Semaphore* sem)
+	{
+		std::lock_guard<std::mutex> lock(idleMtx_);
+		auto it = std::find(idleStack_.begin(), idleStack_.end(), sem);
+		if (it == idleStack_.end())
+			return false;
+		idleStack_.erase(it);
+		idleStackSize_--;
+		return true;
+	}
+
+	// 最多唤醒count个挂起的线程，后进先出，最近挂起的线程缓存还是热的
+	// 没有挂起的线程就什么都不做，正在执行任务或者自旋的线程会自己取到任务
+	void wakeIdleThreads(size_t count)
+	{
+		if (count == 0 || idleStackSize_ == 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(idleMtx_);
+		while (count > 0 && !idleStack_.empty())
+		{
+			Semaphore* sem = idleStack_.back();
+			idleStack_.pop_back();
+			idleStackSize_--;
+			sem->post(); // 持有idleMtx_时post，线程从栈中移除自己之后就不会再有人访问它的信号量
+			count--;
+		}
+	}
+
+	// 唤醒所有挂起的线程
+	void wakeAllIdleThreads()
+	{
+		std::lock_guard<std::mutex> lock(idleMtx_);
+		for (Semaphore* sem : idleStack_)
+		{
+			sem->post();
+		}
+		idleStack_.clear();
+		idleStackSize_ = 0;
+	}
+
+	// 定时器到期的任务放入队列，和外部线程提交一样按线程池的策略处理，POLICY_BLOCK下队列满了定时线程也会等
+	void dispatchTimerTask(Task& task)
+	{
+		if (!pushTask(task))
+			THREADPOOL_LOG_WARN("task queue is full, timer task dropped.");
+	}
+
+	// 把一个任务放入队列，队列满了按线程池的策略处理，提交失败返回false
+	bool pushTask(Task& task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+	{
+		return pushTasks(&task, 1, priority) == 1;
+	}
+
+	bool pushTask(Task& task, TaskPriority priority, BackpressurePolicy policy)
+	{
+		return pushTasks(&task, 1, priority, policy) == 1;
+	}
+
+	// 把count个任务放入对应优先级的队列，返回成功放入（或者由调用线程执行）的个数，队列满了按policy处理
+	// 整批任务只获取一次锁，唤醒的线程数不超过任务数，cached模式整批只判断一次要不要创建线程
+	size_t pushTasks(Task* tasks, size_t count, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+	{
+		return pushTasks(tasks, count, priority, backpressurePolicy_);
+	}
+
+	size_t pushTasks(Task* tasks, size_t count, TaskPriority priority, BackpressurePolicy policy)
+	{
+		// 关闭之后外部线程提交的任务一个都放不进去
+		if (!isAcceptingTasks())
+			return rejectTasks(tasks, 0, count, policy);
+		trace(TraceEventType::TRACE_SUBMIT, count);
+
+		// 线程池自己的线程提交的普通任务直接放入该线程自己的队列，只加这个队列自己的锁，不获取全局的taskQueMtx_
+		// 自己的队列也受队列阈值限制，放不下的走下面的共享队列，共享队列也满了按policy处理
+		// 其它线程都在忙的时候空闲栈是空的，唤醒只是读一次计数
+		size_t local = 0;
+		if (priority == TaskPriority::PRIORITY_NORMAL
+			&& currentWorker().pool == this
+			&& currentWorker().index >= 0)
+		{
+			local = workQues_[currentWorker().index]->pushBatch(tasks, count, (size_t)taskQueMaxThreshHold_);
+			if (local > 0)
+			{
+				taskSize_ += (int)local;
+				wakeIdleThreads(local);
+			}
+			if (local == count)
+			{
+				checkHighWatermark();
+				return count;
+			}
+		}
+
+		TaskLane& lane = lanes_[(int)priority];
+		size_t pushed = local;
+		if (taskQueMode() == TaskQueMode::MODE_LOCK_FREE)
+		{
+			// 无锁队列：一次CAS占住一段连续的空槽位
+			while (pushed < count)
+			{
+				size_t size = lane.lockFreeQue->tryPushBatch(tasks + pushed, count - pushed);
+				if (size == 0)
+				{
+					if (policy == BackpressurePolicy::POLICY_DROP_OLDEST)
+					{
+						// 丢掉最早的一个任务再重试，这期间被别的线程取走了也一样有了空位
+						dropLockFreeTask(lane);
+						continue;
+					}
+					// 队列满了，等待之前已经唤醒了线程去取任务
+					if (policy != BackpressurePolicy::POLICY_BLOCK || !pushLockFreeTask(lane, tasks[pushed]))
+						break;
+					size = 1;
+				}
+				pushed += size;
+				lane.taskSize += (int)size;
+				taskSize_ += (int)size;
+				wakeIdleThreads(size);
+			}
+		}
+		else
+		{
+			// 外部线程提交的任务放入共享的任务队列（工作窃取模式下作为注入队列）
+			size_t unwoken = 0; // 已经放入、还没有唤醒线程的任务数
+			std::vector<Task> dropped; // 被丢弃的任务放到锁外面析构
+			std::vector<Task> cancelled; // 清掉的已取消任务放到锁外面执行，让Future得到TaskCancelledError
+			std::unique_lock<std::mutex> lock = lockTaskQue();
+			while (pushed < count)
+			{
+				if (lane.taskQue.size() >= (size_t)taskQueMaxThreshHold_)
+				{
+					// 先清掉已经取消的任务，腾出位置
+					if (purgeCancelledTasks(lane, cancelled) > 0)
+					{
+						lane.notFull.notify_all();
+						continue;
+					}
+					if (policy == BackpressurePolicy::POLICY_DROP_OLDEST)
+					{
+						dropped.emplace_back(std::move(lane.taskQue.front()));
+						lane.taskQue.pop();
+						lane.taskSize--;
+						taskSize_--;
+						droppedTaskSize_++;
+					}
+					else
+					{
+						if (policy != BackpressurePolicy::POLICY_BLOCK)
+							break;
+						// 用户提交任务，最长阻塞submitTimeout_，否则判断提交任务失败，返回
+						// 等待之前先唤醒线程去取已经放入的任务，否则没有人腾出空位
+						wakeIdleThreads(unwoken);
+						unwoken = 0;
+						lane.waitingSubmitSize++;
+						bool success = lane.notFull.wait_for(lock, submitTimeout_,
+							[&]()->bool { return lane.taskQue.size() < (size_t)taskQueMaxThreshHold_ || !isAcceptingTasks(); });
+						lane.waitingSubmitSize--;
+						if (!success || !isAcceptingTasks())
+							break;
+					}
+				}
+
+				// 如果有空余，把任务放入任务队列中，能放多少放多少
+				size_t size = std::min(count - pushed, (size_t)taskQueMaxThreshHold_ - lane.taskQue.size());
+				for (size_t i = 0; i < size; i++)
+				{
+					lane.taskQue.emplace(std::move(tasks[pushed + i]));
+				}
+				pushed += size;
+				unwoken += size;
+				lane.taskSize += (int)size;
+				taskSize_ += (int)size;
+			}
+			lock.unlock();
+
+			// 因为新放了任务，任务队列肯定不空了，唤醒挂起的线程来执行任务
+			wakeIdleThreads(unwoken);
+
+			// 已取消的任务执行时只会写入TaskCancelledError
+			for (Task& task : cancelled)
+			{
+				task();
+			}
+		}
+
+		growThreads(pushed - local);
+		checkHighWatermark();
+
+		return rejectTasks(tasks, pushed, count, policy);
+	}
+
+	// 处理没能放入队列的tasks[pushed, count)，返回成功放入（或者由调用线程执行）的个数
+	size_t rejectTasks(Task* tasks, size_t pushed, size_t count, BackpressurePolicy policy)
+	{
+		if (pushed < count)
+		{
+			if (policy == BackpressurePolicy::POLICY_CALLER_RUNS)
+			{
+				// 放不进去的任务由提交任务的线程自己执行
+				for (size_t i = pushed; i < count; i++)
+				{
+					tasks[i]();
+				}
+				callerRunsTaskSize_ += count - pushed;
+				return count;
+			}
+			rejectedTaskSize_ += count - pushed;
+		}
+		return pushed;
+	}
+
+	// 还没有关闭，或者是线程池自己的线程在关闭过程中提交任务
+	bool isAcceptingTasks() const
+	{
+		return !isShutdown_ || currentWorker().pool == this;
+	}
+
+	// 放入不在普通任务队列里的任务（带截止时间的任务、节点队列的任务），tryPush在队列满了时返回false，dropOldest丢掉队列里最早的一个任务
+	// 队列满了和普通任务一样处理：POLICY_DROP_OLDEST丢掉最早的再放，POLICY_BLOCK最长等待submitTimeout_，其它直接返回false
+	// 等待时和普通任务一样配合taskQueMtx_，取任务的线程取完之后用notifyNotFull通知
+	template<typename TryPush, typename DropOldest>
+	bool pushBoundedTask(BackpressurePolicy policy, std::condition_variable& notFull, std::atomic_int& waitingSubmitSize,
+		TryPush& tryPush, DropOldest& dropOldest)
+	{
+		bool pushed = tryPush();
+		while (!pushed && policy == BackpressurePolicy::POLICY_DROP_OLDEST)
+		{
+			dropOldest();
+			pushed = tryPush();
+		}
+		if (!pushed && policy == BackpressurePolicy::POLICY_BLOCK)
+		{
+			// 先加等待计数再试：取任务的线程要么在队列的锁里看到计数，要么这里看到空出来的位置
+			std::unique_lock<std::mutex> lock(taskQueMtx_);
+			waitingSubmitSize++;
+			notFull.wait_for(lock, submitTimeout_,
+				[&]()->bool { return !isAcceptingTasks() || (pushed = tryPush()); });
+			waitingSubmitSize--;
+		}
+		return pushed;
+	}
+
+	// 从带截止时间或者节点的队列取出一个任务之后，有提交线程在等待空位时通知
+	void notifyNotFull(std::condition_variable& notFull, std::atomic_int& waitingSubmitSize)
+	{
+		if (waitingSubmitSize > 0)
+		{
+			std::lock_guard<std::mutex> lock(taskQueMtx_);
+			notFull.notify_one();
+		}
+	}
+
+	// 放入带截止时间的任务，按截止时间排序；每个优先级的截止时间队列也按taskQueMaxThreshHold_限制，满了按policy处理
+	// 返回成功放入（或者由调用线程执行）
+	bool pushDeadlineTask(Task& task, TaskPriority priority, std::chrono::steady_clock::time_point deadline, BackpressurePolicy policy)
+	{
+		if (!isAcceptingTasks())
+			return rejectTasks(&task, 0, 1, policy) == 1;
+		TaskLane& lane = lanes_[(int)priority];
+		auto tryPush = [&]()->bool { return lane.deadlineQue.tryPush(deadline, task, (size_t)taskQueMaxThreshHold_); };
+		auto dropOldest = [&]()
+		{
+			Task dropped;
+			if (!lane.deadlineQue.tryPopOldest(dropped))
+				return;
+			deadlineTaskSize_--;
+			lane.taskSize--;
+			taskSize_--;
+			droppedTaskSize_++;
+		};
+		if (!pushBoundedTask(policy, lane.deadlineNotFull, lane.waitingDeadlineSize, tryPush, dropOldest))
+			return rejectTasks(&task, 0, 1, policy) == 1;
+		deadlineTaskSize_++;
+		lane.taskSize++;
+		taskSize_++;
+		wakeIdleThreads(1);
+		growThreads(1);
+		checkHighWatermark();
+		return true;
+	}
+
+	// 丢掉无锁队列中最早的一个任务，任务的Future会抛出broken_promise
+	void dropLockFreeTask(TaskLane& lane)
+	{
+		Task task;
+		if (!lane.lockFreeQue->tryPop(task))
+			return;
+		lane.taskSize--;
+		taskSize_--;
+		droppedTaskSize_++;
+	}
+
+	// 排队的任务数达到高水位时通知一次，降到低水位以下之前不再通知
+	void checkHighWatermark()
+	{
+		if (highWatermark_ > 0
+			&& !overloaded_.load(std::memory_order_relaxed)
+			&& taskSize_ >= highWatermark_
+			&& !overloaded_.exchange(true))
+		{
+			watermarkCallback_(true);
+		}
+	}
+
+	// 排队的任务数降到低水位时通知一次
+	void checkLowWatermark()
+	{
+		if (overloaded_.load(std::memory_order_relaxed)
+			&& taskSize_ <= lowWatermark_
+			&& overloaded_.exchange(false))
+		{
+			watermarkCallback_(false);
+		}
+	}
+
+	// cached模式的线程数量控制线程：每隔CONTROLLER_INTERVAL检查一次，有任务积压时也会被提前唤醒
+	// 任务积压并且最近的排队时间超过growLatency_时，按积压的任务数分步增加线程，每次最多翻倍；
+	// 空闲线程少于spareThreadSize_或者线程总数少于minThreadSize_时补足。线程的回收由空闲线程自己判断
+	void controllerFunc()
+	{
+		uint64_t lastCount = 0;
+		uint64_t lastSum = 0;
+		while (isPoolRunning_)
+		{
+			controllerSem_.waitFor(std::chrono::milliseconds(CONTROLLER_INTERVAL));
+			controllerWakeup_ = false;
+			if (!isPoolRunning_)
+				break;
+			reapExitedThreads();
+
+			// 这段时间里开始执行的任务的平均排队时间
+			uint64_t count = 0;
+			uint64_t sum = 0;
+			queueWaitTotal(count, sum);
+			uint64_t waitCount = count - lastCount;
+			uint64_t avgWait = waitCount == 0 ? 0 : (sum - lastSum) / waitCount;
+			lastCount = count;
+			lastSum = sum;
+
+			int cur = curThreadSize_;
+			int idle = idleThreadSize();
+			int backlog = taskSize_ - idle;
+			int size = 0;
+			// 有积压的时候，要么排队时间太长，要么这段时间一个任务都没开始执行（线程都卡在长任务上）
+			if (backlog > 0 && (waitCount == 0
+				|| avgWait >= (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(growLatency_.load()).count()))
+			{
+				size = std::min(backlog, std::max(cur, 1));
+			}
+			size = std::max(size, spareThreadSize_ - idle);
+			size = std::max(size, minThreadSize_ - cur);
+			size = std::min(size, threadSizeThreshHold_ - cur);
+			if (size <= 0)
+				continue;
+
+			std::unique_lock<std::mutex> lock(taskQueMtx_);
+			for (int i = 0; i < size && isPoolRunning_ && curThreadSize_ < threadSizeThreshHold_; i++)
+			{
+				THREADPOOL_LOG_INFO(">>> create new thread...");
+				addThread();
+			}
+		}
+	}
+
+	// 所有线程（包括已经退出的）记录的排队次数和排队总时间
+	void queueWaitTotal(uint64_t& count, uint64_t& sum)
+	{
+		std::lock_guard<std::mutex> lock(statsMtx_);
+		count = retiredStats_.queueWait.count;
+		sum = retiredStats_.queueWait.sum;
+		for (WorkerState* state : workerStates_)
+		{
+			uint64_t workerCount = 0;
+			uint64_t workerSum = 0;
+			state->stats.queueWaitTotal(workerCount, workerSum);
+			count += workerCount;
+			sum += workerSum;
+		}
+	}
+
+	// cached模式 任务处理比较紧急 场景：小而快的任务 需要根据任务数量和空闲线程的数量，判断是否需要创建新的线程出来
+	// 提交任务的线程不创建线程，只在任务积压时提前唤醒控制线程，每个检查周期只唤醒一次
+	// 这里空闲线程的数量用挂起的线程数估计，不用遍历各线程的状态，控制线程醒来之后再准确判断
+	void growThreads(size_t count)
+	{
+		if (poolMode() != PoolMode::MODE_CACHED
+			|| count == 0
+			|| taskSize_ <= idleStackSize_
+			|| curThreadSize_ >= threadSizeThreshHold_
+			|| controllerWakeup_.load(std::memory_order_relaxed)
+			|| controllerWakeup_.exchange(true))
+			return;
+		trace(TraceEventType::TRACE_GROW, (uint64_t)std::max(taskSize_ - idleStackSize_, 0));
+		controllerSem_.post();
+	}
+
+	// 把任务放入无锁队列，队列满了和有锁队列一样最长等待submitTimeout_
+	bool pushLockFreeTask(TaskLane& lane, Task& task)
+	{
+		if (lane.lockFreeQue->tryPush(task))
+			return true;
+
+		std::unique_lock<std::mutex> lock(taskQueMtx_);
+		lane.waitingSubmitSize++;
+		// 和popLockFreeTask里的fence配对：要么这里看到空出来的槽位，要么取任务的线程看到有人在等待
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool pushed = false;
+		lane.notFull.wait_for(lock, submitTimeout_,
+			[&]()->bool { return !isAcceptingTasks() || (pushed = lane.lockFreeQue->tryPush(task)); });
+		lane.waitingSubmitSize--;
+		return pushed;
+	}
+
+	// 从无锁队列取一个任务，有提交任务的线程在等待空位时才通知notFull
+	bool popLockFreeTask(TaskLane& lane, Task& task)
+	{
+		if (!lane.lockFreeQue->tryPop(task))
+			return false;
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (lane.waitingSubmitSize > 0)
+		{
+			std::unique_lock<std::mutex> lock(taskQueMtx_);
+			lane.notFull.notify_one();
+		}
+		return true;
+	}
+
+	// 从共享的任务队列取一个外部提交的任务
+	// 截止时间已经到了的任务最先执行，其次按优先级从高到低；
+	// 每取PRIORITY_STARVATION_INTERVAL个任务，有一次先从低优先级的队列开始取，低优先级的任务不会被饿死
+	bool popInjectedTask(Task& task)
+	{
+		if (deadlineTaskSize_ > 0 && popDueDeadlineTask(task))
+			return true;
+
+		int start = 0;
+		unsigned count = ++currentWorker().popCount;
+		if (count % PRIORITY_STARVATION_INTERVAL == 0)
+		{
+			start = 1 + (int)(count / PRIORITY_STARVATION_INTERVAL) % (TASK_PRIORITY_SIZE - 1);
+		}
+
+		// 同一个优先级先取直接提交的任务，再取执行器组的任务
+		for (int i = 0; i < TASK_PRIORITY_SIZE; i++)
+		{
+			int priority = (start + i) % TASK_PRIORITY_SIZE;
+			if (popLaneTask(lanes_[priority], task) || popGroupTask(priority, task))
+				return true;
+		}
+		return false;
+	}
+
+	// 从一个优先级的执行器组里取任务：在有任务可执行（有排队的任务、没有用完配额）的组里选虚拟时间最小的
+	// 组的数量一般很少，直接遍历
+	bool popGroupTask(int priority, Task& task)
+	{
+		TaskLane& lane = lanes_[priority];
+		if (lane.groupTaskSize <= 0)
+			return false;
+
+		std::lock_guard<std::mutex> lock(groupMtx_);
+		ExecutorGroupState* best = nullptr;
+		for (auto& group : groups_)
+		{
+			if ((int)group->config.priority != priority || group->taskQue.empty())
+				continue;
+			if (group->config.maxConcurrency > 0 && group->runningSize >= group->config.maxConcurrency)
+				continue;
+			if (best == nullptr || group->pass < best->pass)
+				best = group.get();
+		}
+		if (best == nullptr)
+			return false;
+
+		task = std::move(best->taskQue.front());
+		best->taskQue.pop_front();
+		best->runningSize++;
+		groupVirtualTime_ = best->pass;
+		best->pass += GROUP_STRIDE / best->config.weight;
+		lane.groupTaskSize--;
+		return true;
+	}
+
+	// 从一个优先级的队列取任务，带截止时间的任务先取
+	bool popLaneTask(TaskLane& lane, Task& task)
+	{
+		// 先看计数，空队列不用去拿锁
+		if (lane.taskSize <= 0)
+			return false;
+
+		bool success;
+		if (lane.deadlineQue.tryPop(task))
+		{
+			deadlineTaskSize_--;
+			notifyNotFull(lane.deadlineNotFull, lane.waitingDeadlineSize);
+			success = true;
+		}
+		else if (taskQueMode() == TaskQueMode::MODE_LOCK_FREE)
+		{
+			success = popLockFreeTask(lane, task);
+		}
+		else
+		{
+			std::unique_lock<std::mutex> lock = lockTaskQue();
+			success = !lane.taskQue.empty();
+			if (success)
+			{
+				// 从任务队列中取一个任务出来
+				task = std::move(lane.taskQue.front());
+				lane.taskQue.pop();
+
+				// 取出一个任务，空出一个位置，有提交任务的线程在等待时才通知
+				if (lane.waitingSubmitSize > 0)
+					lane.notFull.notify_one();
+			}
+		}
+
+		if (success)
+			lane.taskSize--;
+		return success;
+	}
+
+	// 取一个截止时间已经到了的任务，不管它是什么优先级
+	bool popDueDeadlineTask(Task& task)
+	{
+		auto now = std::chrono::steady_clock::now();
+		for (TaskLane& lane : lanes_)
+		{
+			if (lane.deadlineQue.isDue(now) && lane.deadlineQue.tryPop(task))
+			{
+				deadlineTaskSize_--;
+				lane.taskSize--;
+				notifyNotFull(lane.deadlineNotFull, lane.waitingDeadlineSize);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 线程进入阻塞区域：还有挂起的线程就由它们接手任务；否则在线程数量上限以内创建一个补偿线程，
+	// 补偿线程的数量不超过阻塞的线程数，阻塞的线程都回来之后补偿线程空闲时在threadFunc里退出
+	void enterBlocking()
+	{
+		blockedThreadSize_++;
+		if (idleStackSize_ > 0 || !isPoolRunning_)
+			return;
+
+		// fixed模式没有控制线程，之前退出的补偿线程在这里回收
+		reapExitedThreads();
+		std::lock_guard<std::mutex> lock(taskQueMtx_);
+		if (!isPoolRunning_
+			|| curThreadSize_ >= threadSizeThreshHold_
+			|| compensateThreadSize_ >= blockedThreadSize_)
+			return;
+		compensateThreadSize_++;
+		THREADPOOL_LOG_INFO(">>> create compensating thread...");
+		addThread(true);
+	}
+
+	void leaveBlocking()
+	{
+		if (--currentWorker().blockingDepth == 0)
+			blockedThreadSize_--;
+	}
+
+	// 放入执行器组的队列，组的队列满了或者已经关闭时返回false
+	// 配额用完时任务只在组里排队，不计入taskSize_，不会唤醒线程
+	bool pushGroupTask(ExecutorGroupState* group, Task& task)
+	{
+		if (!isAcceptingTasks())
+		{
+			rejectedTaskSize_++;
+			THREADPOOL_LOG_WARN("thread pool has been shut down, submit task fail.");
+			return false;
+		}
+
+		TaskLane& lane = lanes_[(int)group->config.priority];
+		bool runnable;
+		{
+			std::lock_guard<std::mutex> lock(groupMtx_);
+			if ((int)group->taskQue.size() >= group->config.maxQueueSize)
+			{
+				rejectedTaskSize_++;
+				THREADPOOL_LOG_WARN("executor group queue is full, submit task fail.");
+				return false;
+			}
+			// 组从空闲变成有任务时追上当前的虚拟时间，空闲期间不能攒下份额
+			if (group->taskQue.empty() && group->runningSize == 0)
+				group->pass = std::max(group->pass, groupVirtualTime_);
+			runnable = group->config.maxConcurrency <= 0
+				|| (int)group->taskQue.size() < group->config.maxConcurrency - group->runningSize;
+			group->taskQue.push_back(std::move(task));
+			if (runnable)
+				lane.groupTaskSize++;
+		}
+
+		if (runnable)
+		{
+			taskSize_++;
+			wakeIdleThreads(1);
+			growThreads(1);
+			checkHighWatermark();
+		}
+		return true;
+	}
+
+	// 执行器组的任务执行完，空出一个配额；有因为配额在排队的任务就变成可以执行
+	void finishGroupTask(ExecutorGroupState* group)
+	{
+		bool runnable;
+		{
+			std::lock_guard<std::mutex> lock(groupMtx_);
+			group->runningSize--;
+			runnable = group->config.maxConcurrency > 0
+				&& (int)group->taskQue.size() >= group->config.maxConcurrency - group->runningSize;
+			if (runnable)
+				lanes_[(int)group->config.priority].groupTaskSize++;
+		}
+
+		if (runnable)
+		{
+			taskSize_++;
+			wakeIdleThreads(1);
+		}
+	}
+
+	// 关闭时丢弃执行器组里排队的任务，包括因为配额还不能执行的
+	void discardGroupTasks()
+	{
+		std::vector<Task> dropped; // 放到锁外面析构
+		{
+			std::lock_guard<std::mutex> lock(groupMtx_);
+			for (TaskLane& lane : lanes_)
+			{
+				taskSize_ -= lane.groupTaskSize.exchange(0);
+			}
+			for (auto& group : groups_)
+			{
+				for (Task& task : group->taskQue)
+				{
+					dropped.emplace_back(std::move(task));
+				}
+				group->taskQue.clear();
+			}
+		}
+		cancelledTaskSize_ += dropped.size();
+	}
+
+	// 放入指定节点的任务队列，每个节点的队列也按taskQueMaxThreshHold_限制，满了按policy处理
+	// 返回成功放入（或者由调用线程执行）
+	bool pushNodeTask(Task& task, int node, BackpressurePolicy policy)
+	{
+		if (!isAcceptingTasks())
+			return rejectTasks(&task, 0, 1, policy) == 1;
+		NodeTaskQueue& que = *nodeQues_[node];
+		auto tryPush = [&]()->bool { return que.taskQue.pushBatch(&task, 1, (size_t)taskQueMaxThreshHold_) == 1; };
+		auto dropOldest = [&]()
+		{
+			Task dropped;
+			if (!que.taskQue.trySteal(dropped))
+				return;
+			que.taskSize--;
+			nodeTaskSize_--;
+			taskSize_--;
+			droppedTaskSize_++;
+		};
+		if (!pushBoundedTask(policy, que.notFull, que.waitingSubmitSize, tryPush, dropOldest))
+			return rejectTasks(&task, 0, 1, policy) == 1;
+		que.taskSize++;
+		nodeTaskSize_++;
+		taskSize_++;
+		wakeIdleThreads(1);
+		growThreads(1);
+		checkHighWatermark();
+		return true;
+	}
+
+	// 从指定节点的队列按提交顺序取一个任务
+	bool popNodeTask(int node, Task& task)
+	{
+		if (node < 0 || nodeTaskSize_ <= 0)
+			return false;
+		NodeTaskQueue& que = *nodeQues_[node];
+		if (que.taskSize <= 0 || !que.taskQue.trySteal(task))
+			return false;
+		que.taskSize--;
+		nodeTaskSize_--;
+		notifyNotFull(que.notFull, que.waitingSubmitSize);
+		return true;
+	}
+
+	// 本节点没有任务时，从其它节点的队列取，从下一个节点开始轮询
+	bool stealNodeTask(int node, Task& task)
+	{
+		if (nodeTaskSize_ <= 0)
+			return false;
+		int size = static_cast<int>(nodeQues_.size());
+		int start = node < 0 ? 0 : node + 1;
+		for (int i = 0; i < size; i++)
+		{
+			int other = (start + i) % size;
+			if (other != node && popNodeTask(other, task))
+				return true;
+		}
+		return false;
+	}
+
+	// 第index个线程要绑定的CPU，-1表示不绑定
+	int placeThread(int index) const
+	{
+		switch (affinityMode_)
+		{
+		case AffinityMode::AFFINITY_COMPACT:
+		{
+			// 把所有节点的CPU按节点顺序排成一列，依次分配
+			int total = 0;
+			for (int node = 0; node < topology_.nodeSize(); node++)
+				total += (int)topology_.nodeCpus(node).size();
+			int pos = index % total;
+			for (int node = 0; node < topology_.nodeSize(); node++)
+			{
+				const std::vector<int>& cpus = topology_.nodeCpus(node);
+				if (pos < (int)cpus.size())
+					return cpus[pos];
+				pos -= (int)cpus.size();
+			}
+			return -1;
+		}
+		case AffinityMode::AFFINITY_SCATTER:
+		{
+			int nodeSize = topology_.nodeSize();
+			const std::vector<int>& cpus = topology_.nodeCpus(index % nodeSize);
+			return cpus[(index / nodeSize) % cpus.size()];
+		}
+		case AffinityMode::AFFINITY_EXPLICIT:
+			return affinityCpus_.empty() ? -1 : affinityCpus_[index % affinityCpus_.size()];
+		default:
+			return -1;
+		}
+	}
+
+	// 从其它线程的队列窃取一个任务，从下一个线程开始轮询，避免所有线程都去偷同一个队列
+	// 没有自己队列的线程（index为-1）每次换一个起点
+	bool stealTask(int index, Task& task)
+	{
+		int size = static_cast<int>(workQues_.size());
+		if (size == 0)
+			return false;
+		int start = index >= 0 ? index + 1 : (int)(currentWorker().stealStart++ % (unsigned)size);
+		for (int i = 0; i < size; i++)
+		{
+			int victim = (start + i) % size;
+			if (victim != index && workQues_[victim]->trySteal(task))
+				return true;
+		}
+		return false;
+	}
+
+	// 创建线程对象，index是线程的下标（工作窃取模式下也是线程自己队列的下标），cpu是要绑定的CPU
+	// compensating表示是阻塞区域创建的补偿线程
+	std::unique_ptr<Thread> createThread(int index, int cpu = -1, bool compensating = false)
+	{
+		return std::make_unique<Thread>([this, index, compensating](int threadid) { threadFunc(threadid, index, compensating); }, cpu);
+	}
+
+	// cached模式下增加一个线程（或者阻塞区域的补偿线程），调用者需要持有taskQueMtx_
+	void addThread(bool compensating = false)
+	{
+		// 创建新的线程对象
+		auto ptr = createThread(-1, -1, compensating);
+		int threadId = ptr->getId();
+		trace(TraceEventType::TRACE_SPAWN, (uint64_t)threadId);
+		threads_.emplace(threadId, std::move(ptr));
+		// 启动线程
+		threads_[threadId]->start();
+		// 修改线程个数相关的变量
+		curThreadSize_++;
+	}
+
+	// 把函数和参数打包成Task，对应的结果交给result，result上挂的后续任务调度到这个线程池
+	template<typename RType, typename Func, typename... Args>
+	Task packageTask(Future<RType>& result, Func&& func, Args&&... args)
+	{
+		// 前面的任务可能是 int() test(), 或者 double()  test() 任务，Task 对它进行封装，全部封装成void()
+		// lambda足够小的话直接放在Task内部的缓冲区，否则放在SlabAllocator分配的内存上
+		return Task(packageCall(result, std::forward<Func>(func), std::forward<Args>(args)...));
+	}
+
+	// 把函数和参数打包成可调用对象，对应的结果交给result
+	template<typename RType, typename Func, typename... Args>
+	auto packageCall(Future<RType>& result, Func&& func, Args&&... args)
+	{
+		// 结果状态由返回的Future和任务里的Promise共同持有，引用计数在状态内部，不需要shared_ptr
+		auto state = new FutureState<RType>();
+		result = Future<RType>(state, continuationPool());
+
+		// 函数和参数按值保存在lambda里面，调用时和std::bind一样以左值传入
+		// 同时记下提交的时间，用来统计任务在队列中等待的时间
+		return [promise = Promise<RType>(state), func = std::forward<Func>(func),
+			args = std::make_tuple(std::forward<Args>(args)...),
+			submitTime = submitClock()]() mutable
+		{
+			recordQueueWait(submitTime);
+			auto call = [&]()->RType { return applyTuple(func, args, std::index_sequence_for<Args...>()); };
+			promise.run(call);
+		};
+	}
+
+	// 带取消令牌的任务：执行前检查令牌，执行后检查有没有超过预算
+	// 提供isCancelled()，队列满了清理的时候能认出已经取消的任务
+	template<typename RType, typename Func, typename Tuple>
+	struct CancellableCall
+	{
+		template<typename F>
+		CancellableCall(BasicThreadPool* pool, Promise<RType>&& promise, const CancellationToken& token,
+			std::chrono::nanoseconds budget, F&& func, Tuple&& args)
+			: pool(pool)
+			, promise(std::move(promise))
+			, token(token)
+			, budget(budget)
+			, func(std::forward<F>(func))
+			, args(std::move(args))
+			, submitTime(std::chrono::steady_clock::now())
+		{}
+
+		void operator()()
+		{
+			recordQueueWait(submitTime);
+			if (token.isCancelled())
+			{
+				pool->cancelledTaskSize_++;
+				promise.setException(std::make_exception_ptr(TaskCancelledError()));
+				return;
+			}
+
+			auto begin = std::chrono::steady_clock::now();
+			auto call = [&]()->RType { return applyTuple(func, args, std::make_index_sequence<std::tuple_size<Tuple>::value>()); };
+			promise.run(call);
+			if (budget.count() > 0)
+			{
+				uint64_t elapsed = elapsedNanos(begin);
+				if (elapsed > (uint64_t)budget.count())
+				{
+					WorkerStats* stats = currentWorker().stats;
+					if (stats != nullptr)
+						stats->addOverrun();
+					THREADPOOL_LOG_INFO("task ran %lld ns, over its budget of %lld ns", (long long)elapsed, (long long)budget.count());
+				}
+			}
+		}
+
+		bool isCancelled() const
+		{
+			return token.isCancelled();
+		}
+
+		BasicThreadPool* pool;
+		Promise<RType> promise;
+		CancellationToken token;
+		std::chrono::nanoseconds budget;
+		Func func;
+		Tuple args;
+		std::chrono::steady_clock::time_point submitTime;
+	};
+
+	// 把已经取消的任务从有锁队列里挪到cancelled，调用时持有taskQueMtx_，返回清掉的任务数
+	// 从上次清理到现在没有CancellationSource被取消的话不用扫描
+	size_t purgeCancelledTasks(TaskLane& lane, std::vector<Task>& cancelled)
+	{
+		uint64_t epoch = CancellationSource::epoch().load(std::memory_order_acquire);
+		if (epoch == lane.purgeEpoch)
+			return 0;
+		lane.purgeEpoch = epoch;
+
+		size_t size = lane.taskQue.size();
+		size_t before = cancelled.size();
+		for (size_t i = 0; i < size; i++)
+		{
+			Task task(std::move(lane.taskQue.front()));
+			lane.taskQue.pop();
+			if (task.isCancelled())
+				cancelled.emplace_back(std::move(task));
+			else
+				lane.taskQue.emplace(std::move(task));
+		}
+		size_t purged = cancelled.size() - before;
+		lane.taskSize -= (int)purged;
+		taskSize_ -= (int)purged;
+		return purged;
+	}
+
+#ifdef THREADPOOL_HAS_PMR
+	// 放在memory_resource上的可调用对象，Task里只保存两个指针
+	template<typename Body>
+	struct ResourceTask
+	{
+		ResourceTask(std::pmr::memory_resource* resource, Body&& body)
+			: resource(resource)
+			, body(nullptr)
+		{
+			void* memory = resource->allocate(sizeof(Body), alignof(Body));
+			try
+			{
+				this->body = new (memory) Body(std::move(body));
+			}
+			catch (...)
+			{
+				resource->deallocate(memory, sizeof(Body), alignof(Body));
+				throw;
+			}
+		}
+		ResourceTask(ResourceTask&& other) noexcept
+			: resource(other.resource)
+			, body(std::exchange(other.body, nullptr))
+		{}
+		~ResourceTask()
+		{
+			if (body != nullptr)
+			{
+				body->~Body();
+				resource->deallocate(body, sizeof(Body), alignof(Body));
+			}
+		}
+		void operator()()
+		{
+			(*body)();
+		}
+
+		std::pmr::memory_resource* resource;
+		Body* body;
+	};
+#endif
+
+	template<size_t... Index, typename... Funcs>
+	auto submitAllImpl(std::index_sequence<Index...>, Funcs&&... funcs)
+		-> std::tuple<Future<decltype(funcs())>...>
+	{
+		std::tuple<Future<decltype(funcs())>...> results;
+		Task items[] = { packageTask(std::get<Index>(results), std::forward<Funcs>(funcs))... };
+
+		size_t pushed = pushTasks(items, sizeof...(Funcs));
+		if (pushed < sizeof...(Funcs))
+		{
+			logRejected();
+			// 没有放进去的任务换成默认值结果
+			int dummy[] = { (Index >= pushed ? (setFailed(std::get<Index>(results)), 0) : 0)... };
+			(void)dummy;
+		}
+		return results;
+	}
+
+	template<typename RType>
+	void setFailed(Future<RType>& result) const
+	{
+		result = rejectedFuture<RType>();
+	}
+
+	// when_all按顺序取出所有结果，有异常时抛出
+	template<typename T>
+	static std::vector<T> collectResults(std::vector<Future<T>>& futures)
+	{
+		std::vector<T> results;
+		results.reserve(futures.size());
+		for (Future<T>& future : futures)
+			results.push_back(future.get());
+		return results;
+	}
+
+	static void collectResults(std::vector<Future<void>>& futures)
+	{
+		for (Future<void>& future : futures)
+			future.get();
+	}
+
+#ifdef THREADPOOL_HAS_COROUTINE
+	// 先切换到线程池的线程，再执行协程，结果或者异常写入promise
+	template<typename T>
+	static DetachedCoroutine spawnImpl(BasicThreadPool* pool, CoroTask<T> task, Promise<T> promise)
+	{
+		std::exception_ptr exception;
+		try
+		{
+			co_await pool->schedule();
+			if constexpr (std::is_void<T>::value)
+			{
+				co_await std::move(task);
+				auto call = []() {};
+				promise.run(call);
+			}
+			else
+			{
+				T value = co_await std::move(task);
+				auto call = [&]()->T { return std::move(value); };
+				promise.run(call);
+			}
+			co_return;
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+		auto call = [&]()->T { std::rethrow_exception(exception); };
+		promise.run(call);
+	}
+#endif
+
+	// 前一个任务完成时调度后续任务：在本线程池的线程上并且嵌套不深时直接执行，省掉一次入队和唤醒，
+	// 否则放进任务队列，队列满了由当前线程执行，后续任务不会被拒绝
+	void scheduleContinuation(Task& task)
+	{
+		WorkerContext& context = currentWorker();
+		if (context.pool == this && context.continuationDepth < CONTINUATION_MAX_DEPTH)
+		{
+			context.continuationDepth++;
+			task();
+			context.continuationDepth--;
+			return;
+		}
+		pushTask(task, TaskPriority::PRIORITY_NORMAL, BackpressurePolicy::POLICY_CALLER_RUNS);
+	}
+
+	// 按照块大小切分区间，选择合适的方式分发给线程池执行，所有块执行完才返回
+	template<typename Index, typename ChunkBody>
+	void parallelChunks(Index first, size_t count, size_t chunk, ChunkBody& chunkBody)
+	{
+		using Diff = decltype(first - first);
+		size_t chunks = (count + chunk - 1) / chunk;
+		auto run = [first, count, chunk, &chunkBody](size_t index)
+		{
+			Index begin = first + (Diff)(index * chunk);
+			Index end = first + (Diff)std::min(count, (index + 1) * chunk);
+			chunkBody(begin, end, index);
+		};
+
+		// 只有一块的话没必要放到线程池里
+		auto state = std::make_shared<ParallelState>(chunks);
+		if (chunks == 1)
+		{
+			state->runChunk(run, 0);
+			state->wait();
+			return;
+		}
+
+		if (poolMode() == PoolMode::MODE_WORK_STEALING && currentWorker().pool == this)
+		{
+			// 调用线程自己从整个区间开始二分，分出去的任务放入自己的队列再继续二分
+			// 外部线程不走这里：分出去的任务会进入共享队列，可能被POLICY_DROP_OLDEST丢掉
+			splitChunks(state, &run, 0, chunks);
+			// 线程池自己的线程在等待时继续执行其它任务，否则嵌套的parallel_for可能把所有线程都卡住
+			while (!state->isDone())
+			{
+				if (!runPendingTask())
+					std::this_thread::yield();
+			}
+		}
+		else
+		{
+			// 每个线程一个领取任务，一次批量放入队列，调用线程自己也领取
+			size_t helpers = std::min(chunks - 1, (size_t)curThreadSize_);
+			std::vector<Task> items;
+			items.reserve(helpers);
+			for (size_t i = 0; i < helpers; i++)
+			{
+				const auto* runPtr = &run;
+				items.emplace_back([state, runPtr]() { state->claimChunks(runPtr); });
+			}
+			// 放不进去的块由调用线程自己领取，不等待也不丢弃别的任务
+			pushTasks(items.data(), helpers, TaskPriority::PRIORITY_NORMAL, BackpressurePolicy::POLICY_FAIL_FAST);
+			state->claimChunks(&run);
+		}
+		state->wait();
+	}
+
+	// 工作窃取模式下递归二分[begin, end)，右半边作为新任务放入队列，左半边继续二分，最后执行剩下的一块
+	template<typename RunChunk>
+	void splitChunks(std::shared_ptr<ParallelState> state, const RunChunk* run, size_t begin, size_t end)
+	{
+		while (end - begin > 1)
+		{
+			size_t mid = begin + (end - begin) / 2;
+			Task task([this, state, run, mid, end]() { splitChunks(state, run, mid, end); });
+			// 队列满了放不进去，就自己把剩下的块都执行了
+			if (!pushTask(task, TaskPriority::PRIORITY_NORMAL, BackpressurePolicy::POLICY_FAIL_FAST))
+				break;
+			end = mid;
+		}
+		for (size_t i = begin; i < end; i++)
+		{
+			state->runChunk(*run, i);
+		}
+	}
+
+	// 计算parallel_for/parallel_reduce的块大小，grain为0时自动选择
+	size_t chunkSize(size_t count, size_t grain) const
+	{
+		size_t threads = (size_t)curThreadSize_ + 1; // 调用线程也参与
+		if (poolMode() == PoolMode::MODE_WORK_STEALING)
+		{
+			// 递归二分到grain为止，分得细一些，窃取的时候负载更均衡
+			if (grain == 0)
+				grain = count / (threads * 8);
+			return std::max(grain, (size_t)1);
+		}
+		// 静态切块：每个线程分到几块，领取得快的线程多领几块
+		size_t chunk = (count + threads * 4 - 1) / (threads * 4);
+		return std::max(std::max(grain, chunk), (size_t)1);
+	}
+
+	// parallel_transform/parallel_scan的切法：下标整体往前挪shift个元素，使每块（除了第一块）从输出的缓存行边界开始
+	// 相邻的块不会写同一个缓存行；chunk是缓存行的整数倍，chunks是块数
+	struct BulkLayout
+	{
+		size_t shift;
+		size_t chunk;
+		size_t chunks;
+	};
+
+	// data是输出的第一个元素的地址，不是内存里连续的输出（或者拿不到地址）时为nullptr，只按大小切块不对齐
+	BulkLayout bulkLayout(const void* data, size_t size, size_t count) const
+	{
+		size_t line = std::max((size_t)CACHE_LINE_SIZE / size, (size_t)1);
+		BulkLayout layout;
+		layout.shift = 0;
+		if (data != nullptr && CACHE_LINE_SIZE % size == 0 && (uintptr_t)data % size == 0)
+			layout.shift = (uintptr_t)data % CACHE_LINE_SIZE / size;
+		size_t total = count + layout.shift;
+		// 不超过缓存大小，区间小的时候按线程数切，但至少一个缓存行
+		size_t chunk = std::min(std::max(BULK_CHUNK_BYTES / size, line), chunkSize(total, 0));
+		layout.chunk = (chunk + line - 1) / line * line;
+		layout.chunks = (total + layout.chunk - 1) / layout.chunk;
+		return layout;
+	}
+
+	template<typename It>
+	static auto bulkAddress(It it, int) -> decltype(std::addressof(*it))
+	{
+		return std::addressof(*it);
+	}
+
+	// 输出是代理对象（比如vector<bool>）的时候拿不到地址
+	template<typename It>
+	static const void* bulkAddress(It, long)
+	{
+		return nullptr;
+	}
+
+	// 按layout把[0, count)切块并行执行chunkBody(begin, end, index)，index是块的序号
+	template<typename ChunkBody>
+	void bulkChunks(const BulkLayout& layout, size_t count, ChunkBody& chunkBody)
+	{
+		if (count == 0)
+			return;
+		size_t shift = layout.shift;
+		auto run = [shift, &chunkBody](size_t begin, size_t end, size_t index)
+		{
+			chunkBody(begin > shift ? begin - shift : 0, end - shift, index);
+		};
+		parallelChunks((size_t)0, count + shift, layout.chunk, run);
+	}
+
+	// parallel_sort的一轮归并：src中每两段相邻的长度为run的有序段归并到dst的同一位置
+	// 输出按piece切块并行执行，每块用二分查找算出从前一段取多少个元素，两段相等的元素前一段的在前
+	// 归并时元素从src移走，所以先算好所有块的起点再开始归并
+	template<typename Src, typename Dst, typename Compare>
+	void mergeRuns(Src src, Dst dst, size_t count, size_t run, size_t piece, Compare& comp)
+	{
+		// 第p块输出的起点在它所在的两段里的位置，以及前多少个输出来自前一段
+		auto locate = [&](size_t p, size_t& pair, size_t& sizeA, size_t& sizeB)
+		{
+			pair = p * piece / (2 * run) * (2 * run);
+			sizeA = std::min(run, count - pair);
+			sizeB = std::min(run, count - pair - sizeA);
+		};
+		size_t pieces = (count + piece - 1) / piece;
+		std::vector<size_t> starts(pieces);
+		for (size_t p = 0; p < pieces; p++)
+		{
+			size_t pair, sizeA, sizeB;
+			locate(p, pair, sizeA, sizeB);
+			Src a = src + pair;
+			Src b = a + sizeA;
+			size_t d = p * piece - pair;
+			size_t lo = d > sizeB ? d - sizeB : 0;
+			size_t hi = std::min(d, sizeA);
+			while (lo < hi)
+			{
+				size_t mid = lo + (hi - lo) / 2;
+				if (comp(b[d - mid - 1], a[mid]))
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+			starts[p] = lo;
+		}
+
+		auto mergePiece = [&](size_t begin, size_t end, size_t index)
+		{
+			size_t pair, sizeA, sizeB;
+			locate(index, pair, sizeA, sizeB);
+			Src a = src + pair;
+			Src b = a + sizeA;
+			// 最后一块或者到两段末尾的块，前一段一直取到结束
+			size_t i0 = starts[index];
+			size_t i1 = end - pair == sizeA + sizeB ? sizeA : starts[index + 1];
+			size_t j0 = begin - pair - i0;
+			size_t j1 = end - pair - i1;
+			std::merge(std::make_move_iterator(a + i0), std::make_move_iterator(a + i1),
+				std::make_move_iterator(b + j0), std::make_move_iterator(b + j1), dst + begin, comp);
+		};
+		parallelChunks((size_t)0, count, piece, mergePiece);
+	}
+
+	// 线程池自己的线程在等待时执行一个队列中的任务，没有任务返回false
+	bool runPendingTask()
+	{
+		Task task;
+		if (!tryGetTask(currentWorker().index, task))
+			return false;
+		if (!discardPending_)
+			runTask(task, currentWorker().stats);
+		else
+			cancelledTaskSize_++;
+		task = Task();
+		finishTask();
+		return true;
+	}
+
+	// 提交时令牌已经取消，返回一个已经就绪的结果，get()抛出TaskCancelledError
+	template<typename RType>
+	static Future<RType> cancelledFuture()
+	{
+		auto state = new FutureState<RType>();
+		Future<RType> result(state);
+		Promise<RType> promise(state);
+		promise.setException(std::make_exception_ptr(TaskCancelledError()));
+		return result;
+	}
+
+	// 提交失败时，返回一个已经就绪的结果，get()抛出TaskRejectedError，shutdown为true（线程池已经关闭）时抛出PoolShutdownError
+	template<typename RType>
+	static Future<RType> failedFuture(bool shutdown = false)
+	{
+		auto state = new FutureState<RType>();
+		Future<RType> result(state);
+		Promise<RType> promise(state);
+		auto call = [shutdown]()->RType
+		{
+			if (shutdown)
+				throw PoolShutdownError();
+			throw TaskRejectedError();
+		};
+		promise.run(call);
+		return result;
+	}
+
+	// 按线程池现在的状态区分提交失败的原因：已经关闭还是队列满了
+	template<typename RType>
+	Future<RType> rejectedFuture() const
+	{
+		return failedFuture<RType>(!isAcceptingTasks());
+	}
+
+	void logRejected() const
+	{
+		if (isAcceptingTasks())
+			THREADPOOL_LOG_WARN("task queue is full, submit task fail.");
+		else
+			THREADPOOL_LOG_WARN("thread pool has been shut down, submit task fail.");
+	}
+
+	// 当前线程所属的线程池和在线程池中的下标，用来判断任务是不是线程池内部的线程提交的
+	struct WorkerContext
+	{
+		BasicThreadPool* pool = nullptr;
+		int index = -1;
+		int node = -1;         // 线程绑定的CPU所在的NUMA节点，-1表示不属于任何节点
+		WorkerState* state = nullptr; // 线程自己的状态，线程池自己的线程才有
+		WorkerStats* stats = nullptr; // 线程的统计计数，就是state->stats
+		unsigned popCount = 0; // 从共享队列取任务的次数，用于防止低优先级任务饿死
+		unsigned stealStart = 0; // 没有自己队列的线程下一次从哪个队列开始窃取
+		int continuationDepth = 0; // 正在直接执行的后续任务嵌套层数
+		int blockingDepth = 0; // blockingRegion()的嵌套层数
+	};
+	static WorkerContext& currentWorker()
+	{
+		static thread_local WorkerContext context;
+		return context;
+	}
+
+	// 检查pool的运行状态
+	bool checkRunningState() const
+	{
+		return isPoolRunning_;
+	}
+
+	// 实际生效的工作模式和任务队列实现，编译期固定的策略下是常量
+	PoolMode poolMode() const
+	{
+		return GrowthPolicy::mode(poolMode_);
+	}
+
+	TaskQueMode taskQueMode() const
+	{
+		return QueuePolicy::mode(taskQueMode_);
+	}
+
+	// Future的后续任务调度到哪个线程池：ThreadPool调度到自己，其它配置返回nullptr，在完成任务的线程上直接执行
+	ThreadPool* continuationPool()
+	{
+		return continuationPoolOf(this);
+	}
+
+	static ThreadPool* continuationPoolOf(ThreadPool* pool) { return pool; }
+	static ThreadPool* continuationPoolOf(void*) { return nullptr; }
+
+	// Strand、执行器组、阻塞区域只支持ThreadPool
+	ThreadPool* defaultPool()
+	{
+		static_assert(std::is_same<BasicThreadPool, ThreadPool>::value, "only available on ThreadPool");
+		return continuationPoolOf(this);
+	}
+
+private:
+	// 成员按读写的频率分组，经常写的计数各自占一个缓存行，不和只读的配置、别的线程写的数据放在一起
+	// 组之间用一个缓存行大小的填充隔开，不用alignas，C++14下new ThreadPool也不需要对齐分配
+	// 每个线程每执行一个任务都要写的计数放在线程自己的WorkerState里，见WorkerState的说明
+
+	// 启动之前设置、之后基本只读的配置
+	std::unordered_map<int, std::unique_ptr<Thread>> threads_; // 线程列表，由taskQueMtx_保护
+	std::vector<std::unique_ptr<Thread>> exitedThreads_; // cached模式下自己退出、还没有join的线程（包括补偿线程），由taskQueMtx_保护
+	int initThreadSize_;  // 初始的线程数量
+	std::atomic_int threadSizeThreshHold_; // 线程数量上限阈值
+	std::atomic_int minThreadSize_; // cached模式下最少的线程数量，-1表示使用初始的线程数量
+	std::atomic_int spareThreadSize_; // cached模式下保持的空闲线程数量
+	std::atomic<std::chrono::milliseconds> threadIdleTimeout_; // cached模式下多余的线程空闲多久回收
+	std::atomic<std::chrono::microseconds> growLatency_; // cached模式下任务排队超过多久才增加线程
+	std::thread controller_; // cached模式的线程数量控制线程
+	Semaphore controllerSem_; // 提前唤醒控制线程
+	std::atomic_bool controllerWakeup_; // 这个检查周期已经唤醒过控制线程
+	std::chrono::milliseconds submitTimeout_; // POLICY_BLOCK下提交任务最长的等待时间
+	int highWatermark_; // 高水位，0表示不开启
+	int lowWatermark_; // 低水位
+	WatermarkCallback watermarkCallback_; // 越过高低水位时的回调
+	int taskQueMaxThreshHold_;  // 任务队列数量上限阈值
+	int idleSpinTime_; // 空闲线程挂起之前自旋的最长时间，单位：微秒，-1表示没有设置，start()时按CPU数量选默认值
+	std::vector<std::unique_ptr<WorkStealingQueue<Task>>> workQues_; // 初始的每个线程自己的任务队列，存放线程内部提交的普通任务
+	std::vector<std::unique_ptr<NodeTaskQueue>> nodeQues_; // 每个NUMA节点一个任务队列
+	CpuTopology topology_; // CPU拓扑
+	AffinityMode affinityMode_; // 工作线程绑定CPU的方式
+	std::vector<int> affinityCpus_; // AFFINITY_EXPLICIT模式下用户给定的CPU列表
+	std::vector<int> workerCpus_; // 每个线程绑定的CPU，-1表示不绑定
+	std::vector<int> workerNodes_; // 每个线程所在的NUMA节点，-1表示不属于任何节点
+	BackpressurePolicy backpressurePolicy_; // 任务队列满了时的处理方式
+	PoolMode poolMode_; // 当前线程池的工作模式
+	TaskQueMode taskQueMode_; // 任务队列的实现方式
+
+	// 每次取任务或者执行完任务都要读、很少写的状态
+	std::atomic_bool isPoolRunning_; // 表示当前线程池的启动状态
+	std::atomic_bool isShutdown_; // 已经调用过shutdown()，不再接受外部线程提交的任务
+	std::atomic_bool discardPending_; // 关闭时丢弃排队的任务
+	std::atomic_int curThreadSize_;	// 记录当前线程池里面线程的总数量
+	std::atomic_bool overloaded_; // 超过了高水位，还没有降到低水位
+	std::atomic_int idleWaiterSize_; // 在waitIdle()中等待的线程数量
+	char readMostlyPadding_[CACHE_LINE_SIZE];
+
+	// 每次提交和取任务都要写的排队计数，单独一个缓存行
+	std::atomic_int taskSize_; // 任务的数量
+	std::atomic_int deadlineTaskSize_; // 带截止时间的任务数量，为0时取任务不用看截止时间
+	std::atomic_int nodeTaskSize_; // 所有节点队列里的任务数量，为0时取任务不用看节点队列
+	char taskSizePadding_[CACHE_LINE_SIZE];
+
+	// 挂起线程的空闲栈，线程挂起和被唤醒时写，每次提交任务读idleStackSize_
+	std::atomic_int idleStackSize_; // 挂起的线程数量，提交任务时不用拿锁就能判断要不要唤醒
+	std::mutex idleMtx_; // 保证空闲栈的线程安全
+	std::vector<Semaphore*> idleStack_; // 挂起的空闲线程，每个线程等在自己的信号量上
+	char idlePadding_[CACHE_LINE_SIZE];
+
+	// 有锁的共享队列，锁和队列本身一起被提交和取任务的线程写
+	std::mutex taskQueMtx_; // 保证任务队列的线程安全
+	TaskLane lanes_[TASK_PRIORITY_SIZE]; // 每个优先级一个任务队列  线程池安装，不会释放掉
+
+	// 执行器组，有组的任务可以执行时才会去拿锁
+	std::mutex groupMtx_; // 保护groups_、各组的队列和计数
+	std::vector<std::unique_ptr<ExecutorGroupState>> groups_; // 所有的执行器组
+	uint64_t groupVirtualTime_; // 最近一次开始执行的组任务的虚拟时间，空闲的组有新任务时从这里开始
+
+	// 很少写的计数和等待用的同步对象
+	std::atomic<uint64_t> rejectedTaskSize_; // 提交失败的任务数
+	std::atomic<uint64_t> droppedTaskSize_; // 被丢弃的任务数
+	std::atomic<uint64_t> callerRunsTaskSize_; // 由提交线程执行的任务数
+	std::atomic<uint64_t> cancelledTaskSize_; // 执行之前被取消的任务数
+	std::atomic_int blockedThreadSize_; // 在阻塞区域里的线程数量
+	std::atomic_int compensateThreadSize_; // 阻塞区域创建的、还没有退出的补偿线程数量
+	std::atomic_bool traceEnabled_; // 是否在记录跟踪事件
+	std::mutex traceMtx_; // 保护开始跟踪的时间
+	uint64_t traceStartTick_; // 开始跟踪时的traceClock()
+	std::chrono::steady_clock::time_point traceStartTime_; // 开始跟踪时的steady_clock
+	std::mutex idleWaitMtx_; // waitIdle()等待用的锁
+	std::condition_variable idleWaitCond_; // 表示线程池空闲了
+	std::vector<WorkerState*> workerStates_; // 还在运行的线程的状态，状态本身在各个线程的栈上
+	WorkerStatsSnapshot retiredStats_; // 已经退出的线程的计数汇总
+	std::mutex statsMtx_; // 保护workerStates_和retiredStats_
+	std::mutex shutdownMtx_; // 多个线程同时调用shutdown()时，保证返回时线程都已经回收
+	TimerWheel timerWheel_; // submitAfter/submitEvery的定时器，最后构造，最先停止
+
+	friend class FutureStateBase;
+	friend class TaskGraph;
+	friend class StrandState;
+	friend class Strand;
+	friend class ExecutorGroup;
+	friend class BlockingRegion;
+	friend class Reactor;
+};
+
+inline void FutureStateBase::runContinuation(Task& task, ThreadPool* pool)
+{
+	if (pool == nullptr)
+		task();
+	else
+		pool->scheduleContinuation(task);
+}
+
+inline BlockingRegion::~BlockingRegion()
+{
+	if (pool_ != nullptr)
+		pool_->leaveBlocking();
+}
+
+inline bool StrandState::schedule(BackpressurePolicy policy)
+{
+	Task task(Activation(shared_from_this(), ticket_.load(std::memory_order_acquire)));
+	if (pool_->pushTask(task, priority_, policy))
+		return true;
+	// 放不进去，作废这个激活任务的票号，析构时不当作被丢弃
+	ticket_.fetch_add(1, std::memory_order_acq_rel);
+	return false;
+}
+
+template<typename Func, typename... Args>
+auto ExecutorGroup::submitTask(Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+{
+	using RType = decltype(func(args...));
+	ThreadPool* pool = state_->pool;
+	auto state = new FutureState<RType>();
+	Future<RType> result(state, pool);
+	// 执行完归还配额，排队时间从放进组的队列开始算
+	ExecutorGroupState* group = state_;
+	Task item([group, promise = Promise<RType>(state), func = std::forward<Func>(func),
+		args = std::make_tuple(std::forward<Args>(args)...),
+		submitTime = std::chrono::steady_clock::now()]() mutable
+	{
+		ThreadPool::recordQueueWait(submitTime);
+		auto call = [&]()->RType { return applyTuple(func, args, std::index_sequence_for<Args...>()); };
+		promise.run(call);
+		group->pool->finishGroupTask(group);
+	});
+	if (!pool->pushGroupTask(group, item))
+		return pool->rejectedFuture<RType>();
+	return result;
+}
+
+inline int ExecutorGroup::getTaskSize() const
+{
+	std::lock_guard<std::mutex> lock(state_->pool->groupMtx_);
+	return (int)state_->taskQue.size();
+}
+
+inline int ExecutorGroup::getRunningSize() const
+{
+	std::lock_guard<std::mutex> lock(state_->pool->groupMtx_);
+	return state_->runningSize;
+}
+
+template<typename Func, typename... Args>
+auto Strand::submitTask(Func&& func, Args&&... args) -> Future<decltype(func(args...))>
+{
+	using RType = decltype(func(args...));
+	ThreadPool* pool = state_->pool();
+	if (!pool->isAcceptingTasks())
+	{
+		pool->rejectedTaskSize_++;
+		THREADPOOL_LOG_WARN("thread pool has been shut down, submit task fail.");
+		return ThreadPool::failedFuture<RType>(true);
+	}
+	Future<RType> result;
+	state_->push(pool->packageTask(result, std::forward<Func>(func), std::forward<Args>(args)...));
+	return result;
+}
+
+// 任务图：先声明好节点和依赖关系，之后可以反复执行，每次执行只申请一个结果状态
+// 一个节点的前驱全部完成之后才执行；完成的节点直接在同一个线程上接着执行一个就绪的后继，其余的放进任务队列
+// 有节点抛出异常之后，还没开始的节点不再执行，run()返回的Future得到第一个异常
+// 图里不能有环；上一次执行完成之前不能再次执行，执行期间也不能修改
+// TaskGraph graph;
+// auto a = graph.addNode([]{ ... }); auto b = graph.addNode([]{ ... });
+// graph.addEdge(a, b); graph.run(pool).get();
+class TaskGraph
+{
+public:
+	using NodeId = size_t;
+
+	TaskGraph()
+		: pool_(nullptr)
+		, pendingSize_(0)
+		, remaining_(0)
+		, failed_(false)
+		, runState_(nullptr)
+	{}
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	// 添加一个节点，返回节点编号
+	NodeId addNode(std::function<void()> work)
+	{
+		Node node;
+		node.work = std::move(work);
+		nodes_.emplace_back(std::move(node));
+		return nodes_.size() - 1;
+	}
+
+	// after依赖before，before完成之后after才能执行
+	void addEdge(NodeId before, NodeId after)
+	{
+		nodes_[before].successors.push_back(after);
+		nodes_[after].dependencySize++;
+	}
+
+	size_t size() const
+	{
+		return nodes_.size();
+	}
+
+	// 在pool上执行一遍整个图，所有节点完成之后返回的Future就绪
+	Future<void> run(ThreadPool& pool)
+	{
+		size_t size = nodes_.size();
+		// 节点数量没变的话，重复执行不需要重新申请计数
+		if (pendingSize_ < size)
+		{
+			pending_.reset(new std::atomic_int[size]);
+			pendingSize_ = size;
+		}
+		rootTasks_.clear();
+		for (size_t i = 0; i < size; i++)
+		{
+			pending_[i].store(nodes_[i].dependencySize, std::memory_order_relaxed);
+			if (nodes_[i].dependencySize == 0)
+				rootTasks_.emplace_back(NodeTask(this, i));
+		}
+		pool_ = &pool;
+		failed_ = false;
+		exception_ = nullptr;
+		remaining_ = size;
+
+		runState_ = new FutureState<void>();
+		Future<void> result(runState_, &pool);
+		if (size == 0)
+		{
+			finish();
+			return result;
+		}
+		// 根节点一次放进任务队列，放不进去的由当前线程执行
+		pool.pushTasks(rootTasks_.data(), rootTasks_.size(),
+			TaskPriority::PRIORITY_NORMAL, BackpressurePolicy::POLICY_CALLER_RUNS);
+		rootTasks_.clear();
+		return result;
+	}
+
+private:
+	struct Node
+	{
+		std::function<void()> work;
+		std::vector<NodeId> successors; // 依赖这个节点的节点
+		int dependencySize = 0; // 依赖的节点数量
+	};
+
+	// 放进任务队列的节点任务，只有两个指针大小，直接放在Task内部；
+	// 没有执行就被丢弃（比如被POLICY_DROP_OLDEST挤掉）时，把这次执行标记为失败，保证run()的结果一定会就绪
+	struct NodeTask
+	{
+		NodeTask(TaskGraph* graph, NodeId node)
+			: graph(graph)
+			, node(node)
+		{}
+		NodeTask(NodeTask&& other) noexcept
+			: graph(other.graph)
+			, node(other.node)
+		{
+			other.graph = nullptr;
+		}
+		~NodeTask()
+		{
+			if (graph != nullptr)
+				graph->abandonNode(node);
+		}
+		void operator()()
+		{
+			TaskGraph* g = graph;
+			graph = nullptr;
+			g->runNode(node);
+		}
+
+		TaskGraph* graph;
+		NodeId node;
+	};
+
+	// 执行一个节点，然后在同一个线程上接着执行它的第一个就绪的后继
+	void runNode(NodeId node)
+	{
+		while (true)
+		{
+			if (!failed_.load(std::memory_order_acquire))
+			{
+				try
+				{
+					nodes_[node].work();
+				}
+				catch (...)
+				{
+					setFailed(std::current_exception());
+				}
+			}
+
+			NodeId next = nodes_.size();
+			for (NodeId successor : nodes_[node].successors)
+			{
+				if (pending_[successor].fetch_sub(1, std::memory_order_acq_rel) != 1)
+					continue;
+				if (next == nodes_.size())
+					next = successor;
+				else
+					scheduleNode(successor);
+			}
+			if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				finish();
+				return;
+			}
+			if (next == nodes_.size())
+				return;
+			node = next;
+		}
+	}
+
+	void scheduleNode(NodeId node)
+	{
+		// 已经失败了，剩下的节点只需要往下传递完成计数，不用再进队列
+		if (failed_.load(std::memory_order_acquire))
+		{
+			runNode(node);
+			return;
+		}
+		Task task(NodeTask(this, node));
+		pool_->pushTask(task, TaskPriority::PRIORITY_NORMAL, BackpressurePolicy::POLICY_CALLER_RUNS);
+	}
+
+	void abandonNode(NodeId node)
+	{
+		setFailed(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+		runNode(node);
+	}
+
+	void setFailed(std::exception_ptr exception)
+	{
+		std::lock_guard<std::mutex> lock(exceptionMtx_);
+		if (!exception_)
+			exception_ = exception;
+		failed_.store(true, std::memory_order_release);
+	}
+
+	// 所有节点都完成了，写入这次执行的结果
+	void finish()
+	{
+		FutureState<void>* state = runState_;
+		runState_ = nullptr;
+		Promise<void> promise(state);
+		if (exception_)
+		{
+			state->setException(exception_);
+			return;
+		}
+		auto call = []() {};
+		promise.run(call);
+	}
+
+private:
+	std::vector<Node> nodes_;
+	std::vector<Task> rootTasks_; // 每次执行复用，避免重复申请
+	ThreadPool* pool_; // 正在执行的线程池
+	std::unique_ptr<std::atomic_int[]> pending_; // 每个节点还没完成的前驱数量
+	size_t pendingSize_;
+	std::atomic<size_t> remaining_; // 这次执行还没完成的节点数量
+	std::atomic_bool failed_;
+	std::exception_ptr exception_; // 第一个异常
+	std::mutex exceptionMtx_;
+	FutureState<void>* runState_; // 这次执行的结果状态
+};
+
+#ifdef __linux__
+// epoll事件关联的对象：IO线程的唤醒fd、监听socket或者连接
+struct ReactorSource
+{
+	enum Kind
+	{
+		SOURCE_WAKEUP,
+		SOURCE_LISTENER,
+		SOURCE_CONNECTION,
+	};
+
+	ReactorSource(Kind kind, int fd)
+		: kind(kind)
+		, fd(fd)
+	{}
+
+	Kind kind;
+	int fd;
+};
+
+// Reactor管理的一个连接，注册时带EPOLLONESHOT，同一时刻只有一个线程池线程在处理它，处理函数里不需要加锁
+// 连接关闭之后连同缓冲区一起放回空闲列表，给下一个连接复用
+class Connection : private ReactorSource
+{
+public:
+	Connection()
+		: ReactorSource(SOURCE_CONNECTION, -1)
+	{}
+
+	Connection(const Connection&) = delete;
+	Connection& operator=(const Connection&) = delete;
+
+	int getFd() const { return fd; }
+
+	// 已经读到、还没有consume的数据
+	const char* data() const { return input_.data() + readPos_; }
+	size_t size() const { return writePos_ - readPos_; }
+
+	// 处理函数用掉了开头的size个字节，剩下的留到下次数据到达时一起处理
+	void consume(size_t size)
+	{
+		readPos_ += std::min(size, this->size());
+		if (readPos_ == writePos_)
+			readPos_ = writePos_ = 0;
+	}
+
+	// 发送数据：先直接写socket，写不完的放进输出缓冲区，等可写时由线程池继续写
+	// 只能在处理函数里调用，连接已经出错时返回false
+	bool send(const void* data, size_t size)
+	{
+		if (error_)
+			return false;
+		const char* begin = static_cast<const char*>(data);
+		if (outputPos_ == output_.size())
+		{
+			output_.clear();
+			outputPos_ = 0;
+			size_t sent = writeSome(begin, size);
+			if (error_)
+				return false;
+			begin += sent;
+			size -= sent;
+		}
+		output_.insert(output_.end(), begin, begin + size);
+		return true;
+	}
+
+	// 处理函数返回之后关闭连接，输出缓冲区里的数据先写完
+	void close() { closing_ = true; }
+
+	// 用户数据，连接关闭之后释放
+	void setContext(std::shared_ptr<void> context) { context_ = std::move(context); }
+	const std::shared_ptr<void>& getContext() const { return context_; }
+
+private:
+	friend class Reactor;
+
+	// 非阻塞地写，返回写出去的字节数，写不下去就停
+	size_t writeSome(const char* data, size_t size)
+	{
+		size_t sent = 0;
+		while (sent < size)
+		{
+			ssize_t n = ::send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+			if (n > 0)
+			{
+				sent += (size_t)n;
+				continue;
+			}
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				error_ = true;
+			break;
+		}
+		return sent;
+	}
+
+	// 写输出缓冲区里剩下的数据，写完返回true
+	bool flushOutput()
+	{
+		outputPos_ += writeSome(output_.data() + outputPos_, output_.size() - outputPos_);
+		if (outputPos_ < output_.size())
+			return false;
+		output_.clear();
+		outputPos_ = 0;
+		return true;
+	}
+
+	// 读一次，空闲空间不够bufferSize时先把没处理的数据挪到开头，还不够再扩大；读到EOF或者出错返回false
+	// 一次事件只读一次，没读完的数据在重新注册之后（水平触发）会再产生事件，一个连接不会一直占着线程
+	bool readInput(size_t bufferSize)
+	{
+		if (input_.size() - writePos_ < bufferSize && readPos_ > 0)
+		{
+			std::copy(input_.begin() + readPos_, input_.begin() + writePos_, input_.begin());
+			writePos_ -= readPos_;
+			readPos_ = 0;
+		}
+		if (input_.size() - writePos_ < bufferSize)
+			input_.resize(writePos_ + bufferSize);
+		for (;;)
+		{
+			ssize_t n = ::read(fd, input_.data() + writePos_, input_.size() - writePos_);
+			if (n > 0)
+			{
+				writePos_ += (size_t)n;
+				return true;
+			}
+			if (n == 0)
+				return false;
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return true;
+			error_ = true;
+			return false;
+		}
+	}
+
+	// 放回空闲列表之前清空状态，缓冲区保留下来复用，太大的释放掉
+	void reset(size_t bufferSize)
+	{
+		fd = -1;
+		readPos_ = writePos_ = 0;
+		outputPos_ = 0;
+		output_.clear();
+		if (input_.size() > REACTOR_BUFFER_MAX_SIZE)
+			std::vector<char>(bufferSize).swap(input_);
+		if (output_.capacity() > REACTOR_BUFFER_MAX_SIZE)
+			std::vector<char>().swap(output_);
+		closing_ = false;
+		error_ = false;
+		connected_ = false;
+		armed_ = false;
+		context_.reset();
+	}
+
+	int loop_ = 0; // 所属的IO线程
+	std::vector<char> input_; // 读缓冲区，[readPos_, writePos_)是还没处理的数据
+	size_t readPos_ = 0;
+	size_t writePos_ = 0;
+	std::vector<char> output_; // 输出缓冲区，从outputPos_开始还没写出去
+	size_t outputPos_ = 0;
+	bool closing_ = false; // 处理函数调用了close()，或者对端已经关闭
+	bool error_ = false;
+	bool connected_ = false; // 已经调用过onConnect
+	bool armed_ = false; // 已经加入epoll
+	std::atomic_bool handoff_{ false }; // 重新注册之前release，下一个事件开始处理时acquire
+	std::shared_ptr<void> context_;
+};
+
+// 基于epoll的IO反应器：IO线程只负责epoll_wait和accept，读写和处理函数都在线程池里执行
+// 每次epoll_wait得到的所有事件整批放进线程池，只获取一次锁；队列满了由IO线程自己处理，IO线程处理不过来就不再取新的事件
+// Reactor reactor(pool);
+// reactor.setOnMessage([](Connection& conn) { conn.send(conn.data(), conn.size()); conn.consume(conn.size()); });
+// reactor.start();
+// reactor.addListener(listenfd);
+// Reactor必须在线程池之前析构；不能在处理函数里调用stop()
+class Reactor
+{
+public:
+	using Handler = std::function<void(Connection&)>;
+
+	explicit Reactor(ThreadPool& pool)
+		: pool_(pool)
+		, ioThreadSize_(1)
+		, maxEventSize_(REACTOR_MAX_EVENTS)
+		, bufferSize_(REACTOR_BUFFER_SIZE)
+		, priority_(TaskPriority::PRIORITY_NORMAL)
+		, isRunning_(false)
+		, nextLoop_(0)
+		, connectionSize_(0)
+		, pendingEventSize_(0)
+	{}
+
+	~Reactor()
+	{
+		stop();
+	}
+
+	Reactor(const Reactor&) = delete;
+	Reactor& operator=(const Reactor&) = delete;
+
+	// 设置IO线程数量，第一个IO线程负责accept，连接轮流分给各个IO线程
+	void setIoThreadSize(int size)
+	{
+		if (checkRunningState())
+			return;
+		ioThreadSize_ = std::max(size, 1);
+	}
+
+	// 设置每次epoll_wait最多取的事件数
+	void setMaxEventSize(int size)
+	{
+		if (checkRunningState())
+			return;
+		maxEventSize_ = std::max(size, 1);
+	}
+
+	// 设置每次读数据时至少留出的空闲空间，也是连接读缓冲区的初始大小
+	void setBufferSize(size_t size)
+	{
+		if (checkRunningState())
+			return;
+		bufferSize_ = std::max(size, (size_t)1);
+	}
+
+	// 设置事件任务在线程池里的优先级
+	void setPriority(TaskPriority priority)
+	{
+		if (checkRunningState())
+			return;
+		priority_ = priority;
+	}
+
+	// 新连接建立之后、开始读之前在线程池里调用一次
+	void setOnConnect(Handler handler)
+	{
+		if (checkRunningState())
+			return;
+		onConnect_ = std::move(handler);
+	}
+
+	// 有新数据到达时在线程池里调用，没用完的数据留在连接里
+	void setOnMessage(Handler handler)
+	{
+		if (checkRunningState())
+			return;
+		onMessage_ = std::move(handler);
+	}
+
+	// 连接关闭之前调用（对端关闭、出错、close()或者stop()）
+	void setOnClose(Handler handler)
+	{
+		if (checkRunningState())
+			return;
+		onClose_ = std::move(handler);
+	}
+
+	// 创建epoll和IO线程，失败时返回false
+	bool start()
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		if (isRunning_)
+			return true;
+		for (int i = 0; i < ioThreadSize_; i++)
+		{
+			std::unique_ptr<IoLoop> loop(new IoLoop());
+			loop->epfd = ::epoll_create1(EPOLL_CLOEXEC);
+			loop->fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			loops_.push_back(std::move(loop));
+			if (loops_.back()->epfd < 0 || loops_.back()->fd < 0
+				|| !control(*loops_.back(), EPOLL_CTL_ADD, loops_.back().get(), EPOLLIN))
+			{
+				THREADPOOL_LOG_ERROR("reactor start fail, errno:%d", errno);
+				closeLoops();
+				return false;
+			}
+		}
+		for (auto& listener : listeners_)
+		{
+			if (!control(*loops_[0], EPOLL_CTL_ADD, listener.get(), EPOLLIN))
+				THREADPOOL_LOG_ERROR("add listener fail, fd:%d errno:%d", listener->fd, errno);
+		}
+		isRunning_ = true;
+		for (int i = 0; i < ioThreadSize_; i++)
+		{
+			IoLoop* loop = loops_[i].get();
+			loop->thread = std::thread([this, loop]() { ioThreadFunc(*loop); });
+		}
+		return true;
+	}
+
+	// 停止IO线程，等正在处理的事件结束，再关闭剩下的所有连接；监听socket由调用者关闭
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			if (!isRunning_)
+				return;
+			isRunning_ = false;
+		}
+		for (auto& loop : loops_)
+		{
+			uint64_t one = 1;
+			ssize_t n = ::write(loop->fd, &one, sizeof(one));
+			(void)n;
+		}
+		for (auto& loop : loops_)
+		{
+			loop->thread.join();
+		}
+		{
+			std::unique_lock<std::mutex> lock(mtx_);
+			idleCond_.wait(lock, [&]()->bool { return pendingEventSize_ == 0; });
+		}
+		// IO线程都退出了，也没有在处理的事件，剩下的连接只有这个线程会碰
+		for (auto& conn : connections_)
+		{
+			if (conn->fd >= 0)
+				closeConnection(*conn);
+		}
+		std::lock_guard<std::mutex> lock(mtx_);
+		closeLoops();
+	}
+
+	// 监听一个已经listen的socket，会被设置成非阻塞；启动前后都可以调用
+	bool addListener(int listenfd)
+	{
+		if (!setNonBlocking(listenfd))
+			return false;
+		std::lock_guard<std::mutex> lock(mtx_);
+		listeners_.emplace_back(new ReactorSource(ReactorSource::SOURCE_LISTENER, listenfd));
+		if (isRunning_ && !control(*loops_[0], EPOLL_CTL_ADD, listeners_.back().get(), EPOLLIN))
+		{
+			THREADPOOL_LOG_ERROR("add listener fail, fd:%d errno:%d", listenfd, errno);
+			listeners_.pop_back();
+			return false;
+		}
+		return true;
+	}
+
+	// 接管一个已经连接的socket（比如主动connect出去的），之后由Reactor关闭；没有启动时返回false
+	bool addConnection(int fd)
+	{
+		if (!checkRunningState() || !setNonBlocking(fd))
+			return false;
+		Task task(EventTask(this, createConnection(fd), 0));
+		pool_.pushTask(task, priority_, BackpressurePolicy::POLICY_CALLER_RUNS);
+		return true;
+	}
+
+	// 当前打开的连接数量
+	int getConnectionSize() const
+	{
+		return connectionSize_;
+	}
+
+private:
+	// 一个IO线程，自己的fd是唤醒用的eventfd
+	struct IoLoop : ReactorSource
+	{
+		IoLoop()
+			: ReactorSource(SOURCE_WAKEUP, -1)
+		{}
+
+		int epfd = -1;
+		std::thread thread;
+	};
+
+	// 放进线程池的事件，events为0表示新连接；没有执行就被销毁（线程池丢弃了任务）时关闭连接
+	class EventTask
+	{
+	public:
+		EventTask(Reactor* reactor, Connection* conn, uint32_t events) noexcept
+			: reactor_(reactor)
+			, conn_(conn)
+			, events_(events)
+		{
+			reactor_->pendingEventSize_++;
+		}
+
+		EventTask(EventTask&& other) noexcept
+			: reactor_(other.reactor_)
+			, conn_(other.conn_)
+			, events_(other.events_)
+		{
+			other.reactor_ = nullptr;
+		}
+
+		EventTask(const EventTask&) = delete;
+		EventTask& operator=(const EventTask&) = delete;
+
+		~EventTask()
+		{
+			if (reactor_ != nullptr)
+			{
+				conn_->handoff_.load(std::memory_order_acquire);
+				reactor_->closeConnection(*conn_);
+				reactor_->finishEvent();
+			}
+		}
+
+		void operator()()
+		{
+			Reactor* reactor = reactor_;
+			reactor_ = nullptr;
+			reactor->handleEvent(*conn_, events_);
+			reactor->finishEvent();
+		}
+
+	private:
+		Reactor* reactor_;
+		Connection* conn_;
+		uint32_t events_;
+	};
+
+	bool checkRunningState() const
+	{
+		return isRunning_;
+	}
+
+	static bool setNonBlocking(int fd)
+	{
+		int flags = ::fcntl(fd, F_GETFL, 0);
+		if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		{
+			THREADPOOL_LOG_ERROR("set nonblocking fail, fd:%d errno:%d", fd, errno);
+			return false;
+		}
+		return true;
+	}
+
+	static bool control(IoLoop& loop, int op, ReactorSource* source, uint32_t events)
+	{
+		epoll_event event;
+		event.events = events;
+		event.data.ptr = source;
+		return ::epoll_ctl(loop.epfd, op, source->fd, &event) == 0;
+	}
+
+	// IO线程：等事件，accept新连接，把这一轮的所有事件整批放进线程池
+	void ioThreadFunc(IoLoop& loop)
+	{
+		std::vector<epoll_event> events(maxEventSize_);
+		std::vector<Task> tasks;
+		tasks.reserve(maxEventSize_);
+		while (isRunning_)
+		{
+			int size = ::epoll_wait(loop.epfd, events.data(), (int)events.size(), -1);
+			if (size < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				THREADPOOL_LOG_ERROR("epoll_wait fail, errno:%d", errno);
+				break;
+			}
+			for (int i = 0; i < size; i++)
+			{
+				ReactorSource* source = static_cast<ReactorSource*>(events[i].data.ptr);
+				switch (source->kind)
+				{
+				case ReactorSource::SOURCE_WAKEUP:
+				{
+					uint64_t value;
+					ssize_t n = ::read(loop.fd, &value, sizeof(value));
+					(void)n;
+					break;
+				}
+				case ReactorSource::SOURCE_LISTENER:
+					acceptConnections(source->fd, tasks);
+					break;
+				case ReactorSource::SOURCE_CONNECTION:
+					tasks.emplace_back(EventTask(this, static_cast<Connection*>(source), events[i].events));
+					break;
+				}
+			}
+			if (!tasks.empty())
+			{
+				// 队列满了由IO线程自己处理，相当于暂停取新的事件
+				pool_.pushTasks(tasks.data(), tasks.size(), priority_, BackpressurePolicy::POLICY_CALLER_RUNS);
+				tasks.clear();
+			}
+		}
+	}
+
+	// 水平触发，一次最多accept maxEventSize_个连接，剩下的下一轮再取
+	void acceptConnections(int listenfd, std::vector<Task>& tasks)
+	{
+		for (int i = 0; i < maxEventSize_; i++)
+		{
+			int fd = ::accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd >= 0)
+			{
+				tasks.emplace_back(EventTask(this, createConnection(fd), 0));
+				continue;
+			}
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				THREADPOOL_LOG_ERROR("accept fail, fd:%d errno:%d", listenfd, errno);
+			break;
+		}
+	}
+
+	// 优先从空闲列表取，复用之前连接的缓冲区
+	Connection* createConnection(int fd)
+	{
+		Connection* conn;
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			if (freeConnections_.empty())
+			{
+				connections_.emplace_back(new Connection());
+				conn = connections_.back().get();
+				conn->input_.resize(bufferSize_);
+			}
+			else
+			{
+				conn = freeConnections_.back();
+				freeConnections_.pop_back();
+			}
+		}
+		conn->fd = fd;
+		conn->loop_ = (int)(nextLoop_++ % (unsigned)loops_.size());
+		connectionSize_++;
+		return conn;
+	}
+
+	// 在线程池里处理一个事件，处理完重新注册，或者关闭连接
+	void handleEvent(Connection& conn, uint32_t events)
+	{
+		// 和上一个处理这个连接的线程同步，epoll本身的同步在C++内存模型里看不到
+		conn.handoff_.load(std::memory_order_acquire);
+		if (!conn.connected_)
+		{
+			conn.connected_ = true;
+			if (onConnect_)
+				onConnect_(conn);
+		}
+		else
+		{
+			if (events & EPOLLERR)
+				conn.error_ = true;
+			if ((events & EPOLLOUT) && !conn.error_)
+				conn.flushOutput();
+			if ((events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) && !conn.error_)
+			{
+				if (!conn.readInput(bufferSize_))
+					conn.closing_ = true;
+				if (conn.size() > 0 && onMessage_)
+					onMessage_(conn);
+			}
+		}
+
+		bool pendingOutput = conn.outputPos_ < conn.output_.size();
+		if (conn.error_ || (conn.closing_ && !pendingOutput))
+		{
+			closeConnection(conn);
+			return;
+		}
+		// 关闭之前只等输出写完，不再读
+		// 重新注册之后下一个事件可能马上在别的线程开始处理，这里之后不能再碰conn
+		uint32_t mask = EPOLLONESHOT | EPOLLRDHUP;
+		if (pendingOutput)
+			mask |= EPOLLOUT;
+		if (!conn.closing_)
+			mask |= EPOLLIN;
+		int op = conn.armed_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		conn.armed_ = true;
+		conn.handoff_.store(true, std::memory_order_release);
+		if (!control(*loops_[conn.loop_], op, &conn, mask))
+		{
+			conn.handoff_.load(std::memory_order_acquire);
+			THREADPOOL_LOG_ERROR("epoll_ctl fail, fd:%d errno:%d", conn.fd, errno);
+			closeConnection(conn);
+		}
+	}
+
+	// 关闭socket之后epoll自动删掉这个fd，连接放回空闲列表
+	void closeConnection(Connection& conn)
+	{
+		if (conn.connected_ && onClose_)
+			onClose_(conn);
+		::close(conn.fd);
+		conn.reset(bufferSize_);
+		connectionSize_--;
+		std::lock_guard<std::mutex> lock(mtx_);
+		freeConnections_.push_back(&conn);
+	}
+
+	void finishEvent()
+	{
+		if (--pendingEventSize_ == 0)
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			idleCond_.notify_all();
+		}
+	}
+
+	// 调用者持有mtx_
+	void closeLoops()
+	{
+		for (auto& loop : loops_)
+		{
+			if (loop->epfd >= 0)
+				::close(loop->epfd);
+			if (loop->fd >= 0)
+				::close(loop->fd);
+		}
+		loops_.clear();
+	}
+
+private:
+	ThreadPool& pool_;
+	int ioThreadSize_;
+	int maxEventSize_;
+	size_t bufferSize_;
+	TaskPriority priority_;
+	Handler onConnect_;
+	Handler onMessage_;
+	Handler onClose_;
+
+	std::atomic_bool isRunning_;
+	std::vector<std::unique_ptr<IoLoop>> loops_;
+	std::vector<std::unique_ptr<ReactorSource>> listeners_;
+	std::vector<std::unique_ptr<Connection>> connections_; // 所有创建过的连接对象，包括空闲的
+	std::vector<Connection*> freeConnections_; // 已经关闭、可以复用的连接对象
+	std::atomic<unsigned> nextLoop_; // 下一个连接分给哪个IO线程
+	std::atomic_int connectionSize_;
+	std::atomic_int pendingEventSize_; // 已经放进线程池、还没处理完的事件数
+	std::mutex mtx_; // 保护loops_、listeners_、连接列表
+	std::condition_variable idleCond_; // 表示没有在处理的事件了
 };
+#endif // __linux__
 
 #endif
@@ -6,6 +6,7 @@
 #include <thread>
 #include <future>
 #include <chrono>
+#include <vector>
 using namespace std;
 
 #include "threadpool.h"
@@ -50,27 +51,27 @@ int main()
     // pool.setMode(PoolMode::MODE_CACHED);
     pool.start(2);
 
-    future<int> r1 = pool.submitTask(sum1, 1, 2);
-    future<int> r2 = pool.submitTask(sum2, 1, 2, 3);
-    future<int> r3 = pool.submitTask([](int b, int e)->int {
+    Future<int> r1 = pool.submitTask(sum1, 1, 2);
+    Future<int> r2 = pool.submitTask(sum2, 1, 2, 3);
+    Future<int> r3 = pool.submitTask([](int b, int e)->int {
         int sum = 0;
         for (int i = b; i <= e; i++)
             sum += i;
         return sum;
         }, 1, 100);     // [] 作用域问题。
-    future<int> r4 = pool.submitTask([](int b, int e)->int {
+    Future<int> r4 = pool.submitTask([](int b, int e)->int {
         int sum = 0;
         for (int i = b; i <= e; i++)
             sum += i;
         return sum;
         }, 1, 100);
-    future<int> r5 = pool.submitTask([](int b, int e)->int {
+    Future<int> r5 = pool.submitTask([](int b, int e)->int {
         int sum = 0;
         for (int i = b; i <= e; i++)
             sum += i;
         return sum;
         }, 1, 100);
-    //future<int> r4 = pool.submitTask(sum1, 1, 2);
+    //Future<int> r4 = pool.submitTask(sum1, 1, 2);
 
     cout << r1.get() << endl;
     cout << r2.get() << endl;
@@ -78,6 +79,22 @@ int main()
     cout << r4.get() << endl;
     cout << r5.get() << endl;
 
+    // 同样是求 1 + ... + 100，交给线程池切块并行计算，当前线程也参与计算
+    int sum = pool.parallel_reduce(1, 101, 0,
+        [](int i)->int { return i; },
+        [](int a, int b)->int { return a + b; });
+    cout << sum << endl;
+
+    // 数组按缓存大小切块并行处理：100个1原地求前缀和得到1..100，再求一次前缀和，最后一个就是总和
+    vector<int> nums(100, 1), prefix(100);
+    pool.parallel_scan(nums.begin(), nums.end(), nums.begin(), 0, [](int a, int b)->int { return a + b; });
+    pool.parallel_scan(nums.begin(), nums.end(), prefix.begin(), 0, [](int a, int b)->int { return a + b; });
+    cout << prefix.back() << endl;
+
+    // 任务完成之后接着在线程池上执行后续任务
+    Future<int> r6 = pool.submitTask(sum1, 1, 2).then([](int v)->int { return v * 10; });
+    cout << r6.get() << endl;
+
 
     
 